@@ -2,15 +2,31 @@
 #define ASSEMBLE_H
 
 #include <boost/progress.hpp>
+#include <boost/icl/interval_set.hpp>
 
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <map>
 #include "msa.h"
+#include "refcache.h"
 #include "split.h"
 #include "gotoh.h"
 #include "needle.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 namespace torali
 {
+
+  #ifndef DELLY_CONSENSUS_BATCH
+  #define DELLY_CONSENSUS_BATCH 256
+  #endif
+
+  #ifndef DELLY_ASSEMBLY_OFFSETS
+  #define DELLY_ASSEMBLY_OFFSETS 16777216
+  #endif
+
   struct SeqSlice {
     int32_t svid;
     int32_t sstart;
@@ -20,10 +36,250 @@ namespace torali
     SeqSlice(int32_t const sv, int32_t const sst, int32_t const il, int32_t q) : svid(sv), sstart(sst), inslen(il), qual(q) {}
   };
 
+  // Primary alignments of one chromosome and sample collected for assembly, BGZF virtual offsets in file order
+  struct AssemblyReads {
+    int32_t refIndex;
+    uint32_t file_c;
+    bool indexed;  // CRAM/SAM input, a sample over the offset budget or split-reads without a collected primary, assembly rescans the chromosome
+    std::vector<std::pair<int64_t, std::size_t> > offsets;  // (virtual offset, read hash)
+    std::vector<std::size_t> seeds;  // Reads with junctions on this chromosome, sorted
+
+    AssemblyReads() : refIndex(-1), file_c(0), indexed(false) {}
+    AssemblyReads(int32_t const r, uint32_t const f) : refIndex(r), file_c(f), indexed(false) {}
+  };
+
+  // Primary alignment outside the scanned intervals, located with the SA tag of a supplementary alignment
+  struct PrimaryLookup {
+    int32_t refIndex;
+    int32_t pos;
+    std::size_t seed;
+
+    PrimaryLookup(int32_t const r, int32_t const p, std::size_t const s) : refIndex(r), pos(p), seed(s) {}
+
+    bool operator<(PrimaryLookup const& pl) const {
+      return ((refIndex < pl.refIndex) || ((refIndex == pl.refIndex) && (pos < pl.pos)) || ((refIndex == pl.refIndex) && (pos == pl.pos) && (seed < pl.seed)));
+    }
+  };
+
+  // Region reader, BAM files are read sequentially from the first index chunk so that every alignment comes with its virtual offset
+  struct OffsetReader {
+    samFile* fp;
+    hts_itr_t* iter;
+    bool bgzf;
+    bool done;
+    int32_t tid;
+    int32_t beg;
+    int32_t end;
+  };
+
+  inline void
+  _offsetReaderOpen(OffsetReader& r, samFile* fp, hts_idx_t* idx, int32_t const tid, int32_t const beg, int32_t const end) {
+    r.fp = fp;
+    r.iter = sam_itr_queryi(idx, tid, beg, end);
+    r.bgzf = ((r.iter != NULL) && (hts_get_format(fp)->format == bam));
+    r.done = false;
+    r.tid = tid;
+    r.beg = beg;
+    r.end = end;
+    if (r.bgzf) {
+      if ((r.iter->n_off == 0) || (bgzf_seek(fp->fp.bgzf, r.iter->off[0].u, SEEK_SET) < 0)) r.done = true;
+    }
+  }
+
+  // Same alignments in the same order as sam_itr_next, the virtual offset is -1 for CRAM/SAM
+  inline int32_t
+  _offsetReaderNext(OffsetReader& r, bam1_t* rec, int64_t& voffset) {
+    voffset = -1;
+    if (!r.bgzf) return sam_itr_next(r.fp, r.iter, rec);
+    while (!r.done) {
+      int64_t off = bgzf_tell(r.fp->fp.bgzf);
+      int32_t ret = bam_read1(r.fp->fp.bgzf, rec);
+      if ((ret < 0) || (rec->core.tid != r.tid) || (rec->core.pos >= r.end)) r.done = true;
+      else if (bam_endpos(rec) > r.beg) {
+	voffset = off;
+	return ret;
+      }
+    }
+    return -1;
+  }
+
+  inline void
+  _offsetReaderClose(OffsetReader& r) {
+    if (r.iter != NULL) hts_itr_destroy(r.iter);
+    r.iter = NULL;
+  }
+
+  inline bool
+  _samePrimaryLookup(PrimaryLookup const& a, PrimaryLookup const& b) {
+    return ((a.refIndex == b.refIndex) && (a.pos == b.pos) && (a.seed == b.seed));
+  }
+
+  // Too many offsets for one sample, assembly rescans the chromosome instead
+  inline void
+  _assemblyReadsDrop(AssemblyReads& ar) {
+    ar.indexed = false;
+    std::vector<std::pair<int64_t, std::size_t> >().swap(ar.offsets);
+    std::vector<std::size_t>().swap(ar.seeds);
+  }
+
+  // Only primary alignments carry the full read sequence, split-reads need a large indel, a clip or a supplementary alignment
+  template<typename TConfig>
+  inline void
+  _assemblyRead(TConfig const& c, AssemblyReads& ar, bam1_t* rec, int64_t const voffset) {
+    if ((!ar.indexed) || (voffset < 0)) return;
+    if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) return;
+    bool split = (bam_aux_get(rec, "SA") != NULL);
+    uint32_t* cigar = bam_get_cigar(rec);
+    for (std::size_t i = 0; ((!split) && (i < rec->core.n_cigar)); ++i) {
+      if ((bam_cigar_op(cigar[i]) == BAM_CDEL) || (bam_cigar_op(cigar[i]) == BAM_CINS)) {
+	if (bam_cigar_oplen(cigar[i]) > c.minRefSep) split = true;
+      } else if ((bam_cigar_op(cigar[i]) == BAM_CSOFT_CLIP) || (bam_cigar_op(cigar[i]) == BAM_CHARD_CLIP)) {
+	if (bam_cigar_oplen(cigar[i]) > c.minClip) split = true;
+      }
+    }
+    if (!split) return;
+    if (ar.offsets.size() >= DELLY_ASSEMBLY_OFFSETS) _assemblyReadsDrop(ar);
+    else ar.offsets.push_back(std::make_pair(voffset, hash_lr(rec)));
+  }
+
+  // Supplementary alignments whose primary alignment (first SA entry) starts in an excluded gap of a scanned chromosome
+  template<typename TValidRegion>
+  inline void
+  _assemblyLookup(TValidRegion const& validRegions, std::map<std::string, int32_t> const& chrMap, bam1_t* rec, std::vector<PrimaryLookup>& lookups) {
+    if (!(rec->core.flag & BAM_FSUPPLEMENTARY)) return;
+    if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY)) return;
+    uint8_t* sa = bam_aux_get(rec, "SA");
+    if (sa == NULL) return;
+    char* saStr = bam_aux2Z(sa);
+    if (saStr == NULL) return;
+    std::string entry(saStr, std::strcspn(saStr, ";"));
+    std::size_t k1 = entry.find(',');
+    if (k1 == std::string::npos) return;
+    std::size_t k2 = entry.find(',', k1 + 1);
+    if (k2 == std::string::npos) return;
+    std::map<std::string, int32_t>::const_iterator itChr = chrMap.find(entry.substr(0, k1));
+    if ((itChr == chrMap.end()) || (validRegions[itChr->second].empty())) return;
+    int32_t tid = itChr->second;
+    int32_t pos = std::atoi(entry.substr(k1 + 1, k2 - k1 - 1).c_str()) - 1;
+    if ((pos < 0) || (boost::icl::contains(validRegions[tid], (uint32_t) pos))) return;
+    lookups.push_back(PrimaryLookup(tid, pos, hash_lr(rec)));
+  }
+
+  // Alignments overlapping several scanned intervals are collected once, only reads in the store are kept
+  template<typename TReadStore>
+  inline void
+  _assemblyReadsFinalize(AssemblyReads& ar, TReadStore const& store) {
+    std::sort(ar.offsets.begin(), ar.offsets.end());
+    uint32_t k = 0;
+    for(uint32_t i = 0; i < ar.offsets.size(); ++i) {
+      if ((k) && (ar.offsets[k-1].first == ar.offsets[i].first)) continue;
+      if (store.find(ar.offsets[i].second) == store.end()) continue;
+      ar.offsets[k++] = ar.offsets[i];
+    }
+    ar.offsets.resize(k);
+    std::vector<std::pair<int64_t, std::size_t> >(ar.offsets).swap(ar.offsets);
+  }
+
+  // Junctions from secondary alignments only leave the primary alignment uncollected, such samples are rescanned
+  template<typename TReadStore>
+  inline void
+  _assemblyReadsComplete(uint32_t const nfiles, std::vector<AssemblyReads>& asmReads, TReadStore const& store) {
+    for(uint32_t file_c = 0; file_c < nfiles; ++file_c) {
+      std::vector<std::size_t> collected;
+      for(uint32_t task = 0; task < asmReads.size(); ++task) {
+	if (asmReads[task].file_c != file_c) continue;
+	for(uint32_t i = 0; i < asmReads[task].offsets.size(); ++i) collected.push_back(asmReads[task].offsets[i].second);
+      }
+      std::sort(collected.begin(), collected.end());
+      bool complete = true;
+      for(uint32_t task = 0; ((complete) && (task < asmReads.size())); ++task) {
+	if (asmReads[task].file_c != file_c) continue;
+	std::vector<std::size_t> const& seeds = asmReads[task].seeds;
+	for(uint32_t i = 0; ((complete) && (i < seeds.size())); ++i) {
+	  if ((store.find(seeds[i]) != store.end()) && (!std::binary_search(collected.begin(), collected.end(), seeds[i]))) complete = false;
+	}
+      }
+      for(uint32_t task = 0; task < asmReads.size(); ++task) {
+	if (asmReads[task].file_c != file_c) continue;
+	if (complete) std::vector<std::size_t>().swap(asmReads[task].seeds);
+	else _assemblyReadsDrop(asmReads[task]);
+      }
+    }
+  }
+
+
+  // Consensus of SVs with enough split-reads, one SV per worker at a time bounds the alignment matrices in memory
+  template<typename TConfig, typename TSVSequences>
+  inline void
+  _assembleConsensus(TConfig const& c, bam_hdr_t* hdr, char* seq, std::vector<StructuralVariantRecord>& svs, TSVSequences& seqStore, std::vector<int32_t>& pending) {
+#pragma omp parallel for default(shared) schedule(dynamic)
+    for(int32_t i = 0; i < (int32_t) pending.size(); ++i) {
+      int32_t svid = pending[i];
+      bool msaSuccess = false;
+      if (seqStore[svid].size() > 1) {
+	//std::cerr << svs[svid].svStart << ',' << svs[svid].svEnd << ',' << svs[svid].svt << ',' << svid << " SV" << std::endl;
+	msa(c, seqStore[svid], svs[svid].consensus);
+	//std::cerr << svs[svid].consensus << std::endl;
+	if (alignConsensus(c, hdr, seq, NULL, svs[svid])) msaSuccess = true;
+      }
+      if (!msaSuccess) {
+	svs[svid].consensus = "";
+	svs[svid].srSupport = 0;
+	svs[svid].srAlignQuality = 0;
+      }
+      typename TSVSequences::value_type().swap(seqStore[svid]);
+    }
+    pending.clear();
+  }
+
+  template<typename TConfig, typename TSRStore, typename TSVSequences>
+  inline void
+  _assembleRecord(TConfig const& c, int32_t const refIndex, bam1_t* rec, std::size_t const seed, std::vector<StructuralVariantRecord>& svs, TSRStore& srStore, TSVSequences& seqStore, std::vector<bool>& svcons, std::vector<int32_t>& pending, uint32_t const maxReadPerSV) {
+    if (srStore.find(seed) != srStore.end()) {
+      for(uint32_t ri = 0; ri < srStore[seed].size(); ++ri) {
+	int32_t svid = srStore[seed][ri].svid;
+	//std::cerr << svs[svid].svStart << ',' << svs[svid].svEnd << ',' << svs[svid].svt << ',' << svid << " SV" << std::endl;
+	//std::cerr << seed << '\t' << srStore[seed][ri].svid << '\t' << srStore[seed][ri].sstart << '\t' << srStore[seed][ri].inslen << '\t' << sv[srStore[seed][ri].svid].srSupport << '\t' << sv[srStore[seed][ri].svid].svt << std::endl;
+
+	if (!svcons[svid]) {
+	  // Get sequence
+	  std::string sequence;
+	  sequence.resize(rec->core.l_qseq);
+	  uint8_t* seqptr = bam_get_seq(rec);
+	  for (int i = 0; i < rec->core.l_qseq; ++i) sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
+	  int32_t readlen = sequence.size();
+
+	  // Extract subsequence
+	  int32_t window = 2 * c.minimumFlankSize;
+	  int32_t sPos = srStore[seed][ri].sstart - window;
+	  int32_t ePos = srStore[seed][ri].sstart + srStore[seed][ri].inslen + window;
+	  if (rec->core.flag & BAM_FREVERSE) {
+	    sPos = (readlen - (srStore[seed][ri].sstart + srStore[seed][ri].inslen)) - window;
+	    ePos = (readlen - srStore[seed][ri].sstart) + window;
+	  }
+	  if (sPos < 0) sPos = 0;
+	  if (ePos > (int32_t) readlen) ePos = readlen;
+	  // Min. seq length and max insertion size, 10kbp?
+	  if (((ePos - sPos) > window) && ((ePos - sPos) <= 10000)) {
+	    std::string seqalign = sequence.substr(sPos, (ePos - sPos));
+	    seqStore[svid].insert(seqalign);
+	      
+	    // Enough split-reads?
+	    if ((!_translocation(svs[svid].svt)) && (svs[svid].chr == refIndex)) {
+	      if ((seqStore[svid].size() == maxReadPerSV) || ((int32_t) seqStore[svid].size() == svs[svid].srSupport)) {
+		pending.push_back(svid);
+		svcons[svid] = true;
+	      }
+	    }
+	  }
+	}
+      }
+    }
+  }
 
   template<typename TConfig, typename TValidRegion, typename TSRStore>
   inline void
-    assemble(TConfig const& c, TValidRegion const& validRegions, std::vector<StructuralVariantRecord>& svs, TSRStore& srStore) {
+    assemble(TConfig const& c, TValidRegion const& validRegions, std::vector<StructuralVariantRecord>& svs, TSRStore& srStore, std::vector<AssemblyReads> const& asmReads) {
     // Sequence store
     typedef std::set<std::string> TSequences;
     typedef std::vector<TSequences> TSVSequences;
@@ -33,6 +289,9 @@ namespace torali
     std::vector<bool> svcons(svs.size(), false);
     uint32_t maxReadPerSV = 20;
 
+    // SVs waiting for consensus
+    std::vector<int32_t> pending;
+
     // Open file handles
     typedef std::vector<samFile*> TSamFile;
     typedef std::vector<hts_idx_t*> TIndex;
@@ -40,6 +299,7 @@ namespace torali
     TIndex idx(c.files.size());
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
+      ioThreadsAttach(samfile[file_c]);
       hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
       idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
     }
@@ -50,7 +310,7 @@ namespace torali
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Split-read assembly" << std::endl;
     boost::progress_display show_progress( hdr->n_targets );
 
-    faidx_t* fai = fai_load(c.genome.string().c_str());
+    uint32_t task = 0;
     for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
       ++show_progress;
       if (validRegions[refIndex].empty()) continue;
@@ -58,101 +318,61 @@ namespace torali
       // Load sequence
       int32_t seqlen = -1;
       std::string tname(hdr->target_name[refIndex]);
-      char* seq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex], &seqlen);
+      char* seq = fetchReference(c.genome, tname, seqlen);
     
       // Collect reads from all samples
       for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-	// Read alignments (full chromosome because primary alignments might be somewhere else)
-	hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, 0, hdr->target_len[refIndex]);
 	bam1_t* rec = bam_init1();
-	while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
-	  // Only primary alignments with the full sequence information
-	  if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
-
-	  std::size_t seed = hash_lr(rec);
-	  if (srStore.find(seed) != srStore.end()) {
-	    for(uint32_t ri = 0; ri < srStore[seed].size(); ++ri) {
-	      int32_t svid = srStore[seed][ri].svid;
-	      //std::cerr << svs[svid].svStart << ',' << svs[svid].svEnd << ',' << svs[svid].svt << ',' << svid << " SV" << std::endl;
-	      //std::cerr << seed << '\t' << srStore[seed][ri].svid << '\t' << srStore[seed][ri].sstart << '\t' << srStore[seed][ri].inslen << '\t' << sv[srStore[seed][ri].svid].srSupport << '\t' << sv[srStore[seed][ri].svid].svt << std::endl;
-
-	      if (!svcons[svid]) {
-		// Get sequence
-		std::string sequence;
-		sequence.resize(rec->core.l_qseq);
-		uint8_t* seqptr = bam_get_seq(rec);
-		for (int i = 0; i < rec->core.l_qseq; ++i) sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
-		int32_t readlen = sequence.size();
-
-		// Extract subsequence
-		int32_t window = 2 * c.minimumFlankSize;
-		int32_t sPos = srStore[seed][ri].sstart - window;
-		int32_t ePos = srStore[seed][ri].sstart + srStore[seed][ri].inslen + window;
-		if (rec->core.flag & BAM_FREVERSE) {
-		  sPos = (readlen - (srStore[seed][ri].sstart + srStore[seed][ri].inslen)) - window;
-		  ePos = (readlen - srStore[seed][ri].sstart) + window;
-		}
-		if (sPos < 0) sPos = 0;
-		if (ePos > (int32_t) readlen) ePos = readlen;
-		// Min. seq length and max insertion size, 10kbp?
-		if (((ePos - sPos) > window) && ((ePos - sPos) <= 10000)) {
-		  std::string seqalign = sequence.substr(sPos, (ePos - sPos));
-		  seqStore[svid].insert(seqalign);
-	      
-		  // Enough split-reads?
-		  if ((!_translocation(svs[svid].svt)) && (svs[svid].chr == refIndex)) {
-		    if ((seqStore[svid].size() == maxReadPerSV) || ((int32_t) seqStore[svid].size() == svs[svid].srSupport)) {
-		      bool msaSuccess = false;
-		      if (seqStore[svid].size() > 1) {
-			//std::cerr << svs[svid].svStart << ',' << svs[svid].svEnd << ',' << svs[svid].svt << ',' << svid << " SV" << std::endl;
-			//for(typename TSequences::iterator it = seqStore[svid].begin(); it != seqStore[svid].end(); ++it) std::cerr << *it << std::endl;
-			msa(c, seqStore[svid], svs[svid].consensus);
-			//std::cerr << svs[svid].consensus << std::endl;
-			if (alignConsensus(c, hdr, seq, NULL, svs[svid])) msaSuccess = true;
-			//std::cerr << msaSuccess << std::endl;
-		      }
-		      if (!msaSuccess) {
-			svs[svid].consensus = "";
-			svs[svid].srSupport = 0;
-			svs[svid].srAlignQuality = 0;
-		      }
-		      seqStore[svid].clear();
-		      svcons[svid] = true;
-		    }
-		  }
-		}
-	      }
+	uint64_t nread = 0;
+	bool rescan = true;
+	if ((task < asmReads.size()) && (asmReads[task].refIndex == refIndex) && (asmReads[task].file_c == file_c) && (asmReads[task].indexed)) {
+	  // Seek to the primary alignments collected during split-read scanning, file order as in the full scan
+	  AssemblyReads const& ar = asmReads[task];
+	  rescan = false;
+	  for(uint32_t i = 0; i < ar.offsets.size(); ++i) {
+	    if (srStore.find(ar.offsets[i].second) == srStore.end()) continue;
+	    if ((bgzf_seek(samfile[file_c]->fp.bgzf, ar.offsets[i].first, SEEK_SET) < 0) || (bam_read1(samfile[file_c]->fp.bgzf, rec) < 0) || (hash_lr(rec) != ar.offsets[i].second)) {
+	      // Sequences are kept in sets, reads assembled so far are not duplicated by the rescan
+	      std::cerr << "Warning: Failed to read alignment at offset " << ar.offsets[i].first << " of " << c.files[file_c].string() << ", rescanning " << hdr->target_name[refIndex] << std::endl;
+	      rescan = true;
+	      break;
 	    }
+	    ++nread;
+	    _assembleRecord(c, refIndex, rec, ar.offsets[i].second, svs, srStore, seqStore, svcons, pending, maxReadPerSV);
+	    if (pending.size() >= DELLY_CONSENSUS_BATCH) _assembleConsensus(c, hdr, seq, svs, seqStore, pending);
 	  }
 	}
+	if (rescan) {
+	  // Read alignments (full chromosome because primary alignments might be somewhere else)
+	  hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, 0, hdr->target_len[refIndex]);
+	  while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
+	    ++nread;
+	    // Only primary alignments with the full sequence information
+	    if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
+	    _assembleRecord(c, refIndex, rec, hash_lr(rec), svs, srStore, seqStore, svcons, pending, maxReadPerSV);
+	    if (pending.size() >= DELLY_CONSENSUS_BATCH) _assembleConsensus(c, hdr, seq, svs, seqStore, pending);
+	  }
+	  hts_itr_destroy(iter);
+	}
+	if ((task < asmReads.size()) && (asmReads[task].refIndex == refIndex) && (asmReads[task].file_c == file_c)) ++task;
 	bam_destroy1(rec);
-	hts_itr_destroy(iter);
+	metricsReads(nread);
       }
       // Handle left-overs
       for(uint32_t svid = 0; svid < svcons.size(); ++svid) {
 	if (!svcons[svid]) {
 	  if ((!_translocation(svs[svid].svt)) && (svs[svid].chr == refIndex)) {
-	    bool msaSuccess = false;
-	    if (seqStore[svid].size() > 1) {
-	      msa(c, seqStore[svid], svs[svid].consensus);
-	      if (alignConsensus(c, hdr, seq, NULL, svs[svid])) msaSuccess = true;
-	    }
-	    if (!msaSuccess) {
-	      svs[svid].consensus = "";
-	      svs[svid].srSupport = 0;
-	      svs[svid].srAlignQuality = 0;
-	    }
-	    seqStore[svid].clear();
+	    pending.push_back(svid);
 	    svcons[svid] = true;
 	  }
 	}
       }
+      _assembleConsensus(c, hdr, seq, svs, seqStore, pending);
       
       // Clean-up
-      if (seq != NULL) free(seq);
+      releaseReference(seq);
     }
     // Clean-up
-    fai_destroy(fai);
     bam_hdr_destroy(hdr);
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       hts_idx_destroy(idx[file_c]);
@@ -12,9 +12,18 @@ struct BoLog {
   typedef TPrecision value_type;
 
   std::vector<TPrecision> phred2prob;
+  // Per-read log10 likelihoods of an error (p), a correct alignment (1-p) and the heterozygous mixture
+  std::vector<TPrecision> logErr;
+  std::vector<TPrecision> logCorrect;
+  std::vector<TPrecision> logHet;
 
   BoLog() {
     for(int i = 0; i <= boost::math::round(-10 * SMALLEST_GL); ++i) phred2prob.push_back(std::pow(TPrecision(10), -(TPrecision(i)/TPrecision(10))));
+    for(uint32_t i = 0; i < phred2prob.size(); ++i) {
+      logErr.push_back(std::log10(phred2prob[i]));
+      logCorrect.push_back(std::log10(TPrecision(1) - phred2prob[i]));
+      logHet.push_back(std::log10(phred2prob[i] + (TPrecision(1) - phred2prob[i])));
+    }
   }
 };
 
@@ -29,14 +38,14 @@ struct BoLog {
    for(unsigned int geno=0; geno<=2; ++geno) gl[geno]=0;
    unsigned int peDepth=mapqRef.size() + mapqAlt.size();
    for(typename TMapqVector::const_iterator mapqRefIt = mapqRef.begin();mapqRefIt!=mapqRef.end();++mapqRefIt) {
-     gl[0] += std::log10(bl.phred2prob[*mapqRefIt]);
-     gl[1] += std::log10(bl.phred2prob[*mapqRefIt] + (FLP(1) - bl.phred2prob[*mapqRefIt]));
-     gl[2] += std::log10(FLP(1) - bl.phred2prob[*mapqRefIt]);
+     gl[0] += bl.logErr[*mapqRefIt];
+     gl[1] += bl.logHet[*mapqRefIt];
+     gl[2] += bl.logCorrect[*mapqRefIt];
    }
    for(typename TMapqVector::const_iterator mapqAltIt = mapqAlt.begin();mapqAltIt!=mapqAlt.end();++mapqAltIt) {
-     gl[0] += std::log10(FLP(1) - bl.phred2prob[*mapqAltIt]);
-     gl[1] += std::log10((FLP(1) - bl.phred2prob[*mapqAltIt]) + bl.phred2prob[*mapqAltIt]);
-     gl[2] += std::log10(bl.phred2prob[*mapqAltIt]);
+     gl[0] += bl.logCorrect[*mapqAltIt];
+     gl[1] += bl.logHet[*mapqAltIt];
+     gl[2] += bl.logErr[*mapqAltIt];
    }
    gl[1] += -FLP(peDepth) * std::log10(FLP(2));
    unsigned int glBest=0;
@@ -75,6 +75,176 @@ namespace torali
     }
   };
 
+  // Disjoint-set forest of graph components, labels follow creation order and merged components keep the smaller label
+  struct ComponentForest {
+    uint32_t numComp;
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> label;
+    std::vector<uint32_t> edgeCount;
+    std::vector<uint8_t> rank;
+
+    explicit ComponentForest(std::size_t const n) : numComp(0), parent(n), label(n, 0), edgeCount(n, 0), rank(n, 0) {
+      for(std::size_t i = 0; i < n; ++i) parent[i] = i;
+    }
+  };
+
+  // Find with path compression
+  inline uint32_t
+  _findComponent(ComponentForest& cf, uint32_t v) {
+    uint32_t root = cf.parent[v];
+    if (cf.parent[root] == root) return root;
+    while (cf.parent[root] != root) root = cf.parent[root];
+    while (cf.parent[v] != root) {
+      uint32_t next = cf.parent[v];
+      cf.parent[v] = root;
+      v = next;
+    }
+    return root;
+  }
+
+  // Join the components of u and v (union by rank), u is a root or has no component yet. Returns the root of the joint component.
+  inline uint32_t
+  _joinComponents(ComponentForest& cf, uint32_t const u, uint32_t const v) {
+    if ((cf.label[v]) && (cf.parent[v] == u)) return u;
+    if (!cf.label[u]) {
+      if (!cf.label[v]) {
+	// Both vertices have no component
+	cf.label[u] = ++cf.numComp;
+	cf.label[v] = cf.label[u];
+	cf.parent[v] = u;
+	cf.rank[u] = 1;
+	return u;
+      }
+      uint32_t rv = _findComponent(cf, v);
+      cf.label[u] = cf.label[rv];
+      cf.parent[u] = rv;
+      return rv;
+    }
+    uint32_t ru = u;
+    if (!cf.label[v]) {
+      cf.label[v] = cf.label[ru];
+      cf.parent[v] = ru;
+      return ru;
+    }
+    uint32_t rv = _findComponent(cf, v);
+    if (ru == rv) return ru;
+    // Merge components
+    if (cf.rank[ru] < cf.rank[rv]) std::swap(ru, rv);
+    else if (cf.rank[ru] == cf.rank[rv]) ++cf.rank[ru];
+    cf.parent[rv] = ru;
+    cf.label[ru] = std::min(cf.label[ru], cf.label[rv]);
+    cf.edgeCount[ru] += cf.edgeCount[rv];
+    return ru;
+  }
+
+  // Bucket the edges of the current graph window by component label
+  template<typename TEdgeList, typename TCompEdgeList>
+  inline void
+  _componentEdges(ComponentForest& cf, TEdgeList const& edges, TCompEdgeList& compEdge) {
+    for(typename TEdgeList::const_iterator itE = edges.begin(); itE != edges.end(); ++itE) compEdge[cf.label[_findComponent(cf, itE->source)]].push_back(*itE);
+  }
+
+  // Candidate edges of a growing clique, a min-heap of positions in the weight-sorted edge list
+  struct CliqueFrontier {
+    std::vector<uint32_t> vertices;
+    std::vector<uint32_t> source;
+    std::vector<uint32_t> target;
+    std::vector<uint32_t> offset;
+    std::vector<uint32_t> incident;
+    std::vector<uint32_t> local;
+    std::vector<uint32_t> fill;
+    std::vector<uint8_t> state;
+    std::vector<uint32_t> heap;
+  };
+
+  // Local vertex ids and incidence lists of a weight-sorted component edge list
+  template<typename TEdgeList>
+  inline void
+  _initCliqueFrontier(TEdgeList const& edges, CliqueFrontier& fr) {
+    fr.source.resize(edges.size());
+    fr.target.resize(edges.size());
+    uint32_t minV = edges[0].source;
+    uint32_t maxV = edges[0].source;
+    for(typename TEdgeList::const_iterator itE = edges.begin(); itE != edges.end(); ++itE) {
+      minV = std::min(minV, (uint32_t) std::min(itE->source, itE->target));
+      maxV = std::max(maxV, (uint32_t) std::max(itE->source, itE->target));
+    }
+    fr.vertices.clear();
+    if (maxV - minV < 4 * edges.size()) {
+      // Vertices of a component are clustered, direct lookup
+      fr.local.assign(maxV - minV + 1, 0);
+      for(typename TEdgeList::const_iterator itE = edges.begin(); itE != edges.end(); ++itE) {
+	fr.local[itE->source - minV] = 1;
+	fr.local[itE->target - minV] = 1;
+      }
+      for(uint32_t i = 0; i < fr.local.size(); ++i) {
+	if (fr.local[i]) {
+	  fr.local[i] = fr.vertices.size();
+	  fr.vertices.push_back(minV + i);
+	}
+      }
+      for(uint32_t k = 0; k < edges.size(); ++k) {
+	fr.source[k] = fr.local[edges[k].source - minV];
+	fr.target[k] = fr.local[edges[k].target - minV];
+      }
+    } else {
+      for(typename TEdgeList::const_iterator itE = edges.begin(); itE != edges.end(); ++itE) {
+	fr.vertices.push_back(itE->source);
+	fr.vertices.push_back(itE->target);
+      }
+      std::sort(fr.vertices.begin(), fr.vertices.end());
+      fr.vertices.erase(std::unique(fr.vertices.begin(), fr.vertices.end()), fr.vertices.end());
+      for(uint32_t k = 0; k < edges.size(); ++k) {
+	fr.source[k] = std::lower_bound(fr.vertices.begin(), fr.vertices.end(), (uint32_t) edges[k].source) - fr.vertices.begin();
+	fr.target[k] = std::lower_bound(fr.vertices.begin(), fr.vertices.end(), (uint32_t) edges[k].target) - fr.vertices.begin();
+      }
+    }
+    fr.offset.assign(fr.vertices.size() + 1, 0);
+    for(uint32_t k = 0; k < edges.size(); ++k) {
+      ++fr.offset[fr.source[k] + 1];
+      ++fr.offset[fr.target[k] + 1];
+    }
+    for(uint32_t i = 0; i < fr.vertices.size(); ++i) fr.offset[i + 1] += fr.offset[i];
+    fr.incident.resize(2 * edges.size());
+    fr.fill.assign(fr.offset.begin(), fr.offset.end() - 1);
+    for(uint32_t k = 0; k < edges.size(); ++k) {
+      fr.incident[fr.fill[fr.source[k]]++] = k;
+      fr.incident[fr.fill[fr.target[k]]++] = k;
+    }
+    // 0: outside, 1: clique member, 2: incompatible
+    fr.state.assign(fr.vertices.size(), 0);
+    fr.heap.clear();
+  }
+
+  // Add a clique member, its edges become candidates
+  inline void
+  _cliqueAdd(CliqueFrontier& fr, uint32_t const v) {
+    fr.state[v] = 1;
+    for(uint32_t i = fr.offset[v]; i < fr.offset[v + 1]; ++i) {
+      uint32_t k = fr.incident[i];
+      if (fr.state[(fr.source[k] == v) ? fr.target[k] : fr.source[k]] == 0) {
+	fr.heap.push_back(k);
+	std::push_heap(fr.heap.begin(), fr.heap.end(), std::greater<uint32_t>());
+      }
+    }
+  }
+
+  // Lowest-weight edge with exactly one endpoint in the clique and a compatible other endpoint.
+  // Invalid edges are dropped lazily, members and incompatible vertices never change state again.
+  inline bool
+  _cliqueNext(CliqueFrontier& fr, uint32_t& v) {
+    while (!fr.heap.empty()) {
+      std::pop_heap(fr.heap.begin(), fr.heap.end(), std::greater<uint32_t>());
+      uint32_t k = fr.heap.back();
+      fr.heap.pop_back();
+      if (fr.state[fr.source[k]] == 0) v = fr.source[k];
+      else if (fr.state[fr.target[k]] == 0) v = fr.target[k];
+      else continue;
+      return true;
+    }
+    return false;
+  }
+
   // Initialize clique, deletions
   template<typename TBamRecord, typename TSize>
   inline void
@@ -221,6 +391,7 @@ namespace torali
     typedef typename TCompEdgeList::mapped_type TEdgeList;
     typedef typename TEdgeList::value_type TEdgeRecord;
     typedef typename TEdgeRecord::TVertexType TVertex;
+    CliqueFrontier fr;
 
     // Iterate all components
     for(typename TCompEdgeList::iterator compIt = compEdge.begin(); compIt != compEdge.end(); ++compIt) {
@@ -229,15 +400,15 @@ namespace torali
 
       // Find a large clique
       typename TEdgeList::const_iterator itWEdge = compIt->second.begin();
-      typename TEdgeList::const_iterator itWEdgeEnd = compIt->second.end();
-      typedef std::set<TVertex> TCliqueMembers;
+      typedef std::vector<TVertex> TCliqueMembers;
       typedef std::set<std::size_t> TSeeds;
       TCliqueMembers clique;
-      TCliqueMembers incompatible;
       TSeeds seeds;
+      _initCliqueFrontier(compIt->second, fr);
       
       // Initialize clique
-      clique.insert(itWEdge->source);
+      clique.push_back(itWEdge->source);
+      _cliqueAdd(fr, fr.source[0]);
       seeds.insert(br[itWEdge->source].id);
       int32_t chr = br[itWEdge->source].chr;
       int32_t chr2 = br[itWEdge->source].chr2;
@@ -250,39 +421,31 @@ namespace torali
       int32_t mapq = br[itWEdge->source].qual;
       int32_t inslen = br[itWEdge->source].inslen;
 
-      // Grow clique
-      bool cliqueGrow = true;
-      while (cliqueGrow) {
-	itWEdge = compIt->second.begin();
-	cliqueGrow = false;
-	// Find next best edge for extension
-	for(;(!cliqueGrow) && (itWEdge != itWEdgeEnd);++itWEdge) {
-	  TVertex v;
-	  if ((clique.find(itWEdge->source) == clique.end()) && (clique.find(itWEdge->target) != clique.end())) v = itWEdge->source;
-	  else if ((clique.find(itWEdge->source) != clique.end()) && (clique.find(itWEdge->target) == clique.end())) v = itWEdge->target;
-	  else continue;
-	  if (incompatible.find(v) != incompatible.end()) continue;
-	  if (seeds.find(br[v].id) != seeds.end()) continue;
-	  // Try to update clique with this vertex
-	  int32_t newCiPosLow = std::min(br[v].pos, ciposlow);
-	  int32_t newCiPosHigh = std::max(br[v].pos, ciposhigh);
-	  int32_t newCiEndLow = std::min(br[v].pos2, ciendlow);
-	  int32_t newCiEndHigh = std::max(br[v].pos2, ciendhigh);
-	  if (((newCiPosHigh - newCiPosLow) < (int32_t) wiggle) && ((newCiEndHigh - newCiEndLow) < (int32_t) wiggle)) cliqueGrow = true;
-	  if (cliqueGrow) {
-	    // Accept new vertex
-	    clique.insert(v);
-	    seeds.insert(br[v].id);
-	    ciposlow = newCiPosLow;
-	    pos += br[v].pos;
-	    ciposhigh = newCiPosHigh;
-	    ciendlow = newCiEndLow;
-	    pos2 += br[v].pos2;
-	    ciendhigh = newCiEndHigh;
-	    mapq += br[v].qual;
-	    inslen += br[v].inslen;
-	  } else incompatible.insert(v);
-	}
+      // Grow clique, always extending along the next best edge
+      uint32_t local;
+      while (_cliqueNext(fr, local)) {
+	TVertex v = fr.vertices[local];
+	// Seeds only grow, a read of an assigned seed stays excluded
+	if (seeds.find(br[v].id) != seeds.end()) continue;
+	// Try to update clique with this vertex
+	int32_t newCiPosLow = std::min(br[v].pos, ciposlow);
+	int32_t newCiPosHigh = std::max(br[v].pos, ciposhigh);
+	int32_t newCiEndLow = std::min(br[v].pos2, ciendlow);
+	int32_t newCiEndHigh = std::max(br[v].pos2, ciendhigh);
+	if (((newCiPosHigh - newCiPosLow) < (int32_t) wiggle) && ((newCiEndHigh - newCiEndLow) < (int32_t) wiggle)) {
+	  // Accept new vertex
+	  clique.push_back(v);
+	  _cliqueAdd(fr, local);
+	  seeds.insert(br[v].id);
+	  ciposlow = newCiPosLow;
+	  pos += br[v].pos;
+	  ciposhigh = newCiPosHigh;
+	  ciendlow = newCiEndLow;
+	  pos2 += br[v].pos2;
+	  ciendhigh = newCiEndHigh;
+	  mapq += br[v].qual;
+	  inslen += br[v].inslen;
+	} else fr.state[local] = 2;
       }
 
       // Enough split reads?
@@ -311,40 +474,36 @@ namespace torali
   inline void
   cluster(TConfig const& c, std::vector<SRBamRecord>& br, std::vector<StructuralVariantRecord>& sv, uint32_t const varisize, int32_t const svt) {
     uint32_t count = 0;
-    for(int32_t refIdx = 0; refIdx < c.nchr; ++refIdx) {
-      
-      // Components
-      typedef std::vector<uint32_t> TComponent;
-      TComponent comp;
-      comp.resize(br.size(), 0);
-      uint32_t numComp = 0;
-
-      // Edge lists for each component
-      typedef uint32_t TWeightType;
-      typedef uint32_t TVertex;
-      typedef EdgeRecord<TWeightType, TVertex> TEdgeRecord;
-      typedef std::vector<TEdgeRecord> TEdgeList;
-      typedef std::map<uint32_t, TEdgeList> TCompEdgeList;
-      TCompEdgeList compEdge;
 
-	
+    // Components, vertices of different chromosomes are never connected
+    ComponentForest cf(br.size());
+
+    // Edge lists for each component
+    typedef uint32_t TWeightType;
+    typedef uint32_t TVertex;
+    typedef EdgeRecord<TWeightType, TVertex> TEdgeRecord;
+    typedef std::vector<TEdgeRecord> TEdgeList;
+    typedef std::map<uint32_t, TEdgeList> TCompEdgeList;
+    TEdgeList edges;
+    for(int32_t refIdx = 0; refIdx < c.nchr; ++refIdx) {
       std::size_t lastConnectedNode = 0;
-      std::size_t lastConnectedNodeStart = 0;
       for(uint32_t i = 0; i<br.size(); ++i) {
 	if (br[i].chr == refIdx) {
 	  ++count;
 	  // Safe to clean the graph?
 	  if (i > lastConnectedNode) {
 	    // Clean edge lists
-	    if (!compEdge.empty()) {
+	    if (!edges.empty()) {
 	      // Search cliques
+	      TCompEdgeList compEdge;
+	      _componentEdges(cf, edges, compEdge);
 	      _searchCliques(c, compEdge, br, sv, varisize, svt);
-	      lastConnectedNodeStart = lastConnectedNode;
-	      compEdge.clear();
+	      edges.clear();
 	    }
 	  }
 	  
 	  
+	  uint32_t root = _findComponent(cf, i);
 	  for(uint32_t j = i + 1; j<br.size(); ++j) {
 	    if (br[j].chr == refIdx) {
 	      if ( (uint32_t) (br[j].pos - br[i].pos) > varisize) break;
@@ -354,53 +513,14 @@ namespace torali
 		if (j > lastConnectedNode) lastConnectedNode = j;
 		
 		// Assign components
-		uint32_t compIndex = 0;
-		if (!comp[i]) {
-		  if (!comp[j]) {
-		    // Both vertices have no component
-		    compIndex = ++numComp;
-		    comp[i] = compIndex;
-		    comp[j] = compIndex;
-		    compEdge.insert(std::make_pair(compIndex, TEdgeList()));
-		  } else {
-		    compIndex = comp[j];
-		    comp[i] = compIndex;
-		  }	
-		} else {
-		  if (!comp[j]) {
-		    compIndex = comp[i];
-		    comp[j] = compIndex;
-		  } else {
-		    // Both vertices have a component
-		    if (comp[j] == comp[i]) {
-		      compIndex = comp[j];
-		    } else {
-		      // Merge components
-		      compIndex = comp[i];
-		      uint32_t otherIndex = comp[j];
-		      if (otherIndex < compIndex) {
-			compIndex = comp[j];
-			otherIndex = comp[i];
-		      }
-		      // Re-label other index
-		      for(uint32_t k = lastConnectedNodeStart; k <= lastConnectedNode; ++k) {
-			if (otherIndex == comp[k]) comp[k] = compIndex;
-		      }
-		      // Merge edge lists
-		      TCompEdgeList::iterator compEdgeIt = compEdge.find(compIndex);
-		      TCompEdgeList::iterator compEdgeOtherIt = compEdge.find(otherIndex);
-		      compEdgeIt->second.insert(compEdgeIt->second.end(), compEdgeOtherIt->second.begin(), compEdgeOtherIt->second.end());
-		      compEdge.erase(compEdgeOtherIt);
-		    }
-		  }
-		}
+		root = _joinComponents(cf, root, j);
 		
 		// Append new edge
-		TCompEdgeList::iterator compEdgeIt = compEdge.find(compIndex);
-		if (compEdgeIt->second.size() < c.graphPruning) {
+		if (cf.edgeCount[root] < c.graphPruning) {
 		  // Breakpoint distance
 		  TWeightType weight = std::abs(br[j].pos2 - br[i].pos2) + std::abs(br[j].pos - br[i].pos);
-		  compEdgeIt->second.push_back(TEdgeRecord(i, j, weight));
+		  edges.push_back(TEdgeRecord(i, j, weight));
+		  ++cf.edgeCount[root];
 		}
 	      }
 	    }
@@ -408,9 +528,11 @@ namespace torali
 	}
       }
       // Search cliques
-      if (!compEdge.empty()) {
+      if (!edges.empty()) {
+	TCompEdgeList compEdge;
+	_componentEdges(cf, edges, compEdge);
 	_searchCliques(c, compEdge, br, sv, varisize, svt);
-	compEdge.clear();
+	edges.clear();
       }
     }
   }
@@ -421,6 +543,7 @@ namespace torali
   _searchCliques(TConfig const& c, TCompEdgeList& compEdge, TBamRecord const& bamRecord, TSVs& svs, int32_t const svt) {
     typedef typename TCompEdgeList::mapped_type TEdgeList;
     typedef typename TEdgeList::value_type TEdgeRecord;
+    CliqueFrontier fr;
 
     // Iterate all components
     for(typename TCompEdgeList::iterator compIt = compEdge.begin(); compIt != compEdge.end(); ++compIt) {
@@ -429,11 +552,9 @@ namespace torali
       
       // Find a large clique
       typename TEdgeList::const_iterator itWEdge = compIt->second.begin();
-      typename TEdgeList::const_iterator itWEdgeEnd = compIt->second.end();
-      typedef std::set<std::size_t> TCliqueMembers;
+      typedef std::vector<std::size_t> TCliqueMembers;
       
       TCliqueMembers clique;
-      TCliqueMembers incompatible;
       int32_t svStart = -1;
       int32_t svEnd = -1;
       int32_t wiggle = 0;
@@ -441,23 +562,18 @@ namespace torali
       int32_t clusterMateRefID=bamRecord[itWEdge->source].mtid;
       _initClique(bamRecord[itWEdge->source], svStart, svEnd, wiggle, svt);
       if ((clusterRefID==clusterMateRefID) && (svStart >= svEnd))  continue;
-      clique.insert(itWEdge->source);
+      _initCliqueFrontier(compIt->second, fr);
+      clique.push_back(itWEdge->source);
+      _cliqueAdd(fr, fr.source[0]);
       
       // Grow the clique from the seeding edge
-      bool cliqueGrow=true;
-      while (cliqueGrow) {
-	itWEdge = compIt->second.begin();
-	cliqueGrow = false;
-	for(;(!cliqueGrow) && (itWEdge != itWEdgeEnd);++itWEdge) {
-	  std::size_t v;
-	  if ((clique.find(itWEdge->source) == clique.end()) && (clique.find(itWEdge->target) != clique.end())) v = itWEdge->source;
-	  else if ((clique.find(itWEdge->source) != clique.end()) && (clique.find(itWEdge->target) == clique.end())) v = itWEdge->target;
-	  else continue;
-	  if (incompatible.find(v) != incompatible.end()) continue;
-	  cliqueGrow = _updateClique(bamRecord[v], svStart, svEnd, wiggle, svt);
-	  if (cliqueGrow) clique.insert(v);
-	  else incompatible.insert(v);
-	}
+      uint32_t local;
+      while (_cliqueNext(fr, local)) {
+	std::size_t v = fr.vertices[local];
+	if (_updateClique(bamRecord[v], svStart, svEnd, wiggle, svt)) {
+	  clique.push_back(v);
+	  _cliqueAdd(fr, local);
+	} else fr.state[local] = 2;
       }
 
       // Enough paired-ends
@@ -499,10 +615,7 @@ namespace torali
   cluster(TConfig const& c, std::vector<BamAlignRecord>& bamRecord, std::vector<StructuralVariantRecord>& svs, uint32_t const varisize, int32_t const svt) {
     typedef typename std::vector<BamAlignRecord> TBamRecord;
     // Components
-    typedef std::vector<uint32_t> TComponent;
-    TComponent comp;
-    comp.resize(bamRecord.size(), 0);
-    uint32_t numComp = 0;
+    ComponentForest cf(bamRecord.size());
       
     // Edge lists for each component
     typedef uint32_t TWeightType;
@@ -510,20 +623,20 @@ namespace torali
     typedef EdgeRecord<TWeightType, TVertex> TEdgeRecord;
     typedef std::vector<TEdgeRecord> TEdgeList;
     typedef std::map<uint32_t, TEdgeList> TCompEdgeList;
-    TCompEdgeList compEdge;
+    TEdgeList edges;
     
     // Iterate the chromosome range
     std::size_t lastConnectedNode = 0;
-    std::size_t lastConnectedNodeStart = 0;
     std::size_t bamItIndex = 0;
     for(TBamRecord::const_iterator bamIt = bamRecord.begin(); bamIt != bamRecord.end(); ++bamIt, ++bamItIndex) {
       // Safe to clean the graph?
       if (bamItIndex > lastConnectedNode) {
 	// Clean edge lists
-	if (!compEdge.empty()) {
+	if (!edges.empty()) {
+	  TCompEdgeList compEdge;
+	  _componentEdges(cf, edges, compEdge);
 	  _searchCliques(c, compEdge, bamRecord, svs, svt);
-	  lastConnectedNodeStart = lastConnectedNode;
-	  compEdge.clear();
+	  edges.clear();
 	}
       }
       int32_t const minCoord = _minCoord(bamIt->pos, bamIt->mpos, svt);
@@ -531,6 +644,7 @@ namespace torali
       TBamRecord::const_iterator bamItNext = bamIt;
       ++bamItNext;
       std::size_t bamItIndexNext = bamItIndex + 1;
+      uint32_t root = _findComponent(cf, bamItIndex);
       for(; ((bamItNext != bamRecord.end()) && ((uint32_t) std::abs(_minCoord(bamItNext->pos, bamItNext->mpos, svt) + bamItNext->alen - minCoord) <= varisize)) ; ++bamItNext, ++bamItIndexNext) {
 	  // Check that mate chr agree (only for translocations)
 	if (bamIt->mtid != bamItNext->mtid) continue;
@@ -542,58 +656,21 @@ namespace torali
 	if (bamItIndexNext > lastConnectedNode ) lastConnectedNode = bamItIndexNext;
 	
 	// Assign components
-	uint32_t compIndex = 0;
-	if (!comp[bamItIndex]) {
-	  if (!comp[bamItIndexNext]) {
-	    // Both vertices have no component
-	    compIndex = ++numComp;
-	    comp[bamItIndex] = compIndex;
-	    comp[bamItIndexNext] = compIndex;
-	    compEdge.insert(std::make_pair(compIndex, TEdgeList()));
-	  } else {
-	    compIndex = comp[bamItIndexNext];
-	    comp[bamItIndex] = compIndex;
-	  }
-	} else {
-	  if (!comp[bamItIndexNext]) {
-	    compIndex = comp[bamItIndex];
-	    comp[bamItIndexNext] = compIndex;
-	  } else {
-	    // Both vertices have a component
-	    if (comp[bamItIndexNext] == comp[bamItIndex]) {
-	      compIndex = comp[bamItIndexNext];
-	    } else {
-	      // Merge components
-	      compIndex = comp[bamItIndex];
-	      uint32_t otherIndex = comp[bamItIndexNext];
-	      if (otherIndex < compIndex) {
-		compIndex = comp[bamItIndexNext];
-		otherIndex = comp[bamItIndex];
-	      }
-	      // Re-label other index
-	      for(std::size_t i = lastConnectedNodeStart; i <= lastConnectedNode; ++i) {
-		if (otherIndex == comp[i]) comp[i] = compIndex;
-	      }
-	      // Merge edge lists
-	      TCompEdgeList::iterator compEdgeIt = compEdge.find(compIndex);
-	      TCompEdgeList::iterator compEdgeOtherIt = compEdge.find(otherIndex);
-	      compEdgeIt->second.insert(compEdgeIt->second.end(), compEdgeOtherIt->second.begin(), compEdgeOtherIt->second.end());
-	      compEdge.erase(compEdgeOtherIt);
-	    }
-	  }
-	}
+	root = _joinComponents(cf, root, bamItIndexNext);
 	
 	// Append new edge
-	TCompEdgeList::iterator compEdgeIt = compEdge.find(compIndex);
-	if (compEdgeIt->second.size() < c.graphPruning) {
+	if (cf.edgeCount[root] < c.graphPruning) {
 	  TWeightType weight = (TWeightType) ( std::log((double) abs( abs( (_minCoord(bamItNext->pos, bamItNext->mpos, svt) - minCoord) - (_maxCoord(bamItNext->pos, bamItNext->mpos, svt) - maxCoord) ) - abs(bamIt->Median - bamItNext->Median)) + 1) / std::log(2) );
-	  compEdgeIt->second.push_back(TEdgeRecord(bamItIndex, bamItIndexNext, weight));
+	  edges.push_back(TEdgeRecord(bamItIndex, bamItIndexNext, weight));
+	  ++cf.edgeCount[root];
 	}
       }
     }
-    if (!compEdge.empty()) {
+    if (!edges.empty()) {
+      TCompEdgeList compEdge;
+      _componentEdges(cf, edges, compEdge);
       _searchCliques(c, compEdge, bamRecord, svs, svt);
-      compEdge.clear();
+      edges.clear();
     }
   }
   
@@ -0,0 +1,560 @@
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#define BOOST_DISABLE_ASSERTS
+
+#include "util.h"
+#include "cluster.h"
+
+// Clique search against the component and clique code it replaced (union-find components, incremental clique frontier), plus a satellite-like locus benchmark
+
+namespace torali
+{
+
+  // Reference: connected components relabelled by full scans and cliques grown by rescanning the component edge list
+
+  template<typename TConfig, typename TCompEdgeList>
+  inline void
+  _searchCliquesReference(TConfig const& c, TCompEdgeList& compEdge, std::vector<SRBamRecord>& br, std::vector<StructuralVariantRecord>& sv, uint32_t const wiggle, int32_t const svt) {
+    typedef typename TCompEdgeList::mapped_type TEdgeList;
+    typedef typename TEdgeList::value_type TEdgeRecord;
+    typedef typename TEdgeRecord::TVertexType TVertex;
+
+    // Iterate all components
+    for(typename TCompEdgeList::iterator compIt = compEdge.begin(); compIt != compEdge.end(); ++compIt) {
+      // Sort edges by weight
+      std::sort(compIt->second.begin(), compIt->second.end(), SortEdgeRecords<TEdgeRecord>());
+
+      // Find a large clique
+      typename TEdgeList::const_iterator itWEdge = compIt->second.begin();
+      typename TEdgeList::const_iterator itWEdgeEnd = compIt->second.end();
+      typedef std::set<TVertex> TCliqueMembers;
+      typedef std::set<std::size_t> TSeeds;
+      TCliqueMembers clique;
+      TCliqueMembers incompatible;
+      TSeeds seeds;
+      
+      // Initialize clique
+      clique.insert(itWEdge->source);
+      seeds.insert(br[itWEdge->source].id);
+      int32_t chr = br[itWEdge->source].chr;
+      int32_t chr2 = br[itWEdge->source].chr2;
+      int32_t ciposlow = br[itWEdge->source].pos;
+      uint64_t pos = br[itWEdge->source].pos;
+      int32_t ciposhigh = br[itWEdge->source].pos; 
+      int32_t ciendlow = br[itWEdge->source].pos2;
+      uint64_t pos2 = br[itWEdge->source].pos2;
+      int32_t ciendhigh = br[itWEdge->source].pos2;
+      int32_t mapq = br[itWEdge->source].qual;
+      int32_t inslen = br[itWEdge->source].inslen;
+
+      // Grow clique
+      bool cliqueGrow = true;
+      while (cliqueGrow) {
+	itWEdge = compIt->second.begin();
+	cliqueGrow = false;
+	// Find next best edge for extension
+	for(;(!cliqueGrow) && (itWEdge != itWEdgeEnd);++itWEdge) {
+	  TVertex v;
+	  if ((clique.find(itWEdge->source) == clique.end()) && (clique.find(itWEdge->target) != clique.end())) v = itWEdge->source;
+	  else if ((clique.find(itWEdge->source) != clique.end()) && (clique.find(itWEdge->target) == clique.end())) v = itWEdge->target;
+	  else continue;
+	  if (incompatible.find(v) != incompatible.end()) continue;
+	  if (seeds.find(br[v].id) != seeds.end()) continue;
+	  // Try to update clique with this vertex
+	  int32_t newCiPosLow = std::min(br[v].pos, ciposlow);
+	  int32_t newCiPosHigh = std::max(br[v].pos, ciposhigh);
+	  int32_t newCiEndLow = std::min(br[v].pos2, ciendlow);
+	  int32_t newCiEndHigh = std::max(br[v].pos2, ciendhigh);
+	  if (((newCiPosHigh - newCiPosLow) < (int32_t) wiggle) && ((newCiEndHigh - newCiEndLow) < (int32_t) wiggle)) cliqueGrow = true;
+	  if (cliqueGrow) {
+	    // Accept new vertex
+	    clique.insert(v);
+	    seeds.insert(br[v].id);
+	    ciposlow = newCiPosLow;
+	    pos += br[v].pos;
+	    ciposhigh = newCiPosHigh;
+	    ciendlow = newCiEndLow;
+	    pos2 += br[v].pos2;
+	    ciendhigh = newCiEndHigh;
+	    mapq += br[v].qual;
+	    inslen += br[v].inslen;
+	  } else incompatible.insert(v);
+	}
+      }
+
+      // Enough split reads?
+      if (clique.size() >= c.minCliqueSize) {
+	int32_t svStart = (int32_t) (pos / (uint64_t) clique.size());
+	int32_t svEnd = (int32_t) (pos2 / (uint64_t) clique.size());
+	int32_t svInsLen = (int32_t) (inslen / (int32_t) clique.size());
+	if (_svSizeCheck(svStart, svEnd, svt, svInsLen)) {
+	  if ((ciposlow > svStart) || (ciposhigh < svStart) || (ciendlow > svEnd) || (ciendhigh < svEnd)) {
+	    std::cerr << "Warning: Confidence intervals out of bounds: " << ciposlow << ',' << svStart << ',' << ciposhigh << ':' << ciendlow << ',' << svEnd << ',' << ciendhigh << std::endl;
+	  }
+	  int32_t svid = sv.size();
+	  sv.push_back(StructuralVariantRecord(chr, svStart, chr2, svEnd, (ciposlow - svStart), (ciposhigh - svStart), (ciendlow - svEnd), (ciendhigh - svEnd), clique.size(), mapq / clique.size(), mapq, svInsLen, svt, svid));
+	  // Reads assigned
+	  for(typename TCliqueMembers::iterator itC = clique.begin(); itC != clique.end(); ++itC) {
+	    //std::cerr << svid << ',' << br[*itC].id << std::endl;
+	    br[*itC].svid = svid;
+	  }
+	}
+      }
+    }
+  }
+  
+
+  template<typename TConfig>
+  inline void
+  clusterReference(TConfig const& c, std::vector<SRBamRecord>& br, std::vector<StructuralVariantRecord>& sv, uint32_t const varisize, int32_t const svt) {
+    uint32_t count = 0;
+    for(int32_t refIdx = 0; refIdx < c.nchr; ++refIdx) {
+      
+      // Components
+      typedef std::vector<uint32_t> TComponent;
+      TComponent comp;
+      comp.resize(br.size(), 0);
+      uint32_t numComp = 0;
+
+      // Edge lists for each component
+      typedef uint32_t TWeightType;
+      typedef uint32_t TVertex;
+      typedef EdgeRecord<TWeightType, TVertex> TEdgeRecord;
+      typedef std::vector<TEdgeRecord> TEdgeList;
+      typedef std::map<uint32_t, TEdgeList> TCompEdgeList;
+      TCompEdgeList compEdge;
+
+	
+      std::size_t lastConnectedNode = 0;
+      std::size_t lastConnectedNodeStart = 0;
+      for(uint32_t i = 0; i<br.size(); ++i) {
+	if (br[i].chr == refIdx) {
+	  ++count;
+	  // Safe to clean the graph?
+	  if (i > lastConnectedNode) {
+	    // Clean edge lists
+	    if (!compEdge.empty()) {
+	      // Search cliques
+	      _searchCliquesReference(c, compEdge, br, sv, varisize, svt);
+	      lastConnectedNodeStart = lastConnectedNode;
+	      compEdge.clear();
+	    }
+	  }
+	  
+	  
+	  for(uint32_t j = i + 1; j<br.size(); ++j) {
+	    if (br[j].chr == refIdx) {
+	      if ( (uint32_t) (br[j].pos - br[i].pos) > varisize) break;
+	      if ((svt == 4) && (std::abs(br[j].inslen - br[i].inslen) > varisize)) continue;
+	      if ( (uint32_t) std::abs(br[j].pos2 - br[i].pos2) < varisize) {
+		// Update last connected node
+		if (j > lastConnectedNode) lastConnectedNode = j;
+		
+		// Assign components
+		uint32_t compIndex = 0;
+		if (!comp[i]) {
+		  if (!comp[j]) {
+		    // Both vertices have no component
+		    compIndex = ++numComp;
+		    comp[i] = compIndex;
+		    comp[j] = compIndex;
+		    compEdge.insert(std::make_pair(compIndex, TEdgeList()));
+		  } else {
+		    compIndex = comp[j];
+		    comp[i] = compIndex;
+		  }	
+		} else {
+		  if (!comp[j]) {
+		    compIndex = comp[i];
+		    comp[j] = compIndex;
+		  } else {
+		    // Both vertices have a component
+		    if (comp[j] == comp[i]) {
+		      compIndex = comp[j];
+		    } else {
+		      // Merge components
+		      compIndex = comp[i];
+		      uint32_t otherIndex = comp[j];
+		      if (otherIndex < compIndex) {
+			compIndex = comp[j];
+			otherIndex = comp[i];
+		      }
+		      // Re-label other index
+		      for(uint32_t k = lastConnectedNodeStart; k <= lastConnectedNode; ++k) {
+			if (otherIndex == comp[k]) comp[k] = compIndex;
+		      }
+		      // Merge edge lists
+		      TCompEdgeList::iterator compEdgeIt = compEdge.find(compIndex);
+		      TCompEdgeList::iterator compEdgeOtherIt = compEdge.find(otherIndex);
+		      compEdgeIt->second.insert(compEdgeIt->second.end(), compEdgeOtherIt->second.begin(), compEdgeOtherIt->second.end());
+		      compEdge.erase(compEdgeOtherIt);
+		    }
+		  }
+		}
+		
+		// Append new edge
+		TCompEdgeList::iterator compEdgeIt = compEdge.find(compIndex);
+		if (compEdgeIt->second.size() < c.graphPruning) {
+		  // Breakpoint distance
+		  TWeightType weight = std::abs(br[j].pos2 - br[i].pos2) + std::abs(br[j].pos - br[i].pos);
+		  compEdgeIt->second.push_back(TEdgeRecord(i, j, weight));
+		}
+	      }
+	    }
+	  }
+	}
+      }
+      // Search cliques
+      if (!compEdge.empty()) {
+	_searchCliquesReference(c, compEdge, br, sv, varisize, svt);
+	compEdge.clear();
+      }
+    }
+  }
+
+
+  template<typename TConfig, typename TCompEdgeList, typename TBamRecord, typename TSVs>
+  inline void
+  _searchCliquesReference(TConfig const& c, TCompEdgeList& compEdge, TBamRecord const& bamRecord, TSVs& svs, int32_t const svt) {
+    typedef typename TCompEdgeList::mapped_type TEdgeList;
+    typedef typename TEdgeList::value_type TEdgeRecord;
+
+    // Iterate all components
+    for(typename TCompEdgeList::iterator compIt = compEdge.begin(); compIt != compEdge.end(); ++compIt) {
+      // Sort edges by weight
+      std::sort(compIt->second.begin(), compIt->second.end(), SortEdgeRecords<TEdgeRecord>());
+      
+      // Find a large clique
+      typename TEdgeList::const_iterator itWEdge = compIt->second.begin();
+      typename TEdgeList::const_iterator itWEdgeEnd = compIt->second.end();
+      typedef std::set<std::size_t> TCliqueMembers;
+      
+      TCliqueMembers clique;
+      TCliqueMembers incompatible;
+      int32_t svStart = -1;
+      int32_t svEnd = -1;
+      int32_t wiggle = 0;
+      int32_t clusterRefID=bamRecord[itWEdge->source].tid;
+      int32_t clusterMateRefID=bamRecord[itWEdge->source].mtid;
+      _initClique(bamRecord[itWEdge->source], svStart, svEnd, wiggle, svt);
+      if ((clusterRefID==clusterMateRefID) && (svStart >= svEnd))  continue;
+      clique.insert(itWEdge->source);
+      
+      // Grow the clique from the seeding edge
+      bool cliqueGrow=true;
+      while (cliqueGrow) {
+	itWEdge = compIt->second.begin();
+	cliqueGrow = false;
+	for(;(!cliqueGrow) && (itWEdge != itWEdgeEnd);++itWEdge) {
+	  std::size_t v;
+	  if ((clique.find(itWEdge->source) == clique.end()) && (clique.find(itWEdge->target) != clique.end())) v = itWEdge->source;
+	  else if ((clique.find(itWEdge->source) != clique.end()) && (clique.find(itWEdge->target) == clique.end())) v = itWEdge->target;
+	  else continue;
+	  if (incompatible.find(v) != incompatible.end()) continue;
+	  cliqueGrow = _updateClique(bamRecord[v], svStart, svEnd, wiggle, svt);
+	  if (cliqueGrow) clique.insert(v);
+	  else incompatible.insert(v);
+	}
+      }
+
+      // Enough paired-ends
+      if ((clique.size() >= c.minCliqueSize) && (_svSizeCheck(svStart, svEnd, svt))) {
+	StructuralVariantRecord svRec;
+	svRec.chr = clusterRefID;
+	svRec.chr2 = clusterMateRefID;
+	svRec.svStart = (uint32_t) svStart + 1;
+	svRec.svEnd = (uint32_t) svEnd + 1;
+	svRec.peSupport = clique.size();
+	int32_t ci_wiggle = std::max(abs(wiggle), 50);
+	svRec.ciposlow = -ci_wiggle;
+	svRec.ciposhigh = ci_wiggle;
+	svRec.ciendlow = -ci_wiggle;
+	svRec.ciendhigh = ci_wiggle;
+	svRec.mapq = 0;
+	std::vector<uint8_t> mapQV;
+	for(typename TCliqueMembers::const_iterator itC = clique.begin(); itC!=clique.end(); ++itC) {
+	  mapQV.push_back(bamRecord[*itC].MapQuality);
+	  svRec.mapq += bamRecord[*itC].MapQuality;
+	}
+	std::sort(mapQV.begin(), mapQV.end());
+	svRec.peMapQuality = mapQV[mapQV.size()/2];
+	svRec.srSupport=0;
+	svRec.srAlignQuality=0;
+	svRec.precise=false;
+	svRec.svt = svt;
+	svRec.insLen = 0;
+	svRec.homLen = 0;
+	svs.push_back(svRec);
+      }
+    }
+  }
+  
+  
+
+  template<typename TConfig>
+  inline void
+  clusterReference(TConfig const& c, std::vector<BamAlignRecord>& bamRecord, std::vector<StructuralVariantRecord>& svs, uint32_t const varisize, int32_t const svt) {
+    typedef typename std::vector<BamAlignRecord> TBamRecord;
+    // Components
+    typedef std::vector<uint32_t> TComponent;
+    TComponent comp;
+    comp.resize(bamRecord.size(), 0);
+    uint32_t numComp = 0;
+      
+    // Edge lists for each component
+    typedef uint32_t TWeightType;
+    typedef uint32_t TVertex;
+    typedef EdgeRecord<TWeightType, TVertex> TEdgeRecord;
+    typedef std::vector<TEdgeRecord> TEdgeList;
+    typedef std::map<uint32_t, TEdgeList> TCompEdgeList;
+    TCompEdgeList compEdge;
+    
+    // Iterate the chromosome range
+    std::size_t lastConnectedNode = 0;
+    std::size_t lastConnectedNodeStart = 0;
+    std::size_t bamItIndex = 0;
+    for(TBamRecord::const_iterator bamIt = bamRecord.begin(); bamIt != bamRecord.end(); ++bamIt, ++bamItIndex) {
+      // Safe to clean the graph?
+      if (bamItIndex > lastConnectedNode) {
+	// Clean edge lists
+	if (!compEdge.empty()) {
+	  _searchCliquesReference(c, compEdge, bamRecord, svs, svt);
+	  lastConnectedNodeStart = lastConnectedNode;
+	  compEdge.clear();
+	}
+      }
+      int32_t const minCoord = _minCoord(bamIt->pos, bamIt->mpos, svt);
+      int32_t const maxCoord = _maxCoord(bamIt->pos, bamIt->mpos, svt);
+      TBamRecord::const_iterator bamItNext = bamIt;
+      ++bamItNext;
+      std::size_t bamItIndexNext = bamItIndex + 1;
+      for(; ((bamItNext != bamRecord.end()) && ((uint32_t) std::abs(_minCoord(bamItNext->pos, bamItNext->mpos, svt) + bamItNext->alen - minCoord) <= varisize)) ; ++bamItNext, ++bamItIndexNext) {
+	  // Check that mate chr agree (only for translocations)
+	if (bamIt->mtid != bamItNext->mtid) continue;
+	
+	// Check combinability of pairs
+	if (_pairsDisagree(minCoord, maxCoord, bamIt->alen, bamIt->maxNormalISize, _minCoord(bamItNext->pos, bamItNext->mpos, svt), _maxCoord(bamItNext->pos, bamItNext->mpos, svt), bamItNext->alen, bamItNext->maxNormalISize, svt)) continue;
+	
+	// Update last connected node
+	if (bamItIndexNext > lastConnectedNode ) lastConnectedNode = bamItIndexNext;
+	
+	// Assign components
+	uint32_t compIndex = 0;
+	if (!comp[bamItIndex]) {
+	  if (!comp[bamItIndexNext]) {
+	    // Both vertices have no component
+	    compIndex = ++numComp;
+	    comp[bamItIndex] = compIndex;
+	    comp[bamItIndexNext] = compIndex;
+	    compEdge.insert(std::make_pair(compIndex, TEdgeList()));
+	  } else {
+	    compIndex = comp[bamItIndexNext];
+	    comp[bamItIndex] = compIndex;
+	  }
+	} else {
+	  if (!comp[bamItIndexNext]) {
+	    compIndex = comp[bamItIndex];
+	    comp[bamItIndexNext] = compIndex;
+	  } else {
+	    // Both vertices have a component
+	    if (comp[bamItIndexNext] == comp[bamItIndex]) {
+	      compIndex = comp[bamItIndexNext];
+	    } else {
+	      // Merge components
+	      compIndex = comp[bamItIndex];
+	      uint32_t otherIndex = comp[bamItIndexNext];
+	      if (otherIndex < compIndex) {
+		compIndex = comp[bamItIndexNext];
+		otherIndex = comp[bamItIndex];
+	      }
+	      // Re-label other index
+	      for(std::size_t i = lastConnectedNodeStart; i <= lastConnectedNode; ++i) {
+		if (otherIndex == comp[i]) comp[i] = compIndex;
+	      }
+	      // Merge edge lists
+	      TCompEdgeList::iterator compEdgeIt = compEdge.find(compIndex);
+	      TCompEdgeList::iterator compEdgeOtherIt = compEdge.find(otherIndex);
+	      compEdgeIt->second.insert(compEdgeIt->second.end(), compEdgeOtherIt->second.begin(), compEdgeOtherIt->second.end());
+	      compEdge.erase(compEdgeOtherIt);
+	    }
+	  }
+	}
+	
+	// Append new edge
+	TCompEdgeList::iterator compEdgeIt = compEdge.find(compIndex);
+	if (compEdgeIt->second.size() < c.graphPruning) {
+	  TWeightType weight = (TWeightType) ( std::log((double) abs( abs( (_minCoord(bamItNext->pos, bamItNext->mpos, svt) - minCoord) - (_maxCoord(bamItNext->pos, bamItNext->mpos, svt) - maxCoord) ) - abs(bamIt->Median - bamItNext->Median)) + 1) / std::log(2) );
+	  compEdgeIt->second.push_back(TEdgeRecord(bamItIndex, bamItIndexNext, weight));
+	}
+      }
+    }
+    if (!compEdge.empty()) {
+      _searchCliquesReference(c, compEdge, bamRecord, svs, svt);
+      compEdge.clear();
+    }
+  }
+  
+
+    
+
+}
+
+using namespace torali;
+
+struct ClusterTestConfig {
+  uint32_t graphPruning;
+  uint32_t minCliqueSize;
+  int32_t nchr;
+};
+
+inline std::string
+_dumpSVs(std::vector<StructuralVariantRecord> const& svs) {
+  std::ostringstream out;
+  for(uint32_t i = 0; i < svs.size(); ++i) {
+    StructuralVariantRecord const& r = svs[i];
+    out << r.chr << ':' << r.svStart << ':' << r.chr2 << ':' << r.svEnd << ':' << r.svt << ':' << r.peSupport << ':' << r.srSupport << ':' << r.mapq << ':' << r.peMapQuality << ':' << r.ciposlow << ':' << r.ciposhigh << ':' << r.ciendlow << ':' << r.ciendhigh << ':' << r.insLen << ';';
+  }
+  return out.str();
+}
+
+// Clique membership of the split-reads
+inline std::string
+_dumpSVIds(std::vector<SRBamRecord> const& br) {
+  std::ostringstream out;
+  for(uint32_t i = 0; i < br.size(); ++i) out << br[i].svid << ',';
+  return out.str();
+}
+
+// Dense split-read locus: a few breakpoints with read positions spread over w bp, plus genome-wide background
+inline void
+_randomSR(int32_t const n, int32_t const w, int32_t const nchr, std::vector<SRBamRecord>& br) {
+  br.clear();
+  for(int32_t i = 0; i < n; ++i) {
+    int32_t chr = std::rand() % nchr;
+    int32_t bp = 100000 + (std::rand() % 4) * 37;
+    int32_t pos = (std::rand() % 5 == 0) ? std::rand() % 10000000 : bp + std::rand() % w;
+    int32_t pos2 = pos + 5000 + std::rand() % w;
+    br.push_back(SRBamRecord(chr, pos, chr, pos2, 0, 0, std::rand() % 60, std::rand() % 50, (std::size_t) (std::rand() % (n / 2 + 1))));
+  }
+  std::sort(br.begin(), br.end(), SortSRBamRecord<SRBamRecord>());
+}
+
+// Discordant pairs around a few breakpoints, the mate orientation follows the SV type
+inline void
+_randomPE(int32_t const n, int32_t const w, int32_t const svt, std::vector<BamAlignRecord>& br) {
+  br.clear();
+  for(int32_t i = 0; i < n; ++i) {
+    bam1_t rec;
+    std::memset(&rec, 0, sizeof(rec));
+    int32_t bp = 100000 + (std::rand() % 3) * 151;
+    int32_t p = (std::rand() % 5 == 0) ? std::rand() % 10000000 : bp - std::rand() % w;
+    int32_t m = p + 3000 + std::rand() % w;
+    rec.core.tid = 0;
+    rec.core.mtid = 0;
+    rec.core.pos = (svt == 2) ? m : p;
+    rec.core.mpos = (svt == 2) ? p : m;
+    br.push_back(BamAlignRecord(&rec, std::rand() % 60, 100, 100, 400, 40, 600));
+  }
+  std::sort(br.begin(), br.end(), SortBamRecords<BamAlignRecord>());
+}
+
+inline double
+_seconds(std::clock_t const start) {
+  return (double) (std::clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+int main(int argc, char **argv) {
+  uint32_t nruns = 400;
+  uint32_t nsat = 100000;
+  if (argc > 1) nruns = std::atoi(argv[1]);
+  if (argc > 2) nsat = std::atoi(argv[2]);
+
+  // Equivalence on random SR and PE inputs, graph pruning is hit for every third run
+  uint32_t mismatches = 0;
+  for(uint32_t s = 0; s < nruns; ++s) {
+    std::srand(s);
+    ClusterTestConfig c;
+    c.graphPruning = (s % 3 == 0) ? 50 : 1000;
+    c.minCliqueSize = 2;
+    c.nchr = 3;
+    int32_t svt = (s % 5 == 4) ? DELLY_SVT_TRANS + (s % 4) : (s % 5);
+    std::vector<SRBamRecord> srRef;
+    _randomSR(50 + std::rand() % 800, 40 + s % 200, c.nchr, srRef);
+    std::vector<SRBamRecord> srNew(srRef);
+    std::vector<StructuralVariantRecord> svRef;
+    std::vector<StructuralVariantRecord> svNew;
+    clusterReference(c, srRef, svRef, 40, svt);
+    cluster(c, srNew, svNew, 40, svt);
+    if ((_dumpSVs(svRef) != _dumpSVs(svNew)) || (_dumpSVIds(srRef) != _dumpSVIds(srNew))) {
+      if (!mismatches) std::cerr << "SR mismatch, seed " << s << std::endl;
+      ++mismatches;
+    }
+
+    std::vector<BamAlignRecord> peRef;
+    _randomPE(50 + std::rand() % 800, 100 + s % 300, s % 4, peRef);
+    std::vector<BamAlignRecord> peNew(peRef);
+    svRef.clear();
+    svNew.clear();
+    clusterReference(c, peRef, svRef, 600, s % 4);
+    cluster(c, peNew, svNew, 600, s % 4);
+    if (_dumpSVs(svRef) != _dumpSVs(svNew)) {
+      if (!mismatches) std::cerr << "PE mismatch, seed " << s << std::endl;
+      ++mismatches;
+    }
+  }
+  std::cout << 2 * nruns << " clusterings, " << mismatches << " mismatches" << std::endl;
+
+  // Satellite-like locus: split-reads at every base of a long stretch with scattered partner positions
+  {
+    std::srand(3);
+    ClusterTestConfig c;
+    c.graphPruning = 1000;
+    c.minCliqueSize = 2;
+    c.nchr = 1;
+    std::vector<SRBamRecord> srRef;
+    for(uint32_t k = 0; k < nsat; ++k) srRef.push_back(SRBamRecord(0, 1000000 + k, 0, 5000000 + std::rand() % 1600, 0, 0, 20, 0, (std::size_t) k));
+    std::sort(srRef.begin(), srRef.end(), SortSRBamRecord<SRBamRecord>());
+    std::vector<SRBamRecord> srNew(srRef);
+    std::vector<StructuralVariantRecord> svRef;
+    std::vector<StructuralVariantRecord> svNew;
+    std::clock_t start = std::clock();
+    clusterReference(c, srRef, svRef, 40, 2);
+    double tRef = _seconds(start);
+    start = std::clock();
+    cluster(c, srNew, svNew, 40, 2);
+    double tNew = _seconds(start);
+    if ((_dumpSVs(svRef) != _dumpSVs(svNew)) || (_dumpSVIds(srRef) != _dumpSVIds(srNew))) ++mismatches;
+    std::cout << "Satellite locus, " << nsat << " split-reads: reference " << tRef << "s, current " << tNew << "s, " << svNew.size() << " SVs" << std::endl;
+  }
+
+  // High-coverage breakpoint: one large component with one large clique
+  {
+    std::srand(5);
+    ClusterTestConfig c;
+    c.graphPruning = 100000000;
+    c.minCliqueSize = 2;
+    c.nchr = 1;
+    std::vector<SRBamRecord> srRef;
+    for(uint32_t k = 0; k < 2000; ++k) srRef.push_back(SRBamRecord(0, 1000000 + std::rand() % 120, 0, 5000000 + std::rand() % 120, 0, 0, 20, 0, (std::size_t) k));
+    std::sort(srRef.begin(), srRef.end(), SortSRBamRecord<SRBamRecord>());
+    std::vector<SRBamRecord> srNew(srRef);
+    std::vector<StructuralVariantRecord> svRef;
+    std::vector<StructuralVariantRecord> svNew;
+    std::clock_t start = std::clock();
+    clusterReference(c, srRef, svRef, 100, 2);
+    double tRef = _seconds(start);
+    start = std::clock();
+    cluster(c, srNew, svNew, 100, 2);
+    double tNew = _seconds(start);
+    if ((_dumpSVs(svRef) != _dumpSVs(svNew)) || (_dumpSVIds(srRef) != _dumpSVIds(srNew))) ++mismatches;
+    std::cout << "Dense breakpoint, 2000 split-reads: reference " << tRef << "s, current " << tNew << "s, " << svNew.size() << " SVs" << std::endl;
+  }
+  return (mismatches == 0) ? 0 : 1;
+}
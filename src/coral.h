@@ -15,10 +15,13 @@
 #include <htslib/faidx.h>
 
 #include "bed.h"
+#include "refcache.h"
 #include "scan.h"
 #include "gcbias.h"
 #include "cnv.h"
 #include "version.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 namespace torali
 {
@@ -29,6 +32,7 @@ namespace torali
     bool hasStatsFile;
     bool hasBedFile;
     bool hasScanFile;
+    bool hasTrackFile;
     bool noScanWindowSelection;
     uint32_t nchr;
     uint32_t meanisize;
@@ -53,6 +57,10 @@ namespace torali
     boost::filesystem::path bamFile;
     boost::filesystem::path bedFile;
     boost::filesystem::path scanFile;
+    boost::filesystem::path trackFile;
+    boost::filesystem::path metricsfile;
+    boost::filesystem::path refcache;
+    int32_t iothreads;
   };
 
   struct CountDNAConfigLib {
@@ -67,6 +75,7 @@ namespace torali
   bamCount(TConfig const& c, LibraryInfo const& li, std::vector<GcBias> const& gcbias, std::pair<uint32_t, uint32_t> const& gcbound) {
     // Load bam file
     samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
+    ioThreadsAttach(samfile);
     hts_set_fai_filename(samfile, c.genome.string().c_str());
     hts_idx_t* idx = sam_index_load(samfile, c.bamFile.string().c_str());
     bam_hdr_t* hdr = sam_hdr_read(samfile);
@@ -92,6 +101,7 @@ namespace torali
     dataOut.push(boost::iostreams::gzip_compressor());
     dataOut.push(boost::iostreams::file_sink(c.outfile.c_str(), std::ios_base::out | std::ios_base::binary));
     dataOut << "chr\tstart\tend\t" << c.sampleName << "_mappable\t" << c.sampleName << "_counts\t" << c.sampleName << "_CN" << std::endl;
+    uint64_t nwritten = 0;
 
     boost::iostreams::filtering_ostream panelOut;
     if (c.hasPanelFile) {
@@ -100,29 +110,38 @@ namespace torali
     }
     
     // Iterate chromosomes
-    faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
-    faidx_t* faiRef = fai_load(c.genome.string().c_str());
+    faidx_t* faiMap = NULL;
+    faidx_t* faiRef = NULL;
+    if (!c.hasTrackFile) {
+      faiMap = fai_load(c.mapFile.string().c_str());
+      faiRef = fai_load(c.genome.string().c_str());
+    }
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
       ++show_progress;
       if (chrNoData(c, refIndex, idx)) continue;
 
-      // Check presence in mappability map
-      std::string tname(hdr->target_name[refIndex]);
-      int32_t seqlen = faidx_seq_len(faiMap, tname.c_str());
-      if (seqlen == - 1) continue;
-      else seqlen = -1;
-      char* seq = faidx_fetch_seq(faiMap, tname.c_str(), 0, faidx_seq_len(faiMap, tname.c_str()), &seqlen);
-
-      // Check presence in reference
-      seqlen = faidx_seq_len(faiRef, tname.c_str());
-      if (seqlen == - 1) continue;
-      else seqlen = -1;
-      char* ref = faidx_fetch_seq(faiRef, tname.c_str(), 0, faidx_seq_len(faiRef, tname.c_str()), &seqlen);
-
       // Get GC and Mappability
+      std::string tname(hdr->target_name[refIndex]);
       std::vector<uint16_t> uniqContent(hdr->target_len[refIndex], 0);
       std::vector<uint16_t> gcContent(hdr->target_len[refIndex], 0);
-      {
+      if (c.hasTrackFile) {
+	if (!gcTrackContent(c.trackFile, tname, hdr->target_len[refIndex], c.meanisize, uniqContent, &gcContent)) continue;
+      } else {
+	// Check presence in mappability map
+	int32_t seqlen = faidx_seq_len(faiMap, tname.c_str());
+	if (seqlen == - 1) continue;
+	else seqlen = -1;
+	char* seq = fetchReference(c.mapFile, tname, seqlen);
+
+	// Check presence in reference
+	seqlen = faidx_seq_len(faiRef, tname.c_str());
+	if (seqlen == - 1) {
+	  releaseReference(seq);
+	  continue;
+	}
+	else seqlen = -1;
+	char* ref = fetchReference(c.genome, tname, seqlen);
+
 	// Mappability map
 	typedef boost::dynamic_bitset<> TBitSet;
 	TBitSet uniq(hdr->target_len[refIndex], false);
@@ -136,6 +155,8 @@ namespace torali
 	for(uint32_t i = 0; i < hdr->target_len[refIndex]; ++i) {
 	  if ((ref[i] == 'c') || (ref[i] == 'C') || (ref[i] == 'g') || (ref[i] == 'G')) gcref[i] = 1;
 	}
+	releaseReference(seq);
+	releaseReference(ref);
 
 	// Sum across fragment
 	int32_t halfwin = (int32_t) (c.meanisize / 2);
@@ -174,7 +195,9 @@ namespace torali
 	bam1_t* rec = bam_init1();
 	int32_t lastAlignedPos = 0;
 	std::set<std::size_t> lastAlignedPosReads;
+	uint64_t nread = 0;
 	while (sam_itr_next(samfile, iter, rec) >= 0) {
+	  ++nread;
 	  if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
 	  if (rec->core.qual < c.minQual) continue;	  
 	  if ((rec->core.flag & BAM_FPAIRED) && ((rec->core.flag & BAM_FMUNMAP) || (rec->core.tid != rec->core.mtid))) continue;
@@ -209,10 +232,9 @@ namespace torali
 	  if ((midPoint >= 0) && (midPoint < (int32_t) hdr->target_len[refIndex]) && (cov[midPoint] < maxCoverage - 1)) ++cov[midPoint];
 	}
 	// Clean-up
-	if (seq != NULL) free(seq);
-	if (ref != NULL) free(ref);
 	bam_destroy1(rec);
 	hts_itr_destroy(iter);
+	metricsReads(nread);
       }
 
 
@@ -261,6 +283,7 @@ namespace torali
 		      double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
 		      double cn = c.ploidy * covsum / expcov;
 		      dataOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (pos + 1) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+		      ++nwritten;
 		      // reset
 		      covsum = 0;
 		      expcov = 0;
@@ -316,8 +339,10 @@ namespace torali
 		double count = ((double) covsum / obsexp ) * (double) (it->second - it->first) / (double) winlen;
 		double cn = c.ploidy * covsum / expcov;
 		dataOut << std::string(hdr->target_name[refIndex]) << "\t" << it->first << "\t" << it->second << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+		++nwritten;
 	      } else {
 		dataOut << std::string(hdr->target_name[refIndex]) << "\t" << it->first << "\t" << it->second << "\tNA\tNA\tNA" << std::endl;
+		++nwritten;
 	      }
 	    }
 	  }
@@ -342,6 +367,7 @@ namespace torali
 		double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
 		double cn = c.ploidy * covsum / expcov;
 		dataOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (pos + 1) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+		++nwritten;
 		// reset
 		covsum = 0;
 		expcov = 0;
@@ -389,6 +415,7 @@ namespace torali
 		double count = ((double) covsum / obsexp ) * (double) c.window_size / (double) winlen;
 		double cn = c.ploidy * covsum / expcov;
 		dataOut << std::string(hdr->target_name[refIndex]) << "\t" << start << "\t" << (start + c.window_size) << "\t" << winlen << "\t" << count << "\t" << cn << std::endl;
+		++nwritten;
 	      }
 	    }
 	  }
@@ -445,8 +472,8 @@ namespace torali
     }
 
     // clean-up
-    fai_destroy(faiRef);
-    fai_destroy(faiMap);
+    if (faiRef != NULL) fai_destroy(faiRef);
+    if (faiMap != NULL) fai_destroy(faiMap);
     bam_hdr_destroy(hdr);
     hts_idx_destroy(idx);
     sam_close(samfile);
@@ -456,6 +483,7 @@ namespace torali
       panelOut.pop();
       panelOut.pop();
     }
+    metricsRecords(nwritten);
     
     return 0;
   }
@@ -469,13 +497,17 @@ namespace torali
     generic.add_options()
       ("help,?", "show help message")
       ("genome,g", boost::program_options::value<boost::filesystem::path>(&c.genome), "genome file")
+      ("ref-cache", boost::program_options::value<boost::filesystem::path>(&c.refcache), "memory-mapped genome cache file, built on first use (optional)")
       ("quality,q", boost::program_options::value<uint16_t>(&c.minQual)->default_value(10), "min. mapping quality")
       ("mappability,m", boost::program_options::value<boost::filesystem::path>(&c.mapFile), "input mappability map")
+      ("track,t", boost::program_options::value<boost::filesystem::path>(&c.trackFile), "GC and mappability track (delly gctrack), replaces -m")
       ("ploidy,y", boost::program_options::value<uint16_t>(&c.ploidy)->default_value(2), "baseline ploidy")
       ("fragment,e", boost::program_options::value<float>(&c.fragmentUnique)->default_value(0.97), "min. fragment uniqueness [0,1]")
       ("statsfile,s", boost::program_options::value<boost::filesystem::path>(&c.statsFile), "gzipped stats output file (optional)")
       ("outfile,o", boost::program_options::value<boost::filesystem::path>(&c.outfile)->default_value("out.cov.gz"), "output file")
       ("adaptive-windowing,a", "use mappable bases for window size")
+      ("metrics", boost::program_options::value<boost::filesystem::path>(&c.metricsfile), "per-stage JSON metrics report (optional)")
+      ("io-threads", boost::program_options::value<int32_t>(&c.iothreads)->default_value(0), "additional threads for BAM/CRAM/BCF (de)compression")
       ;
 
     boost::program_options::options_description window("Window options");
@@ -517,9 +549,10 @@ namespace torali
     boost::program_options::notify(vm);
 
     // Check command line arguments
-    if ((vm.count("help")) || (!vm.count("input-file")) || (!vm.count("genome")) || (!vm.count("mappability"))) {
+    if ((vm.count("help")) || (!vm.count("input-file")) || (!vm.count("genome")) || ((!vm.count("mappability")) && (!vm.count("track")))) {
       std::cout << std::endl;
       std::cout << "Usage: delly " << argv[0] << " [OPTIONS] -g <genome.fa> -m <genome.map> <aligned.bam>" << std::endl;
+      std::cout << "       delly " << argv[0] << " [OPTIONS] -g <genome.fa> -t <genome.gct> <aligned.bam>" << std::endl;
       std::cout << visible_options << "\n";
       return 1;
     }
@@ -543,6 +576,10 @@ namespace torali
     if (vm.count("scan-regions")) c.hasScanFile = true;
     else c.hasScanFile = false;
 
+    // GC and mappability track
+    if (vm.count("track")) c.hasTrackFile = true;
+    else c.hasTrackFile = false;
+
     // Scan window selection
     if (vm.count("no-window-selection")) c.noScanWindowSelection = true;
     else c.noScanWindowSelection = false;
@@ -554,6 +591,21 @@ namespace torali
     // CNV mode
     if (vm.count("panelfile")) c.hasPanelFile = true;
     else c.hasPanelFile = false;
+
+    // Reference cache?
+    if (vm.count("ref-cache")) {
+      if (!_outfileValid(c.refcache)) return 1;
+      referenceCacheEnable(c.genome, c.refcache);
+    }
+
+    // Per-stage metrics?
+    if (vm.count("metrics")) {
+      if (!_outfileValid(c.metricsfile)) return 1;
+      metricsEnable("rd", c.metricsfile);
+    }
+    
+    // Shared I/O thread pool
+    if (!ioThreadsEnable(c.iothreads)) return 1;
     
     // Check window size
     if (c.window_offset > c.window_size) c.window_offset = c.window_size;
@@ -598,19 +650,22 @@ namespace torali
 
       // Check matching chromosome names
       faidx_t* faiRef = fai_load(c.genome.string().c_str());
-      faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
+      faidx_t* faiMap = NULL;
+      if (!c.hasTrackFile) faiMap = fai_load(c.mapFile.string().c_str());
       uint32_t mapFound = 0;
       uint32_t refFound = 0;
       for(int32_t refIndex=0; refIndex < hdr->n_targets; ++refIndex) {
 	std::string tname(hdr->target_name[refIndex]);
-	if (faidx_has_seq(faiMap, tname.c_str())) ++mapFound;
+	if (c.hasTrackFile) {
+	  if (gcTrackHasContig(c.trackFile, tname, DELLY_GCTRACK_MAP)) ++mapFound;
+	} else if (faidx_has_seq(faiMap, tname.c_str())) ++mapFound;
 	if (faidx_has_seq(faiRef, tname.c_str())) ++refFound;
 	else {
 	  std::cerr << "Warning: BAM chromosome " << tname << " not present in reference genome!" << std::endl;
 	}
       }
       fai_destroy(faiRef);
-      fai_destroy(faiMap);
+      if (faiMap != NULL) fai_destroy(faiMap);
       if (!mapFound) {
 	std::cerr << "Mappability map chromosome naming disagrees with BAM file!" << std::endl;
 	return 1;
@@ -639,7 +694,9 @@ namespace torali
       dellyConf.files.push_back(c.bamFile);
       dellyConf.madCutoff = 9;
       dellyConf.madNormalCutoff = c.mad;
-      getLibraryParams(dellyConf, scanRegions, sampleLib);
+      int32_t stage = metricsStart("library");
+      if (!getLibraryParams(dellyConf, scanRegions, sampleLib)) return 1;
+      metricsStop(stage);
       li = sampleLib[0];
       if (!li.median) {
 	li.median = 250;
@@ -664,13 +721,17 @@ namespace torali
       typedef std::vector<ScanWindow> TWindowCounts;
       typedef std::vector<TWindowCounts> TGenomicWindowCounts;
       TGenomicWindowCounts scanCounts(c.nchr, TWindowCounts());
+      int32_t stage = metricsStart("scan");
       scan(c, li, scanCounts);
     
       // Select stable windows
       selectWindows(c, scanCounts);
+      metricsStop(stage);
 
       // Estimate GC bias
+      stage = metricsStart("gcbias");
       gcBias(c, scanCounts, li, gcbias, gcbound);
+      metricsStop(stage);
 
       // Statistics output
       if (c.hasStatsFile) {
@@ -684,6 +745,7 @@ namespace torali
 	
 	// Scan window summry
 	samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
+	ioThreadsAttach(samfile);
 	bam_hdr_t* hdr = sam_hdr_read(samfile);
 	statsOut << "SW\tchrom\tstart\tend\tselected\tcoverage\tuniqcov" <<  std::endl;
 	for(uint32_t refIndex = 0; refIndex < (uint32_t) hdr->n_targets; ++refIndex) {
@@ -704,10 +766,18 @@ namespace torali
     }
       
     // Count reads
+    int32_t stage = metricsStart("count");
     if (bamCount(c, li, gcbias, gcbound)) {
       std::cerr << "Read counting error!" << std::endl;
       return 1;
     }
+    metricsStop(stage);
+
+    // All files are closed
+    ioThreadsDestroy();
+
+    // Metrics report
+    if (!metricsWrite()) return 1;
 
     // Done
     now = boost::posix_time::second_clock::local_time();
@@ -3,6 +3,7 @@
 
 #include <boost/container/flat_set.hpp>
 #include <boost/dynamic_bitset.hpp>
+#include <boost/icl/interval_set.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/stream_buffer.hpp>
 #include <boost/iostreams/device/file.hpp>
@@ -17,6 +18,10 @@
 #include "util.h"
 #include "msa.h"
 #include "split.h"
+#include "striped.h"
+#include "refcache.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 
 namespace torali {
@@ -76,6 +81,183 @@ namespace torali {
     JunctionCount() : refh1(0), refh2(0), alth1(0), alth2(0) {}
   };
 
+  // Evidence resolved while merging tasks in sample and chromosome order
+  // kind 0-3: junction ref/alt and spanning ref/alt read of an SV with breakpoints on two chromosomes, read cap and reference-bias alternation are shared across both chromosomes
+  // kind 4: second read of an inter-chromosomal pair spanning SV breakpoints, resolved once the first reads of all chromosomes are known
+  struct DeferredEvidence {
+    bool haplotagged;
+    bool pass;  // Junction alignment quality above threshold
+    int32_t kind;
+    std::size_t hv;
+    int32_t svt;
+    int32_t hap;
+    uint8_t qual;
+    std::size_t dumpPos;  // Position in the task dump
+    std::vector<uint32_t> ids;
+    std::string dump;
+
+    DeferredEvidence(int32_t const k, std::size_t const h, int32_t const s, uint8_t const q, std::size_t const dp) : haplotagged(false), pass(true), kind(k), hv(h), svt(s), hap(0), qual(q), dumpPos(dp) {}
+  };
+
+  // Sample-chromosome unit of annotateCoverage, evidence is keyed by SV id and merged in task order
+  template<typename TCountPair, typename TSpanPair>
+  struct CoverageTask {
+    uint32_t file_c;
+    int32_t refIndex;
+    bool haplotagged;
+    std::map<uint32_t, TCountPair> countMap;
+    std::map<uint32_t, TSpanPair> spanMap;
+    boost::unordered_map<std::size_t, uint8_t> qualitiestra;
+    std::vector<DeferredEvidence> deferred;
+    std::string dump;
+
+    CoverageTask(uint32_t const f, int32_t const r) : file_c(f), refIndex(r), haplotagged(false) {}
+  };
+
+  inline std::string
+  _dumpSVID(int32_t const svt, uint32_t const id) {
+    std::string svid(_addID(svt));
+    std::string padNumber = boost::lexical_cast<std::string>(id);
+    padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
+    return svid + padNumber;
+  }
+
+  template<typename TCount>
+  inline void
+  _addHaplotype(TCount& h1, TCount& h2, int32_t const hap) {
+    if (hap == 1) ++h1;
+    else ++h2;
+  }
+
+  #ifndef DELLY_COVERAGE_CHUNK_BITS
+  #define DELLY_COVERAGE_CHUNK_BITS 12
+  #endif
+
+  // Read-depth windows left of, within and right of an SV
+  struct CoverageWindows {
+    bool smallSV;
+    int32_t lstart;
+    int32_t lend;
+    int32_t mstart;
+    int32_t mend;
+    int32_t rstart;
+    int32_t rend;
+  };
+
+  template<typename TSV>
+  inline void
+  _coverageWindows(TSV const& sv, int32_t const indelsize, int32_t const len, CoverageWindows& cw) {
+    // Small or large SV
+    cw.smallSV = false;
+    int32_t halfSize = (sv.svEnd - sv.svStart)/2;
+    if ((_translocation(sv.svt)) || (sv.svt == 4)) {
+      halfSize = 500;
+      cw.smallSV = true;
+    } else {
+      if ((sv.svEnd - sv.svStart) <= indelsize) cw.smallSV = true;
+    }
+
+    // Left region
+    cw.lstart = std::max(sv.svStart - halfSize, 0);
+    cw.lend = sv.svStart;
+
+    // Actual SV
+    cw.mstart = sv.svStart;
+    cw.mend = sv.svEnd;
+    if ((_translocation(sv.svt)) || (sv.svt == 4)) {
+      cw.mstart = std::max(sv.svStart - halfSize, 0);
+      cw.mend = std::min(sv.svStart + halfSize, len);
+    }
+
+    // Right region
+    cw.rstart = sv.svEnd;
+    cw.rend = std::min(sv.svEnd + halfSize, len);
+    if ((_translocation(sv.svt)) || (sv.svt == 4)) {
+      cw.rstart = sv.svStart;
+      cw.rend = std::min(sv.svStart + halfSize, len);
+    }
+  }
+
+  // Saturating per-base counts of a chromosome, only chunks overlapping a reserved window are allocated.
+  // Once counting is done, _indexCoverage turns the counts into prefix sums for constant-time window queries.
+  template<typename TCount>
+  struct SparseCoverage {
+    typedef std::vector<TCount> TChunk;
+    typedef std::vector<uint32_t> TPrefix;
+    uint32_t len;
+    std::vector<TChunk> chunks;
+    std::vector<TPrefix> prefix;
+    std::vector<int64_t> base;
+
+    explicit SparseCoverage(uint32_t const l) : len(l), chunks((l >> DELLY_COVERAGE_CHUNK_BITS) + 1) {}
+  };
+
+  template<typename TCount>
+  inline void
+  _reserveCoverage(SparseCoverage<TCount>& sc, int32_t const start, int32_t const end) {
+    uint32_t e = std::min((uint32_t) end, sc.len);
+    if ((start < 0) || ((uint32_t) start >= e)) return;
+    for(uint32_t k = (start >> DELLY_COVERAGE_CHUNK_BITS); k <= ((e - 1) >> DELLY_COVERAGE_CHUNK_BITS); ++k) {
+      if (sc.chunks[k].empty()) sc.chunks[k].resize(1 << DELLY_COVERAGE_CHUNK_BITS, 0);
+    }
+  }
+
+  template<typename TCount>
+  inline void
+  _incCoverage(SparseCoverage<TCount>& sc, uint32_t const pos) {
+    if (pos >= sc.len) return;
+    typename SparseCoverage<TCount>::TChunk& chunk = sc.chunks[pos >> DELLY_COVERAGE_CHUNK_BITS];
+    if (chunk.empty()) return;
+    TCount& cnt = chunk[pos & ((1 << DELLY_COVERAGE_CHUNK_BITS) - 1)];
+    if (cnt < std::numeric_limits<TCount>::max() - 1) ++cnt;
+  }
+
+  // Chunk-local exclusive prefix sums and the total of all preceding chunks, counts are released chunk by chunk
+  template<typename TCount>
+  inline void
+  _indexCoverage(SparseCoverage<TCount>& sc) {
+    sc.prefix.resize(sc.chunks.size());
+    sc.base.resize(sc.chunks.size());
+    int64_t total = 0;
+    for(uint32_t k = 0; k < sc.chunks.size(); ++k) {
+      sc.base[k] = total;
+      if (sc.chunks[k].empty()) continue;
+      sc.prefix[k].resize(sc.chunks[k].size());
+      uint32_t cum = 0;
+      for(uint32_t i = 0; i < sc.chunks[k].size(); ++i) {
+	sc.prefix[k][i] = cum;
+	cum += sc.chunks[k][i];
+      }
+      total += cum;
+      typename SparseCoverage<TCount>::TChunk().swap(sc.chunks[k]);
+    }
+  }
+
+  // Sum of counts in [0, pos), pos <= len
+  template<typename TCount>
+  inline int64_t
+  _prefixCoverage(SparseCoverage<TCount> const& sc, uint32_t const pos) {
+    uint32_t k = pos >> DELLY_COVERAGE_CHUNK_BITS;
+    if (sc.prefix[k].empty()) return sc.base[k];
+    return sc.base[k] + sc.prefix[k][pos & ((1 << DELLY_COVERAGE_CHUNK_BITS) - 1)];
+  }
+
+  // Sum over [start, end) clipped to the chromosome, requires _indexCoverage
+  template<typename TCount>
+  inline int32_t
+  _sumCoverage(SparseCoverage<TCount> const& sc, int32_t const start, int32_t const end) {
+    uint32_t e = std::min((uint32_t) end, sc.len);
+    if ((uint32_t) start >= e) return 0;
+    return (int32_t) (_prefixCoverage(sc, e) - _prefixCoverage(sc, start));
+  }
+
+  // Any flagged position in [start, end)?
+  inline bool
+  _anyFlagged(boost::icl::interval_set<uint32_t> const& flagged, int32_t const start, int32_t const end) {
+    if ((start < 0) || (start >= end)) return false;
+    return boost::icl::intersects(flagged, boost::icl::discrete_interval<uint32_t>::right_open(start, end));
+  }
+
   template<typename TAlign, typename TQualities>
   inline uint32_t
   _getAlignmentQual(TAlign const& align, TQualities const& qual) {
@@ -153,7 +335,6 @@ namespace torali {
     boost::progress_display show_progresss( hdr->n_targets );
 
     TProbes refProbes(svs.size());
-    faidx_t* fai = fai_load(c.genome.string().c_str());
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
       ++show_progresss;
       char* seq = NULL;
@@ -167,7 +348,7 @@ namespace torali {
 	if (seq == NULL) {
 	  int32_t seqlen = -1;
 	  std::string tname(hdr->target_name[refIndex]);
-	  seq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex], &seqlen);
+	  seq = fetchReference(c.genome, tname, seqlen);
 	}
 
 	// Set tag alleles
@@ -235,18 +416,123 @@ namespace torali {
 	  }
 	}
       }
-      if (seq != NULL) free(seq);
+      releaseReference(seq);
     }
-    // Clean-up
-    fai_destroy(fai);
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
       // Sort breakpoint regions
       std::sort(bpRegion[refIndex].begin(), bpRegion[refIndex].end(), SortBp<BpRegion>());
     }
   }
 
-  template<typename TConfig, typename TSampleLibrary, typename TSVs, typename TCoverageCount, typename TCountMap, typename TSpanMap>
+  // Merge the tasks of one sample in chromosome order and release their evidence
+  template<typename TConfig, typename TCoverageTask, typename TCountPairs, typename TSpanPairs, typename TDumpStream>
   inline void
+  _mergeCoverageTasks(TConfig& c, std::vector<TCoverageTask>& tasks, uint32_t const file_c, TCountPairs& countMap, TSpanPairs& spanMap, TDumpStream& dumpOut)
+  {
+    typedef typename TCountPairs::value_type TCountPair;
+    typedef typename TSpanPairs::value_type TSpanPair;
+    typedef boost::unordered_map<std::size_t, uint8_t> TQualities;
+    TQualities qualitiestra;
+    typedef std::map<uint32_t, uint32_t> TRefAlignCount;
+    TRefAlignCount refAlignedReadCount;
+    TRefAlignCount refAlignedSpanCount;
+    for(uint32_t task = 0; task < tasks.size(); ++task) {
+      TCoverageTask& ct = tasks[task];
+      if (ct.file_c < file_c) continue;
+      if (ct.file_c > file_c) break;
+      if (ct.haplotagged) c.isHaplotagged = true;
+      for(typename std::map<uint32_t, TCountPair>::iterator it = ct.countMap.begin(); it != ct.countMap.end(); ++it) {
+	TCountPair& jc = countMap[it->first];
+	jc.ref.insert(jc.ref.end(), it->second.ref.begin(), it->second.ref.end());
+	jc.alt.insert(jc.alt.end(), it->second.alt.begin(), it->second.alt.end());
+	jc.refh1 += it->second.refh1;
+	jc.refh2 += it->second.refh2;
+	jc.alth1 += it->second.alth1;
+	jc.alth2 += it->second.alth2;
+      }
+      for(typename std::map<uint32_t, TSpanPair>::iterator it = ct.spanMap.begin(); it != ct.spanMap.end(); ++it) {
+	TSpanPair& sc = spanMap[it->first];
+	sc.ref.insert(sc.ref.end(), it->second.ref.begin(), it->second.ref.end());
+	sc.alt.insert(sc.alt.end(), it->second.alt.begin(), it->second.alt.end());
+	sc.refh1 += it->second.refh1;
+	sc.refh2 += it->second.refh2;
+	sc.alth1 += it->second.alth1;
+	sc.alth2 += it->second.alth2;
+      }
+
+      // First reads of inter-chromosomal pairs always precede their mates in chromosome order
+      for(TQualities::const_iterator it = ct.qualitiestra.begin(); it != ct.qualitiestra.end(); ++it) qualitiestra[it->first] = it->second;
+
+      // Replay deferred evidence in read order, dump lines keep their position
+      std::size_t dumpPos = 0;
+      for(uint32_t i = 0; i < ct.deferred.size(); ++i) {
+	DeferredEvidence const& de = ct.deferred[i];
+	if (c.hasDumpFile) {
+	  dumpOut << ct.dump.substr(dumpPos, de.dumpPos - dumpPos);
+	  dumpPos = de.dumpPos;
+	}
+	if (de.kind < 2) {
+	  // Junction read, capped per SV
+	  TCountPair& jc = countMap[de.ids[0]];
+	  if ((jc.ref.size() + jc.alt.size()) >= c.maxGenoReadCount) continue;
+	  if (de.kind == 0) {
+	    if ((!(++refAlignedReadCount[de.ids[0]] % 2)) || (!de.pass)) continue;
+	    jc.ref.push_back(de.qual);
+	    if (de.haplotagged) {
+	      c.isHaplotagged = true;
+	      _addHaplotype(jc.refh1, jc.refh2, de.hap);
+	    }
+	  } else {
+	    if (c.hasDumpFile) dumpOut << de.dump;
+	    jc.alt.push_back(de.qual);
+	    if (de.haplotagged) {
+	      c.isHaplotagged = true;
+	      _addHaplotype(jc.alth1, jc.alth2, de.hap);
+	    }
+	  }
+	} else if (de.kind == 2) {
+	  // Normal spanning pair
+	  if (!(++refAlignedSpanCount[de.ids[0]] % 2)) continue;
+	  TSpanPair& sc = spanMap[de.ids[0]];
+	  sc.ref.push_back(de.qual);
+	  if (de.haplotagged) {
+	    c.isHaplotagged = true;
+	    _addHaplotype(sc.refh1, sc.refh2, de.hap);
+	  }
+	} else if (de.kind == 3) {
+	  // Abnormal spanning pair
+	  if (c.hasDumpFile) dumpOut << de.dump;
+	  TSpanPair& sc = spanMap[de.ids[0]];
+	  sc.alt.push_back(de.qual);
+	  if (de.haplotagged) {
+	    c.isHaplotagged = true;
+	    _addHaplotype(sc.alth1, sc.alth2, de.hap);
+	  }
+	} else {
+	  // Mate on another chromosome
+	  TQualities::iterator itQual = qualitiestra.find(de.hv);
+	  if (itQual == qualitiestra.end()) continue; // Mate discarded
+	  uint8_t pairQuality = std::min(itQual->second, de.qual);
+	  itQual->second = 0;
+	  if (pairQuality < c.minGenoQual) continue; // Low quality pair
+	  for(uint32_t k = 0; k < de.ids.size(); ++k) {
+	    if (c.hasDumpFile) dumpOut << _dumpSVID(de.svt, de.ids[k]) << de.dump;
+	    TSpanPair& sc = spanMap[de.ids[k]];
+	    sc.alt.push_back(pairQuality);
+	    if (de.haplotagged) {
+	      c.isHaplotagged = true;
+	      _addHaplotype(sc.alth1, sc.alth2, de.hap);
+	    }
+	  }
+	}
+      }
+      if (c.hasDumpFile) dumpOut << ct.dump.substr(dumpPos);
+      ct = TCoverageTask(file_c, ct.refIndex);
+    }
+  }
+
+  template<typename TConfig, typename TSampleLibrary, typename TSVs, typename TCoverageCount, typename TCountMap, typename TSpanMap>
+  inline bool
   annotateCoverage(TConfig& c, TSampleLibrary& sampleLib, TSVs& svs, TCoverageCount& covCount, TCountMap& countMap, TSpanMap& spanMap)
   {
     typedef typename TCoverageCount::value_type::value_type TCovPair;
@@ -261,13 +547,11 @@ namespace torali {
     TSamFile samfile(c.files.size());
     TIndex idx(c.files.size());
     THeader hdr(c.files.size());
-    int32_t totalTarget = 0;
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
       hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
       idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
       hdr[file_c] = sam_hdr_read(samfile[file_c]);
-      totalTarget += hdr[file_c]->n_targets;
     }
 
     // Initialize coverage count maps
@@ -304,43 +588,11 @@ namespace torali {
     //}
     //}
     
-    // Iterate all samples
-    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
-    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "SV annotation" << std::endl;
-    boost::progress_display show_progress( totalTarget );
-
-    
-    typedef std::vector<uint32_t> TRefAlignCount;
-    typedef std::vector<TRefAlignCount> TFileRefAlignCount;
-    TFileRefAlignCount refAlignedReadCount(c.files.size(), TRefAlignCount());
-    TFileRefAlignCount refAlignedSpanCount(c.files.size(), TRefAlignCount());
+    // Sample-chromosome tasks
+    typedef CoverageTask<TCountPair, TSpanPair> TCoverageTask;
+    std::vector<TCoverageTask> tasks;
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      refAlignedReadCount[file_c].resize(svs.size(), 0);
-      refAlignedSpanCount[file_c].resize(svs.size(), 0);
-    }
-    
-    // Dump file
-    boost::iostreams::filtering_ostream dumpOut;
-    if (c.hasDumpFile) {
-      dumpOut.push(boost::iostreams::gzip_compressor());
-      dumpOut.push(boost::iostreams::file_sink(c.dumpfile.string().c_str(), std::ios_base::out | std::ios_base::binary));
-      dumpOut << "#svid\tbam\tqname\tchr\tpos\tmatechr\tmatepos\tmapq\ttype" << std::endl;
-    }
-
-#pragma omp parallel for default(shared)
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      // Pair qualities and features
-      typedef boost::unordered_map<std::size_t, uint8_t> TQualities;
-      TQualities qualities;
-      TQualities qualitiestra;
-      typedef boost::unordered_map<std::size_t, bool> TClip;
-      TClip clip;
-      TClip cliptra;
-      
-      // Iterate chromosomes
       for(int32_t refIndex=0; refIndex < (int32_t) hdr[file_c]->n_targets; ++refIndex) {
-	++show_progress;
-      
 	// Any SV breakpoints on this chromosome?
 	if (!svOnChr[refIndex]) continue;
 
@@ -354,50 +606,109 @@ namespace torali {
 	hts_idx_get_stat(idx[file_c], refIndex, &mapped, &unmapped);
 	if (mapped) nodata = false;
 	if (nodata) continue;
-	
-	// Coverage track
-	typedef uint16_t TCount;
-	uint32_t maxCoverage = std::numeric_limits<TCount>::max();
-	typedef std::vector<TCount> TCoverage;
-	TCoverage covFragment(hdr[file_c]->target_len[refIndex], 0);
-	TCoverage covBases(hdr[file_c]->target_len[refIndex], 0);
-	
+	tasks.push_back(TCoverageTask(file_c, refIndex));
+      }
+    }
+
+    // SVs with breakpoints on two chromosomes
+    std::vector<bool> interChr(svs.size(), false);
+    for(uint32_t i = 0; i < svs.size(); ++i) interChr[svs[i].id] = (svs[i].chr != svs[i].chr2);
+
+    // Iterate all samples and chromosomes
+    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "SV annotation" << std::endl;
+    boost::progress_display show_progress( tasks.size() );
+
+    // Dump file
+    boost::iostreams::filtering_ostream dumpOut;
+    if (c.hasDumpFile) {
+      dumpOut.push(boost::iostreams::gzip_compressor());
+      dumpOut.push(boost::iostreams::file_sink(c.dumpfile.string().c_str(), std::ios_base::out | std::ios_base::binary));
+      dumpOut << "#svid\tbam\tqname\tchr\tpos\tmatechr\tmatepos\tmapq\ttype" << std::endl;
+    }
+    std::vector<uint32_t> pendingTasks(c.files.size(), 0);
+    for(uint32_t task = 0; task < tasks.size(); ++task) ++pendingTasks[tasks[task].file_c];
+    uint32_t mergedSamples = 0;
+    bool failed = false;
+
+#pragma omp parallel default(shared)
+    {
+      // Thread-local file handle, tasks are sample-major
+      SampleHandle sh;
+
+#pragma omp for schedule(dynamic)
+      for(int32_t task = 0; task < (int32_t) tasks.size(); ++task) {
+	++show_progress;
+	TCoverageTask& ct = tasks[task];
+	uint32_t file_c = ct.file_c;
+	int32_t refIndex = ct.refIndex;
+	if (!_sampleHandleOpen(c, file_c, sh, failed)) continue;
+
+	// Pair qualities and features
+	typedef boost::unordered_map<std::size_t, uint8_t> TQualities;
+	TQualities qualities;
+	typedef boost::unordered_map<std::size_t, bool> TClip;
+	TClip clip;
+
+	// Reference bias counters
+	typedef std::map<uint32_t, uint32_t> TRefAlignCount;
+	TRefAlignCount refAlignedReadCount;
+	TRefAlignCount refAlignedSpanCount;
+
+	// Coverage track, restricted to the read-depth windows of SVs on this chromosome
+	typedef SparseCoverage<uint16_t> TCoverage;
+	TCoverage covFragment(hdr[file_c]->target_len[refIndex]);
+	TCoverage covBases(hdr[file_c]->target_len[refIndex]);
+	typedef std::vector<CoverageWindows> TCoverageWindows;
+	TCoverageWindows covWindows(svs.size());
+	for(uint32_t i = 0; i < svs.size(); ++i) {
+	  if (svs[i].chr != refIndex) continue;
+	  CoverageWindows& cw = covWindows[i];
+	  _coverageWindows(svs[i], c.indelsize, hdr[0]->target_len[refIndex], cw);
+	  TCoverage& cov = (cw.smallSV) ? covBases : covFragment;
+	  _reserveCoverage(cov, cw.lstart, cw.lend);
+	  _reserveCoverage(cov, cw.mstart, cw.mend);
+	  _reserveCoverage(cov, cw.rstart, cw.rend);
+	}
+
 	// Flag breakpoint regions
-	typedef boost::dynamic_bitset<> TBitSet;
-	TBitSet bpOccupied(hdr[file_c]->target_len[refIndex]);
+	typedef boost::icl::interval_set<uint32_t> TFlagged;
+	TFlagged bpOccupied;
 	for(uint32_t i = 0; i < bpRegion[refIndex].size(); ++i) {
-	  for(int32_t k = bpRegion[refIndex][i].regionStart; k < bpRegion[refIndex][i].regionEnd; ++k) {
-	    bpOccupied[k] = 1;
-	  }
+	  int32_t rstart = std::max(bpRegion[refIndex][i].regionStart, 0);
+	  int32_t rend = std::min(bpRegion[refIndex][i].regionEnd, (int32_t) hdr[file_c]->target_len[refIndex]);
+	  if (rstart < rend) bpOccupied += boost::icl::discrete_interval<uint32_t>::right_open(rstart, rend);
 	}
-	
+
 	// Flag spanning breakpoints
 	typedef std::vector<SpanPoint> TSpanPoint;
 	TSpanPoint spanPoint;
-	typedef boost::dynamic_bitset<> TBitSet;
-	TBitSet spanBp(hdr[file_c]->target_len[refIndex]);
+	TFlagged spanBp;
 	for(typename TSVs::iterator itSV = svs.begin(); itSV != svs.end(); ++itSV) {
 	  if (itSV->peSupport == 0) continue;
 	  if ((itSV->chr == refIndex) && (itSV->svStart < (int32_t) hdr[file_c]->target_len[refIndex])) {
-	    spanBp[itSV->svStart] = 1;
+	    spanBp += (uint32_t) itSV->svStart;
 	    spanPoint.push_back(SpanPoint(itSV->svStart, itSV->svt, itSV->id));
 	  }
 	  if ((itSV->chr2 == refIndex) && (itSV->svEnd < (int32_t) hdr[file_c]->target_len[refIndex])) {
-	    spanBp[itSV->svEnd] = 1;
+	    spanBp += (uint32_t) itSV->svEnd;
 	    spanPoint.push_back(SpanPoint(itSV->svEnd, itSV->svt, itSV->id));
 	  }
 	}
 	std::sort(spanPoint.begin(), spanPoint.end(), SortBp<SpanPoint>());
-      
+
 	// Count reads
-	hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, 0, hdr[file_c]->target_len[refIndex]);
+	hts_itr_t* iter = sam_itr_queryi(sh.idx, refIndex, 0, hdr[file_c]->target_len[refIndex]);
 	bam1_t* rec = bam_init1();
 	int32_t lastAlignedPos = 0;
 	std::set<std::size_t> lastAlignedPosReads;
-	while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
+	uint64_t nread = 0;
+	uint64_t nalign = 0;
+	while (sam_itr_next(sh.samfile, iter, rec) >= 0) {
+	  ++nread;
 	  if (rec->core.flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP | BAM_FSUPPLEMENTARY | BAM_FUNMAP | BAM_FMUNMAP)) continue;
 	  if (rec->core.qual < c.minGenoQual) continue;
-	  
+
 	  // Count aligned basepair (small InDels)
 	  {
 	    uint32_t rp = 0; // reference pointer
@@ -405,7 +716,7 @@ namespace torali {
 	    for (std::size_t i = 0; i < rec->core.n_cigar; ++i) {
 	      if (bam_cigar_op(cigar[i]) == BAM_CMATCH) {
 		for(std::size_t k = 0; k<bam_cigar_oplen(cigar[i]);++k) {
-		  if ((rec->core.pos + rp < hdr[file_c]->target_len[refIndex]) && (covBases[rec->core.pos + rp] < maxCoverage - 1)) ++covBases[rec->core.pos + rp];
+		  _incCoverage(covBases, rec->core.pos + rp);
 		  ++rp;
 		}
 	      } else if (bam_cigar_op(cigar[i]) == BAM_CDEL) {
@@ -415,7 +726,7 @@ namespace torali {
 	      }
 	    }
 	  }
-	  
+
 	  // Any (leading) soft clip
 	  bool hasSoftClip = false;
 	  bool hasClip = false;
@@ -428,49 +739,45 @@ namespace torali {
 	      if (i == 0) leadingSC = bam_cigar_oplen(cigar[i]);
 	    } else if (bam_cigar_op(cigar[i]) == BAM_CHARD_CLIP) hasClip = true;
 	  }
-	  
+
 	  // Check read length for junction annotation
 	  if (rec->core.l_qseq >= (2 * c.minimumFlankSize)) {
-	    bool bpvalid = false;
 	    int32_t rbegin = std::max(0, (int32_t) rec->core.pos - leadingSC);
-	    for(int32_t k = rbegin; ((k < (rec->core.pos + rec->core.l_qseq)) && (k < (int32_t) hdr[file_c]->target_len[refIndex])); ++k) {
-	      if (bpOccupied[k]) {
-		bpvalid = true;
-		break;
-	      }
-	    }
-	    if (bpvalid) {
+	    if (_anyFlagged(bpOccupied, rbegin, std::min((int32_t) (rec->core.pos + rec->core.l_qseq), (int32_t) hdr[file_c]->target_len[refIndex]))) {
 	      // Fetch all relevant SVs
 	      typename TBpRegion::iterator itBp = std::lower_bound(bpRegion[refIndex].begin(), bpRegion[refIndex].end(), BpRegion(rbegin), SortBp<BpRegion>());
 	      for(; ((itBp != bpRegion[refIndex].end()) && (rec->core.pos + rec->core.l_qseq >= itBp->bppos)); ++itBp) {
-		if ((countMap[file_c][itBp->id].ref.size() + countMap[file_c][itBp->id].alt.size()) >= c.maxGenoReadCount) continue;
+		bool defer = interChr[itBp->id];
+		TCountPair& jc = ct.countMap[itBp->id];
+		if ((!defer) && ((jc.ref.size() + jc.alt.size()) >= c.maxGenoReadCount)) continue;
 		// Read spans breakpoint?
 		if ((hasSoftClip) || ((!hasClip) && (rec->core.pos + c.minimumFlankSize + itBp->homLeft <= itBp->bppos) &&  (rec->core.pos + rec->core.l_qseq >= itBp->bppos + c.minimumFlankSize + itBp->homRight))) {
 		  std::string consProbe = consProbeArr[itBp->bpPoint][itBp->id];
 		  std::string refProbe = refProbeArr[itBp->bpPoint][itBp->id];
-		  
+
 		  // Get sequence
 		  std::string sequence;
 		  sequence.resize(rec->core.l_qseq);
 		  uint8_t* seqptr = bam_get_seq(rec);
 		  for (int i = 0; i < rec->core.l_qseq; ++i) sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
 		  _adjustOrientation(sequence, itBp->bpPoint, itBp->svt);
-		
-		  // Compute alignment to alternative haplotype
+
+		  // Compute alignment score to alternative haplotype
 		  typedef boost::multi_array<char, 2> TAlign;
 		  TAlign alignAlt;
 		  DnaScore<int> simple(5, -4, -4, -4);
 		  AlignConfig<true, false> semiglobal;
-		  int32_t scoreA = needle(consProbe, sequence, alignAlt, semiglobal, simple);
+		  int32_t scoreA = stripedNeedleScore(consProbe, sequence, semiglobal, simple);
 		  int32_t scoreAltThreshold = (int32_t) (c.flankQuality * consProbe.size() * simple.match + (1.0 - c.flankQuality) * consProbe.size() * simple.mismatch);
 		  double scoreAlt = (double) scoreA / (double) scoreAltThreshold;
-		  
-		  // Compute alignment to reference haplotype
+
+		  // Compute alignment score to reference haplotype
 		  TAlign alignRef;
-		  int32_t scoreR = needle(refProbe, sequence, alignRef, semiglobal, simple);
+		  int32_t scoreR = stripedNeedleScore(refProbe, sequence, semiglobal, simple);
 		  int32_t scoreRefThreshold = (int32_t) (c.flankQuality * refProbe.size() * simple.match + (1.0 - c.flankQuality) * refProbe.size() * simple.mismatch);
 		  double scoreRef = (double) scoreR / (double) scoreRefThreshold;
-		  
+		  nalign += 2;
+
 		  // Any confident alignment?
 		  if ((scoreRef > 1) || (scoreAlt > 1)) {
 		    // Debug alignment to REF and ALT
@@ -483,30 +790,39 @@ namespace torali {
 		    //for(TAIndex j = 0; j< (TAIndex) alignRef.shape()[1]; ++j) std::cerr << alignRef[i][j];
 		    //std::cerr << std::endl;
 		    //}
-		    
+
 		    if (scoreRef > scoreAlt) {
 		      // Account for reference bias
-		      if (++refAlignedReadCount[file_c][itBp->id] % 2) {
+		      if ((defer) || (++refAlignedReadCount[itBp->id] % 2)) {
+			needle(refProbe, sequence, alignRef, semiglobal, simple);
+			++nalign;
 			TQuality quality;
 			quality.resize(rec->core.l_qseq);
 			uint8_t* qualptr = bam_get_qual(rec);
 			for (int i = 0; i < rec->core.l_qseq; ++i) quality[i] = qualptr[i];
 			uint32_t rq = _getAlignmentQual(alignRef, quality);
-			if (rq >= c.minGenoQual) {
+			if (defer) {
 			  uint8_t* hpptr = bam_aux_get(rec, "HP");
-#pragma omp critical
-			  {
-			    countMap[file_c][itBp->id].ref.push_back((uint8_t) std::min(rq, (uint32_t) rec->core.qual));
-			    if (hpptr) {
-			      c.isHaplotagged = true;
-			      int hap = bam_aux2i(hpptr);
-			      if (hap == 1) ++countMap[file_c][itBp->id].refh1;
-			      else ++countMap[file_c][itBp->id].refh2;
-			    }
+			  DeferredEvidence de(0, 0, itBp->svt, (uint8_t) std::min(rq, (uint32_t) rec->core.qual), ct.dump.size());
+			  de.pass = (rq >= c.minGenoQual);
+			  de.ids.push_back(itBp->id);
+			  if (hpptr) {
+			    de.haplotagged = true;
+			    de.hap = bam_aux2i(hpptr);
+			  }
+			  ct.deferred.push_back(de);
+			} else if (rq >= c.minGenoQual) {
+			  uint8_t* hpptr = bam_aux_get(rec, "HP");
+			  jc.ref.push_back((uint8_t) std::min(rq, (uint32_t) rec->core.qual));
+			  if (hpptr) {
+			    ct.haplotagged = true;
+			    _addHaplotype(jc.refh1, jc.refh2, bam_aux2i(hpptr));
 			  }
 			}
 		      }
 		    } else {
+		      needle(consProbe, sequence, alignAlt, semiglobal, simple);
+		      ++nalign;
 		      TQuality quality;
 		      quality.resize(rec->core.l_qseq);
 		      uint8_t* qualptr = bam_get_qual(rec);
@@ -514,21 +830,23 @@ namespace torali {
 		      uint32_t aq = _getAlignmentQual(alignAlt, quality);
 		      if (aq >= c.minGenoQual) {
 			uint8_t* hpptr = bam_aux_get(rec, "HP");
-#pragma omp critical
-			{
-			  if (c.hasDumpFile) {
-			    std::string svid(_addID(itBp->svt));
-			    std::string padNumber = boost::lexical_cast<std::string>(itBp->id);
-			    padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
-			    svid += padNumber;
-			    dumpOut << svid << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tSR" << std::endl;
+			std::ostringstream line;
+			if (c.hasDumpFile) line << _dumpSVID(itBp->svt, itBp->id) << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tSR" << std::endl;
+			if (defer) {
+			  DeferredEvidence de(1, 0, itBp->svt, (uint8_t) std::min(aq, (uint32_t) rec->core.qual), ct.dump.size());
+			  de.ids.push_back(itBp->id);
+			  de.dump = line.str();
+			  if (hpptr) {
+			    de.haplotagged = true;
+			    de.hap = bam_aux2i(hpptr);
 			  }
-			  countMap[file_c][itBp->id].alt.push_back((uint8_t) std::min(aq, (uint32_t) rec->core.qual));
+			  ct.deferred.push_back(de);
+			} else {
+			  ct.dump += line.str();
+			  jc.alt.push_back((uint8_t) std::min(aq, (uint32_t) rec->core.qual));
 			  if (hpptr) {
-			    c.isHaplotagged = true;
-			    int hap = bam_aux2i(hpptr);
-			    if (hap == 1) ++countMap[file_c][itBp->id].alth1;
-			    else ++countMap[file_c][itBp->id].alth2;
+			    ct.haplotagged = true;
+			    _addHaplotype(jc.alth1, jc.alth2, bam_aux2i(hpptr));
 			  }
 			}
 		      }
@@ -555,124 +873,138 @@ namespace torali {
 	    if (rec->core.tid == rec->core.mtid) {
 	      qualities[hv] = rec->core.qual;
 	      clip[hv] = hasSoftClip;
-	    } else {
-	      qualitiestra[hv] = rec->core.qual;
-	      cliptra[hv] = hasSoftClip;
-	    }
+	    } else ct.qualitiestra[hv] = rec->core.qual;
 	  } else {
 	    // Second read
 	    std::size_t hv = hash_pair_mate(rec);
-	    uint8_t pairQuality = 0;
-	    bool pairClip = false;
-	    if (rec->core.tid == rec->core.mtid) {
-	      if (qualities.find(hv) == qualities.end()) continue; // Mate discarded
-	      pairQuality = std::min((uint8_t) qualities[hv], (uint8_t) rec->core.qual);
-	      if ((clip[hv]) || (hasSoftClip)) pairClip = true;
-	      qualities[hv] = 0;
-	      clip[hv] = false;
-	    } else {
-	      if (qualitiestra.find(hv) == qualitiestra.end()) continue; // Mate discarded
-	      pairQuality = std::min((uint8_t) qualitiestra[hv], (uint8_t) rec->core.qual);
-	      if ((cliptra[hv]) || (hasSoftClip)) pairClip = true;
-	      qualitiestra[hv] = 0;
-	      cliptra[hv] = false;
+	    if (rec->core.tid != rec->core.mtid) {
+	      // The mate is on another chromosome, pair quality is known after all tasks
+	      if (sampleLib[file_c].median == 0) continue; // Single-end library or non-valid library
+	      int32_t svt = _isizeMappingPos(rec, sampleLib[file_c].maxISizeCutoff);
+	      if (svt == -1) continue;
+
+	      // Spanning a breakpoint?
+	      int32_t pbegin = rec->core.pos;
+	      int32_t pend = std::min((int32_t) rec->core.pos + sampleLib[file_c].maxNormalISize, (int32_t) hdr[file_c]->target_len[refIndex]);
+	      if (rec->core.flag & BAM_FREVERSE) {
+		pbegin = std::max(0, (int32_t) rec->core.pos + rec->core.l_qseq - sampleLib[file_c].maxNormalISize);
+		pend = std::min((int32_t) rec->core.pos + rec->core.l_qseq, (int32_t) hdr[file_c]->target_len[refIndex]);
+	      }
+	      if (_anyFlagged(spanBp, pbegin, pend)) {
+		uint8_t* hpptr = bam_aux_get(rec, "HP");
+		DeferredEvidence ps(4, hv, svt, rec->core.qual, ct.dump.size());
+		if (hpptr) {
+		  ps.haplotagged = true;
+		  ps.hap = bam_aux2i(hpptr);
+		}
+		typename TSpanPoint::iterator itSpan = std::lower_bound(spanPoint.begin(), spanPoint.end(), SpanPoint(pbegin), SortBp<SpanPoint>());
+		for(; ((itSpan != spanPoint.end()) && (pend >= itSpan->bppos)); ++itSpan) {
+		  if (svt == itSpan->svt) ps.ids.push_back(itSpan->id);
+		}
+		if (!ps.ids.empty()) {
+		  if (c.hasDumpFile) {
+		    std::ostringstream line;
+		    line << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tPE" << std::endl;
+		    ps.dump = line.str();
+		  }
+		  ct.deferred.push_back(ps);
+		}
+	      }
+	      continue;
 	    }
+	    if (qualities.find(hv) == qualities.end()) continue; // Mate discarded
+	    uint8_t pairQuality = std::min((uint8_t) qualities[hv], (uint8_t) rec->core.qual);
+	    bool pairClip = false;
+	    if ((clip[hv]) || (hasSoftClip)) pairClip = true;
+	    qualities[hv] = 0;
+	    clip[hv] = false;
 
 	    // Pair quality
 	    if (pairQuality < c.minGenoQual) continue; // Low quality pair
-	    
-	    // Read-depth fragment counting
-	    if (rec->core.tid == rec->core.mtid) {
-	      // Count mid point (fragment counting)
-	      int32_t midPoint = rec->core.pos + halfAlignmentLength(rec);
-	      if ((midPoint < (int32_t) hdr[file_c]->target_len[refIndex]) && (covFragment[midPoint] < maxCoverage - 1)) ++covFragment[midPoint];
-	    }
+
+	    // Read-depth fragment counting, count mid point
+	    int32_t midPoint = rec->core.pos + halfAlignmentLength(rec);
+	    if (midPoint >= 0) _incCoverage(covFragment, midPoint);
 
 	    // Spanning counting
 	    int32_t outerISize = 0;
 	    if (rec->core.pos < rec->core.mpos) outerISize = rec->core.mpos + rec->core.l_qseq - rec->core.pos;
 	    else outerISize = rec->core.pos + rec->core.l_qseq - rec->core.mpos;
-	    
+
 	    // Get the library information
 	    if (sampleLib[file_c].median == 0) continue; // Single-end library or non-valid library
 
 	    // Normal spanning pair
-	    if ((!pairClip) && (getSVType(rec->core) == 2) && (outerISize >= sampleLib[file_c].minNormalISize) && (outerISize <= sampleLib[file_c].maxNormalISize) && (rec->core.tid==rec->core.mtid)) {
+	    if ((!pairClip) && (getSVType(rec->core) == 2) && (outerISize >= sampleLib[file_c].minNormalISize) && (outerISize <= sampleLib[file_c].maxNormalISize)) {
 	      // Take X% of the outerisize as the spanned interval
 	      int32_t spanlen = 0.8 * outerISize;
 	      int32_t pbegin = std::min((int32_t) rec->core.pos, (int32_t) rec->core.mpos);
 	      int32_t st = pbegin + (outerISize - spanlen) / 2;
-	      bool spanvalid = false;
-	      for(int32_t i = st; ((i < (st + spanlen)) &&  (i < (int32_t) hdr[file_c]->target_len[refIndex])); ++i) {
-		if (spanBp[i]) {
-		  spanvalid = true;
-		  break;
-		}
-	      }
-	      if (spanvalid) {
+	      if (_anyFlagged(spanBp, st, std::min(st + spanlen, (int32_t) hdr[file_c]->target_len[refIndex]))) {
 		// Fetch all relevant SVs
 		typename TSpanPoint::iterator itSpan = std::lower_bound(spanPoint.begin(), spanPoint.end(), SpanPoint(st), SortBp<SpanPoint>());
 		for(; ((itSpan != spanPoint.end()) && (st + spanlen >= itSpan->bppos)); ++itSpan) {
 		  // Account for reference bias
-		  if (++refAlignedSpanCount[file_c][itSpan->id] % 2) {
+		  if (interChr[itSpan->id]) {
 		    uint8_t* hpptr = bam_aux_get(rec, "HP");
-#pragma omp critical
-		    {
-		      spanMap[file_c][itSpan->id].ref.push_back(pairQuality);
-		      if (hpptr) {
-			c.isHaplotagged = true;
-			int hap = bam_aux2i(hpptr);
-			if (hap == 1) ++spanMap[file_c][itSpan->id].refh1;
-			else ++spanMap[file_c][itSpan->id].refh2;
-		      }
+		    DeferredEvidence de(2, 0, itSpan->svt, pairQuality, ct.dump.size());
+		    de.ids.push_back(itSpan->id);
+		    if (hpptr) {
+		      de.haplotagged = true;
+		      de.hap = bam_aux2i(hpptr);
+		    }
+		    ct.deferred.push_back(de);
+		  } else if (++refAlignedSpanCount[itSpan->id] % 2) {
+		    uint8_t* hpptr = bam_aux_get(rec, "HP");
+		    TSpanPair& sc = ct.spanMap[itSpan->id];
+		    sc.ref.push_back(pairQuality);
+		    if (hpptr) {
+		      ct.haplotagged = true;
+		      _addHaplotype(sc.refh1, sc.refh2, bam_aux2i(hpptr));
 		    }
 		  }
 		}
 	      }
 	    }
-	    
+
 	    // Abnormal spanning coverage
-	    if ((getSVType(rec->core) != 2) || (outerISize < sampleLib[file_c].minNormalISize) || (outerISize > sampleLib[file_c].maxNormalISize) || (rec->core.tid!=rec->core.mtid)) {
+	    if ((getSVType(rec->core) != 2) || (outerISize < sampleLib[file_c].minNormalISize) || (outerISize > sampleLib[file_c].maxNormalISize)) {
 	      // SV type
 	      int32_t svt = _isizeMappingPos(rec, sampleLib[file_c].maxISizeCutoff);
 	      if (svt == -1) continue;
-	      
+
 	      // Spanning a breakpoint?
-	      bool spanvalid = false;
 	      int32_t pbegin = rec->core.pos;
 	      int32_t pend = std::min((int32_t) rec->core.pos + sampleLib[file_c].maxNormalISize, (int32_t) hdr[file_c]->target_len[refIndex]);
 	      if (rec->core.flag & BAM_FREVERSE) {
 		pbegin = std::max(0, (int32_t) rec->core.pos + rec->core.l_qseq - sampleLib[file_c].maxNormalISize);
 		pend = std::min((int32_t) rec->core.pos + rec->core.l_qseq, (int32_t) hdr[file_c]->target_len[refIndex]);
 	      }
-	      for(int32_t i = pbegin; i < pend; ++i) {
-		if (spanBp[i]) {
-		  spanvalid = true;
-		  break;
-		}
-	      }
-	      if (spanvalid) {
+	      if (_anyFlagged(spanBp, pbegin, pend)) {
 		// Fetch all relevant SVs
 		typename TSpanPoint::iterator itSpan = std::lower_bound(spanPoint.begin(), spanPoint.end(), SpanPoint(pbegin), SortBp<SpanPoint>());
 		for(; ((itSpan != spanPoint.end()) && (pend >= itSpan->bppos)); ++itSpan) {
 		  if (svt == itSpan->svt) {
 		    uint8_t* hpptr = bam_aux_get(rec, "HP");
-#pragma omp critical
-		    {
-		      if (c.hasDumpFile) {
-			std::string svid(_addID(itSpan->svt));
-			std::string padNumber = boost::lexical_cast<std::string>(itSpan->id);
-			padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
-			svid += padNumber;
-			dumpOut << svid << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tPE" << std::endl;
-		      }
-		      spanMap[file_c][itSpan->id].alt.push_back(pairQuality);
+		    std::ostringstream line;
+		    if (c.hasDumpFile) line << _dumpSVID(itSpan->svt, itSpan->id) << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tPE" << std::endl;
+		    if (interChr[itSpan->id]) {
+		      DeferredEvidence de(3, 0, itSpan->svt, pairQuality, ct.dump.size());
+		      de.ids.push_back(itSpan->id);
+		      de.dump = line.str();
 		      if (hpptr) {
-			c.isHaplotagged = true;
-			int hap = bam_aux2i(hpptr);
-			if (hap == 1) ++spanMap[file_c][itSpan->id].alth1;
-			else ++spanMap[file_c][itSpan->id].alth2;
+			de.haplotagged = true;
+			de.hap = bam_aux2i(hpptr);
 		      }
+		      ct.deferred.push_back(de);
+		      continue;
+		    }
+		    ct.dump += line.str();
+		    TSpanPair& sc = ct.spanMap[itSpan->id];
+		    sc.alt.push_back(pairQuality);
+		    if (hpptr) {
+		      ct.haplotagged = true;
+		      _addHaplotype(sc.alth1, sc.alth2, bam_aux2i(hpptr));
 		    }
 		  }
 		}
@@ -682,70 +1014,49 @@ namespace torali {
 	}
 	// Clean-up
 	bam_destroy1(rec);
+	metricsReads(nread);
+	metricsAlignments(nalign);
 	hts_itr_destroy(iter);
-	qualities.clear();
-	clip.clear();
-	
-	// Assign fragment and base counts to SVs
+
+	// Assign fragment and base counts to SVs, each SV is owned by the task of its first chromosome
+	_indexCoverage(covBases);
+	_indexCoverage(covFragment);
 	for(uint32_t i = 0; i < svs.size(); ++i) {
 	  if (svs[i].chr == refIndex) {
-	    // Small or large SV
-	    bool smallSV = false;
-	    int32_t halfSize = (svs[i].svEnd - svs[i].svStart)/2;
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      halfSize = 500;
-	      smallSV = true;
-	    } else {
-	      if ((svs[i].svEnd - svs[i].svStart) <= c.indelsize) smallSV = true;
-	    }
-
-	    // Left region
-	    int32_t lstart = std::max(svs[i].svStart - halfSize, 0);
-	    int32_t lend = svs[i].svStart;
-	    int32_t covbase = 0;
-	    for(uint32_t k = lstart; ((k < (uint32_t) lend) && (k < hdr[0]->target_len[refIndex])); ++k) {
-	      if (smallSV) covbase += covBases[k];
-	      else covbase += covFragment[k];
-	    }
-	    covCount[file_c][svs[i].id].leftRC = covbase;
-
-	    // Actual SV
-	    covbase = 0;
-	    int32_t mstart = svs[i].svStart;
-	    int32_t mend = svs[i].svEnd;
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      mstart = std::max(svs[i].svStart - halfSize, 0);
-	      mend = std::min(svs[i].svStart + halfSize, (int32_t) hdr[0]->target_len[refIndex]);
-	    }
-	    for(uint32_t k = mstart; ((k < (uint32_t) mend) && (k < hdr[0]->target_len[refIndex])); ++k) {
-	      if (smallSV) covbase += covBases[k];
-	      else covbase += covFragment[k];
-	    }
-	    covCount[file_c][svs[i].id].rc = covbase;
-
-	    // Right region
-	    covbase = 0;
-	    int32_t rstart = svs[i].svEnd;
-	    int32_t rend = std::min(svs[i].svEnd + halfSize, (int32_t) hdr[0]->target_len[refIndex]);
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      rstart = svs[i].svStart;
-	      rend = std::min(svs[i].svStart + halfSize, (int32_t) hdr[0]->target_len[refIndex]);
-	    }
-	    for(uint32_t k = rstart; ((k < (uint32_t) rend) && (k < hdr[0]->target_len[refIndex])); ++k) {
-	      if (smallSV) covbase += covBases[k];
-	      else covbase += covFragment[k];
-	    }
-	    covCount[file_c][svs[i].id].rightRC = covbase;
+	    CoverageWindows const& cw = covWindows[i];
+	    TCoverage const& cov = (cw.smallSV) ? covBases : covFragment;
+	    covCount[file_c][svs[i].id].leftRC = _sumCoverage(cov, cw.lstart, std::min(cw.lend, (int32_t) hdr[0]->target_len[refIndex]));
+	    covCount[file_c][svs[i].id].rc = _sumCoverage(cov, cw.mstart, std::min(cw.mend, (int32_t) hdr[0]->target_len[refIndex]));
+	    covCount[file_c][svs[i].id].rightRC = _sumCoverage(cov, cw.rstart, std::min(cw.rend, (int32_t) hdr[0]->target_len[refIndex]));
 	  }
 	}
+
+	// Merge completed samples in sample order, the dump file keeps the serial order
+#pragma omp critical (covmerge)
+	{
+	  --pendingTasks[file_c];
+	  for(; ((mergedSamples < c.files.size()) && (!pendingTasks[mergedSamples])); ++mergedSamples) _mergeCoverageTasks(c, tasks, mergedSamples, countMap[mergedSamples], spanMap[mergedSamples], dumpOut);
+	}
       }
+
+      _sampleHandleClose(sh);
     }
+    if (failed) {
+      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+	bam_hdr_destroy(hdr[file_c]);
+	hts_idx_destroy(idx[file_c]);
+	sam_close(samfile[file_c]);
+      }
+      return false;
+    }
+
     // Clean-up
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       bam_hdr_destroy(hdr[file_c]);
       hts_idx_destroy(idx[file_c]);
       sam_close(samfile[file_c]);    
     }
+    return true;
   }
 
 }
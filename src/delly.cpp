@@ -37,6 +37,7 @@ displayUsage() {
   std::cout << std::endl;
   std::cout << "Read-depth commands:" << std::endl;
   std::cout << "    rd           read-depth normalization" << std::endl;
+  std::cout << "    gctrack      precompute GC and mappability track for read-depth normalization" << std::endl;
   std::cout << std::endl;
   std::cout << std::endl;
 }
@@ -76,6 +77,9 @@ int main(int argc, char **argv) {
     else if ((std::string(argv[1]) == "rd")) {
       return coral(argc-1,argv+1);
     }
+    else if ((std::string(argv[1]) == "gctrack")) {
+      return gcTrack(argc-1,argv+1);
+    }
     else if ((std::string(argv[1]) == "filter")) {
       return filter(argc-1,argv+1);
     }
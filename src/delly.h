@@ -38,6 +38,9 @@
 #include "split.h"
 #include "shortpe.h"
 #include "modvcf.h"
+#include "metrics.h"
+#include "refcache.h"
+#include "iothreads.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -69,6 +72,7 @@ namespace torali
     bool hasVcfFile;
     bool isHaplotagged;
     bool hasDumpFile;
+    bool hasEvidenceFile;
     bool svtcmd;
     std::set<int32_t> svtset;
     DnaScore<int> aliscore;
@@ -77,6 +81,10 @@ namespace torali
     boost::filesystem::path genome;
     boost::filesystem::path exclude;
     boost::filesystem::path dumpfile;
+    boost::filesystem::path evidencefile;
+    boost::filesystem::path metricsfile;
+    boost::filesystem::path refcache;
+    int32_t iothreads;
     std::vector<boost::filesystem::path> files;
     std::vector<std::string> sampleName;
   };
@@ -117,7 +125,13 @@ namespace torali
     // Create library objects
     typedef std::vector<LibraryInfo> TSampleLibrary;
     TSampleLibrary sampleLib(c.files.size(), LibraryInfo());
-    getLibraryParams(c, validRegions, sampleLib);
+    int32_t stage = metricsStart("library");
+    if (!getLibraryParams(c, validRegions, sampleLib)) {
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+      return 1;
+    }
+    metricsStop(stage);
     for(uint32_t i = 0; i<sampleLib.size(); ++i) {
       if (sampleLib[i].rs == 0) {
 	std::cerr << "Sample has not enough data to estimate library parameters! File: " << c.files[i].string() << std::endl;
@@ -139,15 +153,29 @@ namespace torali
 	typedef boost::unordered_map<TPosRead, int32_t> TPosReadSV;
 	typedef std::vector<TPosReadSV> TGenomicPosReadSV;
 	TGenomicPosReadSV srStore(c.nchr, TPosReadSV());
-	scanPEandSR(c, validRegions, svs, srSVs, srStore, sampleLib);
+	stage = metricsStart("discovery");
+	if (!scanPEandSR(c, validRegions, svs, srSVs, srStore, sampleLib)) {
+	  bam_hdr_destroy(hdr);
+	  sam_close(samfile);
+	  return 1;
+	}
+	metricsStop(stage);
 	
 	// Assemble split-read calls
+	stage = metricsStart("assembly");
 	assembleSplitReads(c, validRegions, srStore, srSVs);
+	metricsStop(stage);
       }
 
       // Sort and merge PE and SR calls
+      stage = metricsStart("merge");
       mergeSort(svs, srSVs);
-    } else vcfParse(c, hdr, svs);
+      metricsStop(stage);
+    } else {
+      stage = metricsStart("vcfparse");
+      vcfParse(c, hdr, svs);
+      metricsStop(stage);
+    }
     // Clean-up
     bam_hdr_destroy(hdr);
     sam_close(samfile);
@@ -173,10 +201,14 @@ namespace torali
     TSampleSVReadCount rcMap;
     
     // SV Genotyping
-    if (!svs.empty()) annotateCoverage(c, sampleLib, svs, rcMap, jctMap, spanMap);
+    stage = metricsStart("genotyping");
+    if ((!svs.empty()) && (!annotateCoverage(c, sampleLib, svs, rcMap, jctMap, spanMap))) return 1;
+    metricsStop(stage);
     
     // VCF output
+    stage = metricsStart("output");
     vcfOutput(c, svs, jctMap, rcMap, spanMap);
+    metricsStop(stage);
     
     // Output library statistics
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
@@ -188,6 +220,12 @@ namespace torali
 #ifdef PROFILE
     ProfilerStop();
 #endif
+
+    // All files are closed
+    ioThreadsDestroy();
+
+    // Metrics report
+    if (!metricsWrite()) return 1;
   
     // End
     now = boost::posix_time::second_clock::local_time();
@@ -208,8 +246,11 @@ namespace torali
       ("help,?", "show help message")
       ("svtype,t", boost::program_options::value<std::string>(&svtype)->default_value("ALL"), "SV type to compute [DEL, INS, DUP, INV, BND, ALL]")
       ("genome,g", boost::program_options::value<boost::filesystem::path>(&c.genome), "genome fasta file")
+      ("ref-cache", boost::program_options::value<boost::filesystem::path>(&c.refcache), "memory-mapped genome cache file, built on first use (optional)")
       ("exclude,x", boost::program_options::value<boost::filesystem::path>(&c.exclude), "file with regions to exclude")
       ("outfile,o", boost::program_options::value<boost::filesystem::path>(&c.outfile)->default_value("sv.bcf"), "SV BCF output file")
+      ("metrics", boost::program_options::value<boost::filesystem::path>(&c.metricsfile), "per-stage JSON metrics report (optional)")
+      ("io-threads", boost::program_options::value<int32_t>(&c.iothreads)->default_value(0), "additional threads for BAM/CRAM/BCF (de)compression")
       ;
     
     boost::program_options::options_description disc("Discovery options");
@@ -221,6 +262,7 @@ namespace torali
       ("min-clique-size,z", boost::program_options::value<uint32_t>(&c.minCliqueSize)->default_value(2), "min. PE/SR clique size")
       ("minrefsep,m", boost::program_options::value<uint32_t>(&c.minRefSep)->default_value(25), "min. reference separation")
       ("maxreadsep,n", boost::program_options::value<uint32_t>(&c.maxReadSep)->default_value(40), "max. read separation")
+      ("evidence,e", boost::program_options::value<boost::filesystem::path>(&c.evidencefile), "split-read sidecar file, assembly reads it instead of the BAMs (optional)")
       ;
     
     boost::program_options::options_description geno("Genotyping options");
@@ -266,6 +308,10 @@ namespace torali
     if (vm.count("dump")) c.hasDumpFile = true;
     else c.hasDumpFile = false;
 
+    // Split-read evidence sidecar?
+    if (vm.count("evidence")) c.hasEvidenceFile = true;
+    else c.hasEvidenceFile = false;
+
     // Clique size
     if (c.minCliqueSize < 2) c.minCliqueSize = 2;
     
@@ -366,6 +412,21 @@ namespace torali
     
     // Check output directory
     if (!_outfileValid(c.outfile)) return 1;
+
+    // Reference cache?
+    if (vm.count("ref-cache")) {
+      if (!_outfileValid(c.refcache)) return 1;
+      referenceCacheEnable(c.genome, c.refcache);
+    }
+
+    // Per-stage metrics?
+    if (vm.count("metrics")) {
+      if (!_outfileValid(c.metricsfile)) return 1;
+      metricsEnable("call", c.metricsfile);
+    }
+    
+    // Shared I/O thread pool
+    if (!ioThreadsEnable(c.iothreads)) return 1;
     
     // Show cmd
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
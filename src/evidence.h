@@ -0,0 +1,198 @@
+#ifndef EVIDENCE_H
+#define EVIDENCE_H
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#include <htslib/sam.h>
+
+namespace torali
+{
+
+  #ifndef DELLY_EVIDENCE_CHUNK
+  #define DELLY_EVIDENCE_CHUNK 4194304
+  #endif
+
+  static char const DELLY_EVIDENCE_MAGIC[8] = {'D', 'L', 'Y', 'E', 'V', 'I', '1', '\0'};
+
+  // Contiguous block of split-read candidates of one scan region
+  struct EvidenceChunk {
+    uint32_t file_c;
+    int32_t refIndex;
+    uint32_t task;
+    uint32_t part;
+    uint64_t offset;
+    uint64_t size;
+
+    EvidenceChunk() : file_c(0), refIndex(0), task(0), part(0), offset(0), size(0) {}
+    EvidenceChunk(uint32_t const f, int32_t const r, uint32_t const t, uint32_t const p, uint64_t const o, uint64_t const s) : file_c(f), refIndex(r), task(t), part(p), offset(o), size(s) {}
+  };
+
+  template<typename TEvidenceChunk>
+  struct SortEvidenceChunk : public std::binary_function<TEvidenceChunk, TEvidenceChunk, bool>
+  {
+    inline bool operator()(TEvidenceChunk const& c1, TEvidenceChunk const& c2) {
+      return ((c1.refIndex < c2.refIndex) || ((c1.refIndex == c2.refIndex) && (c1.file_c < c2.file_c)) || ((c1.refIndex == c2.refIndex) && (c1.file_c == c2.file_c) && (c1.task < c2.task)) || ((c1.refIndex == c2.refIndex) && (c1.file_c == c2.file_c) && (c1.task == c2.task) && (c1.part < c2.part)));
+    }
+  };
+
+  // Split-read candidate as stored in the sidecar
+  struct EvidenceRead {
+    int32_t pos;
+    uint32_t seed;
+    uint8_t qual;
+    std::string sequence;
+  };
+
+  struct EvidenceWriter {
+    FILE* fp;
+    uint64_t offset;
+    std::vector<EvidenceChunk> chunks;
+
+    EvidenceWriter() : fp(NULL), offset(0) {}
+  };
+
+
+  template<typename TValue>
+  inline void
+  _evidencePut(std::string& buf, TValue const val) {
+    buf.append((char const*) &val, sizeof(TValue));
+  }
+
+  template<typename TValue>
+  inline bool
+  _evidenceGet(std::string const& buf, std::size_t& k, TValue& val) {
+    if (k + sizeof(TValue) > buf.size()) return false;
+    std::memcpy(&val, &buf[k], sizeof(TValue));
+    k += sizeof(TValue);
+    return true;
+  }
+
+  // Append a read, the sequence is kept 4-bit packed as in BAM
+  inline void
+  _evidenceAppend(std::string& buf, bam1_t* rec, uint32_t const seed) {
+    _evidencePut(buf, (int32_t) rec->core.pos);
+    _evidencePut(buf, seed);
+    _evidencePut(buf, (uint8_t) rec->core.qual);
+    _evidencePut(buf, (int32_t) rec->core.l_qseq);
+    buf.append((char const*) bam_get_seq(rec), (rec->core.l_qseq + 1) / 2);
+  }
+
+  inline bool
+  _evidenceNext(std::string const& buf, std::size_t& k, EvidenceRead& er) {
+    int32_t lseq = 0;
+    if (!_evidenceGet(buf, k, er.pos)) return false;
+    if (!_evidenceGet(buf, k, er.seed)) return false;
+    if (!_evidenceGet(buf, k, er.qual)) return false;
+    if (!_evidenceGet(buf, k, lseq)) return false;
+    if ((lseq < 0) || (k + (lseq + 1) / 2 > buf.size())) return false;
+    uint8_t const* seqptr = (uint8_t const*) &buf[k];
+    er.sequence.resize(lseq);
+    for (int32_t i = 0; i < lseq; ++i) er.sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
+    k += (lseq + 1) / 2;
+    return true;
+  }
+
+  inline bool
+  evidenceOpen(boost::filesystem::path const& path, EvidenceWriter& ew) {
+    ew.fp = std::fopen(path.string().c_str(), "wb");
+    if (ew.fp == NULL) return false;
+    if (std::fwrite(DELLY_EVIDENCE_MAGIC, 1, sizeof(DELLY_EVIDENCE_MAGIC), ew.fp) != sizeof(DELLY_EVIDENCE_MAGIC)) {
+      std::fclose(ew.fp);
+      ew.fp = NULL;
+      return false;
+    }
+    ew.offset = sizeof(DELLY_EVIDENCE_MAGIC);
+    ew.chunks.clear();
+    return true;
+  }
+
+  // Not thread-safe, callers serialize chunk writes
+  inline void
+  evidenceWriteChunk(EvidenceWriter& ew, uint32_t const file_c, int32_t const refIndex, uint32_t const task, uint32_t const part, std::string const& buf) {
+    if ((ew.fp == NULL) || (buf.empty())) return;
+    if (std::fwrite(buf.data(), 1, buf.size(), ew.fp) != buf.size()) {
+      std::cerr << "Warning: Failed to write evidence sidecar!" << std::endl;
+      std::fclose(ew.fp);
+      ew.fp = NULL;
+      return;
+    }
+    ew.chunks.push_back(EvidenceChunk(file_c, refIndex, task, part, ew.offset, buf.size()));
+    ew.offset += buf.size();
+  }
+
+  // Chunk index and footer
+  inline bool
+  evidenceClose(EvidenceWriter& ew) {
+    if (ew.fp == NULL) return false;
+    std::string buf;
+    _evidencePut(buf, (uint64_t) ew.chunks.size());
+    for(uint32_t i = 0; i < ew.chunks.size(); ++i) {
+      _evidencePut(buf, ew.chunks[i].file_c);
+      _evidencePut(buf, ew.chunks[i].refIndex);
+      _evidencePut(buf, ew.chunks[i].task);
+      _evidencePut(buf, ew.chunks[i].part);
+      _evidencePut(buf, ew.chunks[i].offset);
+      _evidencePut(buf, ew.chunks[i].size);
+    }
+    _evidencePut(buf, ew.offset);
+    buf.append(DELLY_EVIDENCE_MAGIC, sizeof(DELLY_EVIDENCE_MAGIC));
+    bool success = (std::fwrite(buf.data(), 1, buf.size(), ew.fp) == buf.size());
+    if (std::fclose(ew.fp) != 0) success = false;
+    ew.fp = NULL;
+    return success;
+  }
+
+  // Load the chunk index, sorted by chromosome, sample and scan order
+  inline bool
+  evidenceLoadIndex(boost::filesystem::path const& path, std::vector<EvidenceChunk>& chunks) {
+    std::ifstream in(path.string().c_str(), std::ios::in | std::ios::binary);
+    if (!in.good()) return false;
+    std::size_t footerSize = sizeof(uint64_t) + sizeof(DELLY_EVIDENCE_MAGIC);
+    in.seekg(0, std::ios::end);
+    std::streamoff fsize = in.tellg();
+    if (fsize < (std::streamoff) (sizeof(DELLY_EVIDENCE_MAGIC) + footerSize)) return false;
+    std::string footer(footerSize, '\0');
+    in.seekg(fsize - footerSize);
+    if (!in.read(&footer[0], footerSize)) return false;
+    if (std::memcmp(&footer[sizeof(uint64_t)], DELLY_EVIDENCE_MAGIC, sizeof(DELLY_EVIDENCE_MAGIC)) != 0) return false;
+    std::size_t k = 0;
+    uint64_t idxOffset = 0;
+    _evidenceGet(footer, k, idxOffset);
+    if ((std::streamoff) idxOffset + (std::streamoff) footerSize > fsize) return false;
+    std::string buf(fsize - footerSize - idxOffset, '\0');
+    in.seekg(idxOffset);
+    if (!in.read(&buf[0], buf.size())) return false;
+    k = 0;
+    uint64_t nchunks = 0;
+    if (!_evidenceGet(buf, k, nchunks)) return false;
+    chunks.resize(nchunks);
+    for(uint64_t i = 0; i < nchunks; ++i) {
+      if (!_evidenceGet(buf, k, chunks[i].file_c)) return false;
+      if (!_evidenceGet(buf, k, chunks[i].refIndex)) return false;
+      if (!_evidenceGet(buf, k, chunks[i].task)) return false;
+      if (!_evidenceGet(buf, k, chunks[i].part)) return false;
+      if (!_evidenceGet(buf, k, chunks[i].offset)) return false;
+      if (!_evidenceGet(buf, k, chunks[i].size)) return false;
+    }
+    std::sort(chunks.begin(), chunks.end(), SortEvidenceChunk<EvidenceChunk>());
+    return true;
+  }
+
+  inline bool
+  evidenceReadChunk(std::ifstream& in, EvidenceChunk const& chunk, std::string& buf) {
+    buf.resize(chunk.size);
+    in.seekg(chunk.offset);
+    if (!in.read(&buf[0], chunk.size)) return false;
+    return true;
+  }
+
+}
+
+#endif
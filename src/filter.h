@@ -38,6 +38,8 @@
 #include "version.h"
 #include "util.h"
 #include "modvcf.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 namespace torali
 {
@@ -61,6 +63,8 @@ struct FilterConfig {
   boost::filesystem::path outfile;
   boost::filesystem::path samplefile;
   boost::filesystem::path vcffile;
+  boost::filesystem::path metricsfile;
+  int32_t iothreads;
 };
 
 
@@ -70,10 +74,12 @@ filterRun(TFilterConfig const& c) {
 
   // Load bcf file
   htsFile* ifile = hts_open(c.vcffile.string().c_str(), "r");
+  ioThreadsAttach(ifile);
   bcf_hdr_t* hdr = bcf_hdr_read(ifile);
 
   // Open output VCF file
   htsFile *ofile = hts_open(c.outfile.string().c_str(), "wb");
+  ioThreadsAttach(ofile);
   bcf_hdr_t *hdr_out = bcf_hdr_dup(hdr);
   if (c.filter == "somatic") {
     bcf_hdr_remove(hdr_out, BCF_HL_INFO, "RDRATIO");
@@ -118,8 +124,12 @@ filterRun(TFilterConfig const& c) {
   // Parse BCF
   boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
   std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Filtering VCF/BCF file" << std::endl;
+  int32_t stage = metricsStart("filter");
+  uint64_t nread = 0;
+  uint64_t nwritten = 0;
   bcf1_t* rec = bcf_init1();
   while (bcf_read(ifile, hdr, rec) == 0) {
+    ++nread;
     bcf_unpack(rec, BCF_UN_INFO);
 
     // Check SV type
@@ -219,6 +229,7 @@ filterRun(TFilterConfig const& c) {
 	  _remove_info_tag(hdr_out, rec, "SOMATIC");
 	  bcf_update_info_flag(hdr_out, rec, "SOMATIC", NULL, 1);
 	  bcf_write1(ofile, hdr_out, rec);
+	  ++nwritten;
 	}
       } else if (c.filter == "germline") {
 	float genotypeRatio = (float) (nCount + tCount) / (float) (bcf_hdr_nsamples(hdr));
@@ -247,6 +258,7 @@ filterRun(TFilterConfig const& c) {
 	  _remove_info_tag(hdr_out, rec, "RDRATIO");
 	  bcf_update_info_float(hdr_out, rec, "RDRATIO", &rdRatio, 1);
 	  bcf_write1(ofile, hdr_out, rec);
+	  ++nwritten;
 	  
 	  
 	}
@@ -254,6 +266,8 @@ filterRun(TFilterConfig const& c) {
     }
   }
   bcf_destroy(rec);
+  metricsReads(nread);
+  metricsRecords(nwritten);
 
   // Clean-up
   if (svend != NULL) free(svend);
@@ -274,13 +288,23 @@ filterRun(TFilterConfig const& c) {
   bcf_hdr_destroy(hdr_out);
   hts_close(ofile);
 
+  metricsStop(stage);
+
   // Build index
+  stage = metricsStart("index");
   bcf_index_build(c.outfile.string().c_str(), 14);
+  metricsStop(stage);
 
   // Close VCF
   bcf_hdr_destroy(hdr);
   bcf_close(ifile);
 
+  // All files are closed
+  ioThreadsDestroy();
+
+  // Metrics report
+  if (!metricsWrite()) return 1;
+
   // End
   now = boost::posix_time::second_clock::local_time();
   std::cout << '[' << boost::posix_time::to_simple_string(now) << "] Done." << std::endl;
@@ -303,6 +327,8 @@ int filter(int argc, char **argv) {
     ("maxsize,n", boost::program_options::value<int32_t>(&c.maxsize)->default_value(500000000), "max. SV size")
     ("ratiogeno,r", boost::program_options::value<float>(&c.ratiogeno)->default_value(0.75), "min. fraction of genotyped samples")
     ("pass,p", "Filter sites for PASS")
+    ("metrics", boost::program_options::value<boost::filesystem::path>(&c.metricsfile), "per-stage JSON metrics report (optional)")
+    ("io-threads", boost::program_options::value<int32_t>(&c.iothreads)->default_value(0), "additional threads for BAM/CRAM/BCF (de)compression")
     ;
 
   // Define somatic options
@@ -455,6 +481,15 @@ int filter(int argc, char **argv) {
     bcf_close(ifile);
   }
 
+  // Per-stage metrics?
+  if (vm.count("metrics")) {
+    if (!_outfileValid(c.metricsfile)) return 1;
+    metricsEnable("filter", c.metricsfile);
+  }
+  
+  // Shared I/O thread pool
+  if (!ioThreadsEnable(c.iothreads)) return 1;
+
   // Show cmd
   boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
   std::cout << '[' << boost::posix_time::to_simple_string(now) << "] ";
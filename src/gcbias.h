@@ -19,6 +19,9 @@
 
 #include "scan.h"
 #include "util.h"
+#include "refcache.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 namespace torali
 {
@@ -123,6 +126,7 @@ namespace torali
   gcBias(TConfig const& c, std::vector< std::vector<ScanWindow> > const& scanCounts, LibraryInfo const& li, std::vector<GcBias>& gcbias, TGCBound& gcbound) {
     // Load bam file
     samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
+    ioThreadsAttach(samfile);
     hts_set_fai_filename(samfile, c.genome.string().c_str());
     hts_idx_t* idx = sam_index_load(samfile, c.bamFile.string().c_str());
     bam_hdr_t* hdr = sam_hdr_read(samfile);
@@ -132,8 +136,12 @@ namespace torali
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Estimate GC bias" << std::endl;
     boost::progress_display show_progress( hdr->n_targets );
 
-    faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
-    faidx_t* faiRef = fai_load(c.genome.string().c_str());
+    faidx_t* faiMap = NULL;
+    faidx_t* faiRef = NULL;
+    if (!c.hasTrackFile) {
+      faiMap = fai_load(c.mapFile.string().c_str());
+      faiRef = fai_load(c.genome.string().c_str());
+    }
     for (int refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
       ++show_progress;
       if (scanCounts[refIndex].empty()) continue;
@@ -148,23 +156,28 @@ namespace torali
 	}
       }
       
-      // Check presence in mappability map
-      std::string tname(hdr->target_name[refIndex]);
-      int32_t seqlen = faidx_seq_len(faiMap, tname.c_str());
-      if (seqlen == - 1) continue;
-      else seqlen = -1;
-      char* seq = faidx_fetch_seq(faiMap, tname.c_str(), 0, faidx_seq_len(faiMap, tname.c_str()), &seqlen);
-
-      // Check presence in reference
-      seqlen = faidx_seq_len(faiRef, tname.c_str());
-      if (seqlen == - 1) continue;
-      else seqlen = -1;
-      char* ref = faidx_fetch_seq(faiRef, tname.c_str(), 0, faidx_seq_len(faiRef, tname.c_str()), &seqlen);
-
       // Get GC and Mappability
+      std::string tname(hdr->target_name[refIndex]);
       std::vector<uint16_t> uniqContent(hdr->target_len[refIndex], 0);
       std::vector<uint16_t> gcContent(hdr->target_len[refIndex], 0);
-      {
+      if (c.hasTrackFile) {
+	if (!gcTrackContent(c.trackFile, tname, hdr->target_len[refIndex], c.meanisize, uniqContent, &gcContent)) continue;
+      } else {
+	// Check presence in mappability map
+	int32_t seqlen = faidx_seq_len(faiMap, tname.c_str());
+	if (seqlen == - 1) continue;
+	else seqlen = -1;
+	char* seq = fetchReference(c.mapFile, tname, seqlen);
+
+	// Check presence in reference
+	seqlen = faidx_seq_len(faiRef, tname.c_str());
+	if (seqlen == - 1) {
+	  releaseReference(seq);
+	  continue;
+	}
+	else seqlen = -1;
+	char* ref = fetchReference(c.genome, tname, seqlen);
+
 	// Mappability map
 	typedef boost::dynamic_bitset<> TBitSet;
 	TBitSet uniq(hdr->target_len[refIndex], false);
@@ -178,6 +191,8 @@ namespace torali
 	for(uint32_t i = 0; i < hdr->target_len[refIndex]; ++i) {
 	  if ((ref[i] == 'c') || (ref[i] == 'C') || (ref[i] == 'g') || (ref[i] == 'G')) gcref[i] = 1;
 	}
+	releaseReference(seq);
+	releaseReference(ref);
 
 	// Sum across fragments
 	int32_t halfwin = (int32_t) (c.meanisize / 2);
@@ -215,7 +230,9 @@ namespace torali
       bam1_t* rec = bam_init1();
       int32_t lastAlignedPos = 0;
       std::set<std::size_t> lastAlignedPosReads;
+      uint64_t nread = 0;
       while (sam_itr_next(samfile, iter, rec) >= 0) {
+	++nread;
 	if (rec->core.flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP | BAM_FSUPPLEMENTARY | BAM_FUNMAP)) continue;
 	if ((rec->core.flag & BAM_FPAIRED) && ((rec->core.flag & BAM_FMUNMAP) || (rec->core.tid != rec->core.mtid))) continue;
 	if (rec->core.qual < c.minQual) continue;
@@ -257,8 +274,7 @@ namespace torali
       }
       bam_destroy1(rec);
       hts_itr_destroy(iter);
-      if (seq != NULL) free(seq);
-      if (ref != NULL) free(ref);
+      metricsReads(nread);
 
       // Summarize GC coverage for this chromosome
       for(uint32_t i = 0; i < hdr->target_len[refIndex]; ++i) {
@@ -331,8 +347,8 @@ namespace torali
       if (gcbias[i].fractionReference > 0) gcbias[i].obsexp = gcbias[i].fractionSample / gcbias[i].fractionReference;
     }
     
-    fai_destroy(faiRef);
-    fai_destroy(faiMap);
+    if (faiRef != NULL) fai_destroy(faiRef);
+    if (faiMap != NULL) fai_destroy(faiMap);
     hts_idx_destroy(idx);
     sam_close(samfile);
     bam_hdr_destroy(hdr);
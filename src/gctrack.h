@@ -0,0 +1,393 @@
+#ifndef GCTRACK_H
+#define GCTRACK_H
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/progress.hpp>
+
+#include <htslib/faidx.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "refcache.h"
+
+namespace torali
+{
+
+  static char const DELLY_GCTRACK_MAGIC[8] = {'D', 'L', 'Y', 'G', 'C', 'T', '1', '\0'};
+
+  #ifndef DELLY_GCTRACK_MAP
+  #define DELLY_GCTRACK_MAP 1
+  #endif
+
+  #ifndef DELLY_GCTRACK_REF
+  #define DELLY_GCTRACK_REF 2
+  #endif
+
+  struct GcTrackConfig {
+    boost::filesystem::path genome;
+    boost::filesystem::path mapFile;
+    boost::filesystem::path outfile;
+  };
+
+  // Bit track (unique or GC base) with a cumulative count per 64-bit word
+  struct GcTrackBits {
+    uint32_t len;
+    uint64_t const* bits;
+    uint32_t const* cum;
+
+    GcTrackBits() : len(0), bits(NULL), cum(NULL) {}
+  };
+
+  struct GcTrackContig {
+    uint32_t len;
+    uint8_t flags;
+    GcTrackBits uniq;
+    GcTrackBits gc;
+
+    GcTrackContig() : len(0), flags(0) {}
+  };
+
+  // Memory-mapped GC and mappability track, one entry per contig of the reference or mappability map
+  struct GcTrack {
+    bool mapped;
+    char* base;
+    uint64_t length;
+    std::map<std::string, GcTrackContig> contigs;
+
+    GcTrack() : mapped(false), base(NULL), length(0) {}
+  };
+
+  typedef std::map<std::string, GcTrack> TGcTrackMap;
+
+  inline TGcTrackMap&
+  _gcTracks() {
+    static TGcTrackMap tracks;
+    return tracks;
+  }
+
+  inline uint32_t
+  _gcTrackWords(uint32_t const len) {
+    return len / 64 + 1;
+  }
+
+  inline uint64_t
+  _gcTrackSize(uint32_t const len) {
+    return (uint64_t) _gcTrackWords(len) * (sizeof(uint64_t) + sizeof(uint32_t));
+  }
+
+  // Number of set bits in [0, pos)
+  inline uint32_t
+  _gcTrackRank(GcTrackBits const& tb, uint32_t pos) {
+    if (pos > tb.len) pos = tb.len;
+    uint32_t w = pos >> 6;
+    uint32_t r = pos & 63;
+    if (r == 0) return tb.cum[w];
+    return tb.cum[w] + __builtin_popcountll(tb.bits[w] & ((1ULL << r) - 1));
+  }
+
+  // Sum of set bits in [pos - halfwin, pos + halfwin], same windows as the sliding sums over the FASTA
+  inline void
+  _gcTrackWindowSums(GcTrackBits const& tb, uint32_t const len, int32_t const halfwin, std::vector<uint16_t>& content) {
+    for(int32_t pos = halfwin; pos < (int32_t) len - halfwin; ++pos) content[pos] = _gcTrackRank(tb, pos + halfwin + 1) - _gcTrackRank(tb, pos - halfwin);
+  }
+
+  template<typename TPredicate>
+  inline bool
+  _writeGcTrackBits(std::ofstream& out, char const* seq, uint32_t const len, TPredicate isSet) {
+    uint32_t nwords = _gcTrackWords(len);
+    std::vector<uint64_t> bits(nwords, 0);
+    std::vector<uint32_t> cum(nwords, 0);
+    for(uint32_t i = 0; i < len; ++i) {
+      if (isSet(seq[i])) bits[i >> 6] |= (1ULL << (i & 63));
+    }
+    uint32_t total = 0;
+    for(uint32_t w = 0; w < nwords; ++w) {
+      cum[w] = total;
+      total += __builtin_popcountll(bits[w]);
+    }
+    out.write((char const*) &bits[0], nwords * sizeof(uint64_t));
+    out.write((char const*) &cum[0], nwords * sizeof(uint32_t));
+    return out.good();
+  }
+
+  inline bool
+  _isUniqueBase(char const c) {
+    return (c == 'C');
+  }
+
+  inline bool
+  _isGcBase(char const c) {
+    return ((c == 'c') || (c == 'C') || (c == 'g') || (c == 'G'));
+  }
+
+  inline bool
+  _gcTrackPad(std::ofstream& out, uint64_t& offset) {
+    while (offset % sizeof(uint64_t)) {
+      out.put('\0');
+      ++offset;
+    }
+    return out.good();
+  }
+
+  inline int32_t
+  buildGcTrack(GcTrackConfig const& c) {
+    faidx_t* faiRef = fai_load(c.genome.string().c_str());
+    if (faiRef == NULL) {
+      std::cerr << "Fail to open genome " << c.genome.string() << std::endl;
+      return 1;
+    }
+    faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
+    if (faiMap == NULL) {
+      std::cerr << "Fail to open mappability map " << c.mapFile.string() << std::endl;
+      fai_destroy(faiRef);
+      return 1;
+    }
+
+    // Contigs of the reference followed by mappability-only contigs
+    std::vector<std::string> names;
+    std::vector<GcTrackContig> contigs;
+    for(int32_t i = 0; i < faidx_nseq(faiRef); ++i) {
+      std::string tname(faidx_iseq(faiRef, i));
+      GcTrackContig ctg;
+      ctg.len = faidx_seq_len(faiRef, tname.c_str());
+      ctg.flags = DELLY_GCTRACK_REF;
+      if (faidx_has_seq(faiMap, tname.c_str())) {
+	if (faidx_seq_len(faiMap, tname.c_str()) == (int32_t) ctg.len) ctg.flags |= DELLY_GCTRACK_MAP;
+	else std::cerr << "Warning: " << tname << " has different lengths in genome and mappability map!" << std::endl;
+      }
+      names.push_back(tname);
+      contigs.push_back(ctg);
+    }
+    for(int32_t i = 0; i < faidx_nseq(faiMap); ++i) {
+      std::string tname(faidx_iseq(faiMap, i));
+      if (faidx_has_seq(faiRef, tname.c_str())) continue;
+      GcTrackContig ctg;
+      ctg.len = faidx_seq_len(faiMap, tname.c_str());
+      ctg.flags = DELLY_GCTRACK_MAP;
+      names.push_back(tname);
+      contigs.push_back(ctg);
+    }
+
+    // Header and contig index
+    uint64_t offset = sizeof(DELLY_GCTRACK_MAGIC) + sizeof(int32_t);
+    for(uint32_t i = 0; i < names.size(); ++i) offset += sizeof(int32_t) + names[i].size() + sizeof(uint32_t) + sizeof(uint8_t) + 2 * sizeof(uint64_t);
+    std::ofstream out(c.outfile.string().c_str(), std::ios::out | std::ios::binary);
+    if (!out.good()) {
+      std::cerr << "Fail to open output file " << c.outfile.string() << std::endl;
+      fai_destroy(faiRef);
+      fai_destroy(faiMap);
+      return 1;
+    }
+    out.write(DELLY_GCTRACK_MAGIC, sizeof(DELLY_GCTRACK_MAGIC));
+    int32_t ncontig = names.size();
+    out.write((char const*) &ncontig, sizeof(int32_t));
+    uint64_t dataOffset = offset + (sizeof(uint64_t) - offset % sizeof(uint64_t)) % sizeof(uint64_t);
+    for(uint32_t i = 0; i < names.size(); ++i) {
+      int32_t nameLen = names[i].size();
+      out.write((char const*) &nameLen, sizeof(int32_t));
+      out.write(names[i].c_str(), nameLen);
+      out.write((char const*) &contigs[i].len, sizeof(uint32_t));
+      out.write((char const*) &contigs[i].flags, sizeof(uint8_t));
+      uint64_t mapOffset = 0;
+      if (contigs[i].flags & DELLY_GCTRACK_MAP) {
+	mapOffset = dataOffset;
+	dataOffset += _gcTrackSize(contigs[i].len);
+	dataOffset += (sizeof(uint64_t) - dataOffset % sizeof(uint64_t)) % sizeof(uint64_t);
+      }
+      uint64_t refOffset = 0;
+      if (contigs[i].flags & DELLY_GCTRACK_REF) {
+	refOffset = dataOffset;
+	dataOffset += _gcTrackSize(contigs[i].len);
+	dataOffset += (sizeof(uint64_t) - dataOffset % sizeof(uint64_t)) % sizeof(uint64_t);
+      }
+      out.write((char const*) &mapOffset, sizeof(uint64_t));
+      out.write((char const*) &refOffset, sizeof(uint64_t));
+    }
+
+    // Bit tracks
+    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Build GC and mappability track" << std::endl;
+    boost::progress_display show_progress( names.size() );
+    bool success = _gcTrackPad(out, offset);
+    for(uint32_t i = 0; ((i < names.size()) && (success)); ++i) {
+      ++show_progress;
+      for(uint8_t flag = DELLY_GCTRACK_MAP; ((flag <= DELLY_GCTRACK_REF) && (success)); flag <<= 1) {
+	if (!(contigs[i].flags & flag)) continue;
+	int32_t seqlen = -1;
+	faidx_t* fai = (flag == DELLY_GCTRACK_MAP) ? faiMap : faiRef;
+	char* seq = faidx_fetch_seq(fai, names[i].c_str(), 0, contigs[i].len, &seqlen);
+	if ((seq == NULL) || (seqlen != (int32_t) contigs[i].len)) success = false;
+	else if (flag == DELLY_GCTRACK_MAP) success = _writeGcTrackBits(out, seq, contigs[i].len, _isUniqueBase);
+	else success = _writeGcTrackBits(out, seq, contigs[i].len, _isGcBase);
+	if (seq != NULL) free(seq);
+	offset += _gcTrackSize(contigs[i].len);
+	if (success) success = _gcTrackPad(out, offset);
+      }
+    }
+    out.close();
+    fai_destroy(faiRef);
+    fai_destroy(faiMap);
+    if ((!success) || (out.fail())) {
+      std::cerr << "Fail to write GC and mappability track " << c.outfile.string() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  inline bool
+  _mapGcTrack(std::string const& trackFile, GcTrack& tr) {
+    int fd = open(trackFile.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat trackStat;
+    if ((fstat(fd, &trackStat) != 0) || (trackStat.st_size < (off_t) (sizeof(DELLY_GCTRACK_MAGIC) + sizeof(int32_t)))) {
+      close(fd);
+      return false;
+    }
+    void* addr = mmap(NULL, trackStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+    char* base = (char*) addr;
+    uint64_t length = trackStat.st_size;
+    uint64_t k = sizeof(DELLY_GCTRACK_MAGIC);
+    int32_t ncontig = 0;
+    bool valid = (std::memcmp(base, DELLY_GCTRACK_MAGIC, sizeof(DELLY_GCTRACK_MAGIC)) == 0);
+    valid = valid && _refCacheGet(base, length, k, ncontig);
+    for(int32_t i = 0; ((valid) && (i < ncontig)); ++i) {
+      int32_t nameLen = 0;
+      valid = _refCacheGet(base, length, k, nameLen) && (nameLen >= 0) && (k + nameLen <= length);
+      if (!valid) break;
+      std::string name(base + k, nameLen);
+      k += nameLen;
+      GcTrackContig ctg;
+      uint64_t mapOffset = 0;
+      uint64_t refOffset = 0;
+      valid = _refCacheGet(base, length, k, ctg.len) && _refCacheGet(base, length, k, ctg.flags) && _refCacheGet(base, length, k, mapOffset) && _refCacheGet(base, length, k, refOffset);
+      if (!valid) break;
+      uint32_t nwords = _gcTrackWords(ctg.len);
+      if (ctg.flags & DELLY_GCTRACK_MAP) {
+	valid = (mapOffset + _gcTrackSize(ctg.len) <= length);
+	ctg.uniq.len = ctg.len;
+	ctg.uniq.bits = (uint64_t const*) (base + mapOffset);
+	ctg.uniq.cum = (uint32_t const*) (base + mapOffset + nwords * sizeof(uint64_t));
+      }
+      if (ctg.flags & DELLY_GCTRACK_REF) {
+	valid = valid && (refOffset + _gcTrackSize(ctg.len) <= length);
+	ctg.gc.len = ctg.len;
+	ctg.gc.bits = (uint64_t const*) (base + refOffset);
+	ctg.gc.cum = (uint32_t const*) (base + refOffset + nwords * sizeof(uint64_t));
+      }
+      if (valid) tr.contigs[name] = ctg;
+    }
+    if (!valid) {
+      tr.contigs.clear();
+      munmap(addr, length);
+      return false;
+    }
+    tr.mapped = true;
+    tr.base = base;
+    tr.length = length;
+    return true;
+  }
+
+  inline GcTrack const&
+  _openGcTrack(boost::filesystem::path const& trackFile) {
+    GcTrack* tr = NULL;
+#pragma omp critical (gctrack)
+    {
+      TGcTrackMap& tracks = _gcTracks();
+      TGcTrackMap::iterator it = tracks.find(trackFile.string());
+      if (it == tracks.end()) {
+	tr = &tracks[trackFile.string()];
+	if (!_mapGcTrack(trackFile.string(), *tr)) std::cerr << "Error: Invalid GC and mappability track " << trackFile.string() << std::endl;
+      } else tr = &it->second;
+    }
+    return *tr;
+  }
+
+  // Contig presence in the track (DELLY_GCTRACK_MAP and/or DELLY_GCTRACK_REF)
+  inline bool
+  gcTrackHasContig(boost::filesystem::path const& trackFile, std::string const& chr, uint8_t const flags) {
+    GcTrack const& tr = _openGcTrack(trackFile);
+    std::map<std::string, GcTrackContig>::const_iterator it = tr.contigs.find(chr);
+    if (it == tr.contigs.end()) return false;
+    return ((it->second.flags & flags) == flags);
+  }
+
+  // Fragment uniqueness and GC content for fragments of size meanisize centred at each position, gcContent is optional
+  inline bool
+  gcTrackContent(boost::filesystem::path const& trackFile, std::string const& chr, uint32_t const len, uint32_t const meanisize, std::vector<uint16_t>& uniqContent, std::vector<uint16_t>* gcContent) {
+    GcTrack const& tr = _openGcTrack(trackFile);
+    std::map<std::string, GcTrackContig>::const_iterator it = tr.contigs.find(chr);
+    if (it == tr.contigs.end()) return false;
+    if (!(it->second.flags & DELLY_GCTRACK_MAP)) return false;
+    if ((gcContent != NULL) && (!(it->second.flags & DELLY_GCTRACK_REF))) return false;
+    int32_t halfwin = (int32_t) (meanisize / 2);
+    _gcTrackWindowSums(it->second.uniq, len, halfwin, uniqContent);
+    if (gcContent != NULL) _gcTrackWindowSums(it->second.gc, len, halfwin, *gcContent);
+    return true;
+  }
+
+  int gcTrack(int argc, char **argv) {
+    GcTrackConfig c;
+
+    // Parameter
+    boost::program_options::options_description generic("Generic options");
+    generic.add_options()
+      ("help,?", "show help message")
+      ("genome,g", boost::program_options::value<boost::filesystem::path>(&c.genome), "genome file")
+      ("mappability,m", boost::program_options::value<boost::filesystem::path>(&c.mapFile), "input mappability map")
+      ("outfile,o", boost::program_options::value<boost::filesystem::path>(&c.outfile)->default_value("genome.gct"), "GC and mappability track")
+      ;
+
+    boost::program_options::options_description cmdline_options;
+    cmdline_options.add(generic);
+    boost::program_options::options_description visible_options;
+    visible_options.add(generic);
+
+    // Parse command-line
+    boost::program_options::variables_map vm;
+    boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
+    boost::program_options::notify(vm);
+
+    // Check command line arguments
+    if ((vm.count("help")) || (!vm.count("genome")) || (!vm.count("mappability"))) {
+      std::cout << std::endl;
+      std::cout << "Usage: delly " << argv[0] << " [OPTIONS] -g <genome.fa> -m <genome.map>" << std::endl;
+      std::cout << visible_options << "\n";
+      return 1;
+    }
+
+    // Show cmd
+    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] ";
+    std::cout << "delly ";
+    for(int i=0; i<argc; ++i) { std::cout << argv[i] << ' '; }
+    std::cout << std::endl;
+
+    // Build track
+    if (buildGcTrack(c)) return 1;
+
+    // Done
+    now = boost::posix_time::second_clock::local_time();
+    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Done." << std::endl;
+    return 0;
+  }
+
+}
+
+#endif
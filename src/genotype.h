@@ -11,9 +11,14 @@
 #include <boost/iostreams/device/file.hpp>
 #include <boost/progress.hpp>
 
+#include <deque>
+
 #include <htslib/sam.h>
 
 #include "util.h"
+#include "refcache.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 namespace torali
 {
@@ -33,15 +38,110 @@ namespace torali
   };
   
 
-  template<typename TConfig, typename TSRStore, typename TJunctionMap, typename TReadCountMap>
+  // Sample-chromosome unit of trackRef, per-sample statistics are merged in task order
+  struct TrackRefTask {
+    uint32_t file_c;
+    int32_t refIndex;
+    bool haplotagged;
+    uint64_t matchCount;
+    uint64_t mismatchCount;
+    uint64_t delCount;
+    uint64_t insCount;
+    std::vector<uint32_t> covDist;
+    std::vector<uint32_t> rlDist;
+    std::string dump;
+
+    TrackRefTask(uint32_t const f, int32_t const r) : file_c(f), refIndex(r), haplotagged(false), matchCount(0), mismatchCount(0), delCount(0), insCount(0) {}
+  };
+
+  // Per-base coverage of one chromosome, only bases right of the current alignment start are kept
+  struct CoverageSweep {
+    uint32_t len;
+    uint32_t done;
+    uint64_t cum;
+    uint32_t nextBound;
+    std::deque<uint16_t> cov;
+    std::vector<uint32_t> bounds;
+    std::vector<uint64_t> cumAt;
+
+    CoverageSweep(uint32_t const l, std::vector<uint32_t> const& b) : len(l), done(0), cum(0), nextBound(0), bounds(b), cumAt(b.size(), 0) {}
+  };
+
+  inline void
+  _sweepBounds(CoverageSweep& cs) {
+    while ((cs.nextBound < cs.bounds.size()) && (cs.bounds[cs.nextBound] <= cs.done)) cs.cumAt[cs.nextBound++] = cs.cum;
+  }
+
+  // Fold final bases [done, upto) into the coverage histogram and the cumulative sums at the window bounds
+  inline void
+  _sweepFinalize(CoverageSweep& cs, uint32_t upto, std::vector<uint32_t>& covDist) {
+    if (upto > cs.len) upto = cs.len;
+    while (cs.done < upto) {
+      _sweepBounds(cs);
+      if (cs.cov.empty()) {
+	if (covDist.empty()) covDist.resize(1, 0);
+	covDist[0] += upto - cs.done;
+	cs.done = upto;
+      } else {
+	uint16_t val = cs.cov.front();
+	cs.cov.pop_front();
+	if (val >= covDist.size()) covDist.resize(val + 1, 0);
+	++covDist[val];
+	cs.cum += val;
+	++cs.done;
+      }
+    }
+    _sweepBounds(cs);
+  }
+
+  inline void
+  _sweepAdd(CoverageSweep& cs, uint32_t const rp, uint32_t const maxCoverage) {
+    if (rp < cs.len) {
+      uint32_t k = rp - cs.done;
+      if (k >= cs.cov.size()) cs.cov.resize(k + 1, 0);
+      if (cs.cov[k] < maxCoverage - 1) ++cs.cov[k];
+    }
+  }
+
+  // Coverage sum of [start, end), both clipped to the chromosome, once all bases are final
+  inline int32_t
+  _sweepSum(CoverageSweep const& cs, int32_t start, int32_t end) {
+    start = std::min(std::max(start, 0), (int32_t) cs.len);
+    end = std::min(std::max(end, 0), (int32_t) cs.len);
+    if (end <= start) return 0;
+    uint64_t cs1 = cs.cumAt[std::lower_bound(cs.bounds.begin(), cs.bounds.end(), (uint32_t) end) - cs.bounds.begin()];
+    uint64_t cs0 = cs.cumAt[std::lower_bound(cs.bounds.begin(), cs.bounds.end(), (uint32_t) start) - cs.bounds.begin()];
+    return (int32_t) (cs1 - cs0);
+  }
+
+  // Left control, SV and right control window of an SV for its chromosome
   inline void
+  _trackRefWindows(StructuralVariantRecord const& sv, uint32_t const len, int32_t* win) {
+    int32_t halfSize = (sv.svEnd - sv.svStart)/2;
+    if ((_translocation(sv.svt)) || (sv.svt == 4)) halfSize = 500;
+    win[0] = std::max(sv.svStart - halfSize, 0);
+    win[1] = sv.svStart;
+    win[2] = sv.svStart;
+    win[3] = sv.svEnd;
+    win[4] = sv.svEnd;
+    win[5] = std::min(sv.svEnd + halfSize, (int32_t) len);
+    if ((_translocation(sv.svt)) || (sv.svt == 4)) {
+      win[2] = std::max(sv.svStart - halfSize, 0);
+      win[3] = std::min(sv.svStart + halfSize, (int32_t) len);
+      win[4] = sv.svStart;
+      win[5] = std::min(sv.svStart + halfSize, (int32_t) len);
+    }
+  }
+
+  template<typename TConfig, typename TSRStore, typename TJunctionMap, typename TReadCountMap>
+  inline bool
   trackRef(TConfig& c, std::vector<StructuralVariantRecord>& svs, TSRStore& srStore, TJunctionMap& jctMap, TReadCountMap& covMap) {
     typedef std::vector<StructuralVariantRecord> TSVs;
     typedef std::vector<uint8_t> TQuality;
     typedef boost::multi_array<char, 2> TAlign;
-    if (svs.empty()) return;
+    if (svs.empty()) return true;
 
-    // Open file handles
+    // Open file handles, reads are parsed with thread-local handles
     typedef std::vector<samFile*> TSamFile;
     typedef std::vector<hts_idx_t*> TIndex;
     typedef std::vector<bam_hdr_t*> THeader;
@@ -60,7 +160,6 @@ namespace torali
     // Parse genome chr-by-chr
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "SV annotation" << std::endl;
-    boost::progress_display show_progress( hdr[0]->n_targets );
 
     // Ref aligned reads
     typedef std::vector<uint32_t> TRefAlignCount;
@@ -99,17 +198,16 @@ namespace torali
       dumpOut << "#svid\tbam\tqname\tchr\tpos\tmatechr\tmatepos\tmapq\ttype" << std::endl;
     }
 
+    // Reference and consensus probes, an SV only has probes on its first chromosome
+    typedef std::vector<Geno> TGenoRegion;
+    TGenoRegion gbp(svs.size(), Geno());
+    std::vector<std::vector<int32_t> > chrProbes(hdr[0]->n_targets);
+
     // Iterate chromosomes
     std::vector<std::string> refProbes(svs.size());
-    faidx_t* fai = fai_load(c.genome.string().c_str());
     for(int32_t refIndex=0; refIndex < (int32_t) hdr[0]->n_targets; ++refIndex) {
-      ++show_progress;
       char* seq = NULL;
 
-      // Reference and consensus probes for this chromosome
-      typedef std::vector<Geno> TGenoRegion;
-      TGenoRegion gbp(svs.size(), Geno());
-      
       // Iterate all structural variants
       for(typename TSVs::iterator itSV = svs.begin(); itSV != svs.end(); ++itSV) {
 	if ((itSV->chr != refIndex) && (itSV->chr2 != refIndex)) continue;
@@ -118,7 +216,7 @@ namespace torali
 	if (seq == NULL) {
 	  int32_t seqlen = -1;
 	  std::string tname(hdr[0]->target_name[refIndex]);
-	  seq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr[0]->target_len[refIndex], &seqlen);
+	  seq = fetchReference(c.genome, tname, seqlen);
 	}
 
 	// Set tag alleles
@@ -204,12 +302,15 @@ namespace torali
 	  gbp[itSV->id].ref = refSeq;
 	  gbp[itSV->id].alt = altSeq;
 	  gbp[itSV->id].svt = itSV->svt;
+	  chrProbes[refIndex].push_back(itSV->id);
 	}
       }
-      if (seq != NULL) free(seq);
+      releaseReference(seq);
+    }
 
-      // Genotype
-      // Iterate samples
+    // Genotype tasks for all samples and chromosomes
+    std::vector<TrackRefTask> tasks;
+    for(int32_t refIndex=0; refIndex < (int32_t) hdr[0]->n_targets; ++refIndex) {
       for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
 	// Check we have mapped reads on this chromosome
 	bool nodata = true;
@@ -221,10 +322,47 @@ namespace torali
 	hts_idx_get_stat(idx[file_c], refIndex, &mapped, &unmapped);
 	if (mapped) nodata = false;
 	if (nodata) continue;
+	tasks.push_back(TrackRefTask(file_c, refIndex));
+      }
+    }
 
-	// Coverage track
-	typedef std::vector<TMaxCoverage> TBpCoverage;
-	TBpCoverage covBases(hdr[file_c]->target_len[refIndex], 0);
+    // SVs by chromosome for the read-count windows
+    std::vector<std::vector<uint32_t> > chrSVs(hdr[0]->n_targets);
+    for(uint32_t i = 0; i < svs.size(); ++i) chrSVs[svs[i].chr].push_back(i);
+
+    // Execute tasks sample-major so one file handle per thread suffices
+    std::vector<uint32_t> schedule;
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      for(uint32_t task = 0; task < tasks.size(); ++task) {
+	if (tasks[task].file_c == file_c) schedule.push_back(task);
+      }
+    }
+    bool failed = false;
+
+    boost::progress_display show_progress( tasks.size() );
+#pragma omp parallel default(shared)
+    {
+      // Thread-local file handle
+      SampleHandle sh;
+
+#pragma omp for schedule(dynamic)
+      for(int32_t slot = 0; slot < (int32_t) schedule.size(); ++slot) {
+	++show_progress;
+	TrackRefTask& tt = tasks[schedule[slot]];
+	uint32_t file_c = tt.file_c;
+	int32_t refIndex = tt.refIndex;
+	if (!_sampleHandleOpen(c, file_c, sh, failed)) continue;
+
+	// Coverage track, window bounds of all SVs on this chromosome
+	std::vector<uint32_t> bounds;
+	for(uint32_t j = 0; j < chrSVs[refIndex].size(); ++j) {
+	  int32_t win[6];
+	  _trackRefWindows(svs[chrSVs[refIndex][j]], hdr[file_c]->target_len[refIndex], win);
+	  for(uint32_t w = 0; w < 6; ++w) bounds.push_back(std::min(std::max(win[w], 0), (int32_t) hdr[file_c]->target_len[refIndex]));
+	}
+	std::sort(bounds.begin(), bounds.end());
+	bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+	CoverageSweep covBases(hdr[file_c]->target_len[refIndex], bounds);
 
 	// Flag breakpoints
 	typedef std::set<int32_t> TIdSet;
@@ -232,7 +370,8 @@ namespace torali
 	TBpToIdMap bpid;
 	typedef boost::dynamic_bitset<> TBitSet;
 	TBitSet bpOccupied(hdr[file_c]->target_len[refIndex], false);
-	for(uint32_t i = 0; i < gbp.size(); ++i) {
+	for(uint32_t j = 0; j < chrProbes[refIndex].size(); ++j) {
+	  int32_t i = chrProbes[refIndex][j];
 	  if (gbp[i].svStart != -1) {
 	    bpOccupied[gbp[i].svStart] = 1;
 	    if (bpid.find(gbp[i].svStart) == bpid.end()) bpid.insert(std::make_pair(gbp[i].svStart, TIdSet()));
@@ -246,15 +385,25 @@ namespace torali
 	}
 
 	// Count reads
-	hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, 0, hdr[file_c]->target_len[refIndex]);
+	hts_itr_t* iter = sam_itr_queryi(sh.idx, refIndex, 0, hdr[file_c]->target_len[refIndex]);
 	bam1_t* rec = bam_init1();
-	while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
+	uint64_t nread = 0;
+	uint64_t nalign = 0;
+	while (sam_itr_next(sh.samfile, iter, rec) >= 0) {
+	  ++nread;
 	  // Genotyping only primary alignments
 	  if (rec->core.flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP | BAM_FSUPPLEMENTARY | BAM_FUNMAP)) continue;
+
+	  // Bases left of this alignment are final
+	  _sweepFinalize(covBases, rec->core.pos, tt.covDist);
 	  
 	  // Read length
 	  int32_t readlen = readLength(rec);
-	  if (readlen < (int32_t) (maxReadLength * rlBinSize)) ++rlDist[file_c][(int32_t) (readlen / rlBinSize)];
+	  if (readlen < (int32_t) (maxReadLength * rlBinSize)) {
+	    uint32_t rlBin = readlen / rlBinSize;
+	    if (rlBin >= tt.rlDist.size()) tt.rlDist.resize(rlBin + 1, 0);
+	    ++tt.rlDist[rlBin];
+	  }
 
 	  // Reference and sequence pointer
 	  uint32_t rp = rec->core.pos; // reference pointer
@@ -283,7 +432,7 @@ namespace torali
 	    if ((bam_cigar_op(cigar[i]) == BAM_CMATCH) || (bam_cigar_op(cigar[i]) == BAM_CEQUAL) || (bam_cigar_op(cigar[i]) == BAM_CDIFF)) {
 	      // Fetch reference alignments
 	      for(uint32_t k = 0; k < bam_cigar_oplen(cigar[i]); ++k) {
-		if ((rp < hdr[file_c]->target_len[refIndex]) && (covBases[rp] < maxCoverage - 1)) ++covBases[rp];
+		_sweepAdd(covBases, rp, maxCoverage);
 		if (bpOccupied[rp]) {
 		  for(typename TIdSet::const_iterator it = bpid[rp].begin(); it != bpid[rp].end(); ++it) {
 		    // Ensure fwd alignment and each SV only once
@@ -293,13 +442,13 @@ namespace torali
 		    }
 		  }
 		}
-		if ((bam_cigar_op(cigar[i]) == BAM_CMATCH) || (bam_cigar_op(cigar[i]) == BAM_CEQUAL)) ++matchCount[file_c];
-		else if (bam_cigar_op(cigar[i]) == BAM_CDIFF) ++mismatchCount[file_c];
+		if ((bam_cigar_op(cigar[i]) == BAM_CMATCH) || (bam_cigar_op(cigar[i]) == BAM_CEQUAL)) ++tt.matchCount;
+		else if (bam_cigar_op(cigar[i]) == BAM_CDIFF) ++tt.mismatchCount;
 		++sp;
 		++rp;
 	      }
 	    } else if ((bam_cigar_op(cigar[i]) == BAM_CDEL) || (bam_cigar_op(cigar[i]) == BAM_CREF_SKIP)) {
-	      ++delCount[file_c];
+	      ++tt.delCount;
 	      for(uint32_t k = 0; k < bam_cigar_oplen(cigar[i]); ++k) {
 		if (bpOccupied[rp]) {
 		  for(typename TIdSet::const_iterator it = bpid[rp].begin(); it != bpid[rp].end(); ++it) {
@@ -313,7 +462,7 @@ namespace torali
 		++rp;
 	      }
 	    } else if (bam_cigar_op(cigar[i]) == BAM_CINS) {
-	      ++insCount[file_c];
+	      ++tt.insCount;
 	      sp += bam_cigar_oplen(cigar[i]);
 	    } else if (bam_cigar_op(cigar[i]) == BAM_CSOFT_CLIP) {
 	      sp += bam_cigar_oplen(cigar[i]);
@@ -378,6 +527,7 @@ namespace torali
 	      // Compute alignment to reference haplotype
 	      double scoreRef = needleBanded(gbp[svid].ref, subseq, semiglobal, simple);
 	      scoreRef /= (double) (c.flankQuality * gbp[svid].ref.size() * simple.match + (1.0 - c.flankQuality) * gbp[svid].ref.size() * simple.mismatch);
+	      nalign += 2;
 
 	      // Any confident alignment?
 	      if ((scoreRef > 1) || (scoreAlt > 1)) {
@@ -393,7 +543,7 @@ namespace torali
 		      uint8_t* hpptr = bam_aux_get(rec, "HP");
 		      jctMap[file_c][svid].ref.push_back((uint8_t) std::min(rq, (uint32_t) rec->core.qual));
 		      if (hpptr) {
-			c.isHaplotagged = true;
+			tt.haplotagged = true;
 			int hap = bam_aux2i(hpptr);
 			if (hap == 1) ++jctMap[file_c][svid].refh1;
 			else ++jctMap[file_c][svid].refh2;
@@ -413,11 +563,13 @@ namespace torali
 		      std::string padNumber = boost::lexical_cast<std::string>(svid);
 		      padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
 		      svidStr += padNumber;
-		      dumpOut << svidStr << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tSR" << std::endl;
+		      std::ostringstream dumpLine;
+		      dumpLine << svidStr << "\t" << c.files[file_c].string() << "\t" << bam_get_qname(rec) << "\t" << hdr[file_c]->target_name[rec->core.tid] << "\t" << rec->core.pos << "\t" << hdr[file_c]->target_name[rec->core.mtid] << "\t" << rec->core.mpos << "\t" << (int32_t) rec->core.qual << "\tSR" << std::endl;
+		      tt.dump += dumpLine.str();
 		    }
 		    jctMap[file_c][svid].alt.push_back((uint8_t) std::min(aq, (uint32_t) rec->core.qual));
 		    if (hpptr) {
-		      c.isHaplotagged = true;
+		      tt.haplotagged = true;
 		      int hap = bam_aux2i(hpptr);
 		      if (hap == 1) ++jctMap[file_c][svid].alth1;
 		      else ++jctMap[file_c][svid].alth2;
@@ -430,52 +582,49 @@ namespace torali
 	}
 	// Clean-up
 	bam_destroy1(rec);
+	metricsReads(nread);
+	metricsAlignments(nalign);
 	hts_itr_destroy(iter);
       
 	// Summarize coverage for this chromosome
-	for(uint32_t i = 0; i < hdr[file_c]->target_len[refIndex]; ++i) ++covDist[file_c][covBases[i]];
+	_sweepFinalize(covBases, hdr[file_c]->target_len[refIndex], tt.covDist);
             
 	// Assign SV support
-	for(uint32_t i = 0; i < svs.size(); ++i) {
-	  if (svs[i].chr == refIndex) {
-	    int32_t halfSize = (svs[i].svEnd - svs[i].svStart)/2;
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) halfSize = 500;
-
-	    // Left region
-	    int32_t lstart = std::max(svs[i].svStart - halfSize, 0);
-	    int32_t lend = svs[i].svStart;
-	    int32_t covbase = 0;
-	    for(uint32_t k = lstart; ((k < (uint32_t) lend) && (k < hdr[file_c]->target_len[refIndex])); ++k) covbase += covBases[k];
-	    covMap[file_c][svs[i].id].leftRC = covbase;
-
-	    // Actual SV
-	    covbase = 0;
-	    int32_t mstart = svs[i].svStart;
-	    int32_t mend = svs[i].svEnd;
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      mstart = std::max(svs[i].svStart - halfSize, 0);
-	      mend = std::min(svs[i].svStart + halfSize, (int32_t) hdr[file_c]->target_len[refIndex]);
-	    }
-	    for(uint32_t k = mstart; ((k < (uint32_t) mend) && (k < hdr[file_c]->target_len[refIndex])); ++k) covbase += covBases[k];
-	    covMap[file_c][svs[i].id].rc = covbase;
-
-	    // Right region
-	    covbase = 0;
-	    int32_t rstart = svs[i].svEnd;
-	    int32_t rend = std::min(svs[i].svEnd + halfSize, (int32_t) hdr[file_c]->target_len[refIndex]);
-	    if ((_translocation(svs[i].svt)) || (svs[i].svt == 4)) {
-	      rstart = svs[i].svStart;
-	      rend = std::min(svs[i].svStart + halfSize, (int32_t) hdr[file_c]->target_len[refIndex]);
-	    }
-	    for(uint32_t k = rstart; ((k < (uint32_t) rend) && (k < hdr[file_c]->target_len[refIndex])); ++k) covbase += covBases[k];
-	    covMap[file_c][svs[i].id].rightRC = covbase;
-	  }
+	for(uint32_t j = 0; j < chrSVs[refIndex].size(); ++j) {
+	  StructuralVariantRecord const& sv = svs[chrSVs[refIndex][j]];
+	  int32_t win[6];
+	  _trackRefWindows(sv, hdr[file_c]->target_len[refIndex], win);
+	  covMap[file_c][sv.id].leftRC = _sweepSum(covBases, win[0], win[1]);
+	  covMap[file_c][sv.id].rc = _sweepSum(covBases, win[2], win[3]);
+	  covMap[file_c][sv.id].rightRC = _sweepSum(covBases, win[4], win[5]);
 	}
       }
+
+      _sampleHandleClose(sh);
+    }
+    if (failed) {
+      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+	bam_hdr_destroy(hdr[file_c]);
+	hts_idx_destroy(idx[file_c]);
+	sam_close(samfile[file_c]);
+      }
+      return false;
     }
-    // Clean-up
-    fai_destroy(fai);
 
+    // Merge task statistics in chromosome and sample order
+    for(uint32_t task = 0; task < tasks.size(); ++task) {
+      TrackRefTask const& tt = tasks[task];
+      uint32_t file_c = tt.file_c;
+      if (tt.haplotagged) c.isHaplotagged = true;
+      matchCount[file_c] += tt.matchCount;
+      mismatchCount[file_c] += tt.mismatchCount;
+      delCount[file_c] += tt.delCount;
+      insCount[file_c] += tt.insCount;
+      for(uint32_t i = 0; i < tt.covDist.size(); ++i) covDist[file_c][i] += tt.covDist[i];
+      for(uint32_t i = 0; i < tt.rlDist.size(); ++i) rlDist[file_c][i] += tt.rlDist[i];
+      if (c.hasDumpFile) dumpOut << tt.dump;
+    }
+    
     // Output coverage info
     std::cout << "Coverage distribution (^COV)" << std::endl;
     for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
@@ -540,6 +689,7 @@ namespace torali
       hts_idx_destroy(idx[file_c]);
       sam_close(samfile[file_c]);
     }
+    return true;
   }
      
   
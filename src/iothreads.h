@@ -0,0 +1,63 @@
+#ifndef IOTHREADS_H
+#define IOTHREADS_H
+
+#include <iostream>
+
+#include <htslib/hts.h>
+#include <htslib/thread_pool.h>
+
+namespace torali
+{
+
+  // htslib thread pool shared by all BAM/CRAM/BCF files of a command
+  struct IoThreadPool {
+    int32_t nthreads;
+    htsThreadPool tp;
+
+    IoThreadPool() : nthreads(0) {
+      tp.pool = NULL;
+      tp.qsize = 0;
+    }
+  };
+
+  inline IoThreadPool&
+  _ioThreads() {
+    static IoThreadPool p;
+    return p;
+  }
+
+  // Without a pool (n < 1) BGZF and CRAM (de)compression stays on the calling thread
+  inline bool
+  ioThreadsEnable(int32_t const n) {
+    IoThreadPool& p = _ioThreads();
+    if ((n < 1) || (p.tp.pool != NULL)) return true;
+    p.tp.pool = hts_tpool_init(n);
+    if (p.tp.pool == NULL) {
+      std::cerr << "Failed to create I/O thread pool with " << n << " threads!" << std::endl;
+      return false;
+    }
+    p.nthreads = n;
+    return true;
+  }
+
+  // Files can be opened and attached from any thread, the pool itself is thread-safe
+  inline void
+  ioThreadsAttach(htsFile* fp) {
+    IoThreadPool& p = _ioThreads();
+    if ((fp == NULL) || (p.tp.pool == NULL)) return;
+    if (hts_set_thread_pool(fp, &p.tp) != 0) std::cerr << "Warning: Failed to attach I/O thread pool!" << std::endl;
+  }
+
+  // All attached files must be closed before
+  inline void
+  ioThreadsDestroy() {
+    IoThreadPool& p = _ioThreads();
+    if (p.tp.pool == NULL) return;
+    hts_tpool_destroy(p.tp.pool);
+    p.tp.pool = NULL;
+    p.nthreads = 0;
+  }
+
+}
+
+#endif
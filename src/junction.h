@@ -15,6 +15,8 @@
 
 #include "util.h"
 #include "assemble.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 namespace torali
 {
@@ -275,137 +277,230 @@ namespace torali
   }
 
 
-  template<typename TConfig, typename TValidRegion, typename TReadBp>
+  // Junctions of one alignment from its CIGAR, including the look-ahead indel extension
+  template<typename TConfig, typename TReadBp>
   inline void
-  findJunctions(TConfig const& c, TValidRegion const& validRegions, TReadBp& readBp) {
+  _alignmentJunctions(TConfig const& c, bam1_t* rec, TReadBp& readBp) {
+    std::size_t seed = hash_lr(rec);
+    //std::cerr << bam_get_qname(rec) << '\t' << seed << std::endl;
+    uint32_t rp = rec->core.pos; // reference pointer
+    uint32_t sp = 0; // sequence pointer
+
+    // Parse the CIGAR
+    uint32_t* cigar = bam_get_cigar(rec);
+    for (std::size_t i = 0; i < rec->core.n_cigar; ++i) {
+      if ((bam_cigar_op(cigar[i]) == BAM_CMATCH) || (bam_cigar_op(cigar[i]) == BAM_CEQUAL) || (bam_cigar_op(cigar[i]) == BAM_CDIFF)) {
+	sp += bam_cigar_oplen(cigar[i]);
+	rp += bam_cigar_oplen(cigar[i]);
+      } else if (bam_cigar_op(cigar[i]) == BAM_CDEL) {
+	if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
+	rp += bam_cigar_oplen(cigar[i]);
+	if (bam_cigar_oplen(cigar[i]) > c.minRefSep) { // Try look-ahead
+	  uint32_t spOrig = sp;
+	  uint32_t rpTmp = rp;
+	  uint32_t spTmp = sp;
+	  uint32_t dlen = bam_cigar_oplen(cigar[i]);
+	  for (std::size_t j = i + 1; j < rec->core.n_cigar; ++j) {
+	    if ((bam_cigar_op(cigar[j]) == BAM_CMATCH) || (bam_cigar_op(cigar[j]) == BAM_CEQUAL) || (bam_cigar_op(cigar[j]) == BAM_CDIFF)) {
+	      spTmp += bam_cigar_oplen(cigar[j]);
+	      rpTmp += bam_cigar_oplen(cigar[j]);
+	      if ((double) (spTmp - sp) / (double) (dlen + (rpTmp - rp)) > c.indelExtension) break;
+	    } else if (bam_cigar_op(cigar[j]) == BAM_CDEL) {
+	      rpTmp += bam_cigar_oplen(cigar[j]);
+	      if (bam_cigar_oplen(cigar[j]) > c.minRefSep) {
+		// Extend deletion
+		dlen += (rpTmp - rp);
+		rp = rpTmp;
+		sp = spTmp;
+		i = j;
+	      }
+	    } else if (bam_cigar_op(cigar[j]) == BAM_CINS) {
+	      if (bam_cigar_oplen(cigar[j]) > c.minRefSep) break; // No extension
+	      spTmp += bam_cigar_oplen(cigar[j]);
+	    } else break; // No extension
+	  }
+	  _insertJunction(readBp, seed, rec, rp, spOrig, true);
+	}
+      } else if (bam_cigar_op(cigar[i]) == BAM_CINS) {
+	if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
+	sp += bam_cigar_oplen(cigar[i]);
+	if (bam_cigar_oplen(cigar[i]) > c.minRefSep) { // Try look-ahead
+	  uint32_t rpOrig = rp;
+	  uint32_t rpTmp = rp;
+	  uint32_t spTmp = sp;
+	  uint32_t ilen = bam_cigar_oplen(cigar[i]);
+	  for (std::size_t j = i + 1; j < rec->core.n_cigar; ++j) {
+	    if ((bam_cigar_op(cigar[j]) == BAM_CMATCH) || (bam_cigar_op(cigar[j]) == BAM_CEQUAL) || (bam_cigar_op(cigar[j]) == BAM_CDIFF)) {
+	      spTmp += bam_cigar_oplen(cigar[j]);
+	      rpTmp += bam_cigar_oplen(cigar[j]);
+	      if ((double) (rpTmp - rp) / (double) (ilen + (spTmp - sp)) > c.indelExtension) break;
+	    } else if (bam_cigar_op(cigar[j]) == BAM_CDEL) {
+	      if (bam_cigar_oplen(cigar[j]) > c.minRefSep) break; // No extension
+	      rpTmp += bam_cigar_oplen(cigar[j]);
+	    } else if (bam_cigar_op(cigar[j]) == BAM_CINS) {
+	      spTmp += bam_cigar_oplen(cigar[j]);
+	      if (bam_cigar_oplen(cigar[j]) > c.minRefSep) {
+		// Extend insertion
+		ilen += (spTmp - sp);
+		rp = rpTmp;
+		sp = spTmp;
+		i = j;
+	      }
+	    } else {
+	      break; // No extension
+	    }
+	  }
+	  _insertJunction(readBp, seed, rec, rpOrig, sp, true);
+	}
+      } else if (bam_cigar_op(cigar[i]) == BAM_CREF_SKIP) {
+	rp += bam_cigar_oplen(cigar[i]);
+      } else if ((bam_cigar_op(cigar[i]) == BAM_CSOFT_CLIP) || (bam_cigar_op(cigar[i]) == BAM_CHARD_CLIP)) {
+	int32_t finalsp = sp;
+	bool scleft = false;
+	if (sp == 0) {
+	  finalsp += bam_cigar_oplen(cigar[i]); // Leading soft-clip / hard-clip
+	  scleft = true;
+	}
+	sp += bam_cigar_oplen(cigar[i]);
+	//std::cerr << bam_get_qname(rec) << ',' << rp << ',' << finalsp << ',' << scleft << std::endl;
+	if (bam_cigar_oplen(cigar[i]) > c.minClip) _insertJunction(readBp, seed, rec, rp, finalsp, scleft);
+      } else {
+	std::cerr << "Unknown Cigar options" << std::endl;
+      }
+    }
+  }
+
+  template<typename TConfig, typename TValidRegion, typename TReadBp>
+  inline bool
+  findJunctions(TConfig const& c, TValidRegion const& validRegions, TReadBp& readBp, std::vector<AssemblyReads>& asmReads) {
     typedef typename TValidRegion::value_type TChrIntervals;
 
-    // Open file handles
-    typedef std::vector<samFile*> TSamFile;
-    typedef std::vector<hts_idx_t*> TIndex;
-    TSamFile samfile(c.files.size());
-    TIndex idx(c.files.size());
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
-      hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
-      idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
-    }
-    bam_hdr_t* hdr = sam_hdr_read(samfile[0]);
+    // Open header
+    samFile* samfile = sam_open(c.files[0].string().c_str(), "r");
+    hts_set_fai_filename(samfile, c.genome.string().c_str());
+    bam_hdr_t* hdr = sam_hdr_read(samfile);
     
     // Parse genome chr-by-chr
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Split-read scanning" << std::endl;
-    boost::progress_display show_progress( hdr->n_targets );
 
-    // Iterate chromosomes
+    // Chromosome-sample tasks in the order of the serial scan
+    typedef std::pair<int32_t, uint32_t> TChrFile;
+    std::vector<TChrFile> tasks;
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
-      ++show_progress;
       if (validRegions[refIndex].empty()) continue;
+      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) tasks.push_back(std::make_pair(refIndex, file_c));
+    }
+    std::vector<TReadBp> taskBp(tasks.size());
+    asmReads.clear();
+    std::vector<std::vector<int32_t> > taskIndex(hdr->n_targets, std::vector<int32_t>(c.files.size(), -1));
+    for(uint32_t task = 0; task < tasks.size(); ++task) {
+      asmReads.push_back(AssemblyReads(tasks[task].first, tasks[task].second));
+      taskIndex[tasks[task].first][tasks[task].second] = task;
+    }
+
+    // Primary alignments in excluded gaps, (task, (virtual offset, read hash))
+    typedef std::pair<uint32_t, std::pair<int64_t, std::size_t> > TGapRead;
+    std::vector<std::vector<TGapRead> > gapReads(tasks.size());
+    std::map<std::string, int32_t> chrMap;
+    for(int32_t refIndex = 0; refIndex < (int32_t) hdr->n_targets; ++refIndex) chrMap[hdr->target_name[refIndex]] = refIndex;
+    std::vector<uint64_t> sampleOffsets(c.files.size(), 0);
+    boost::progress_display show_progress( tasks.size() );
+
+    // Execute tasks sample-major so one file handle per thread suffices
+    std::vector<uint32_t> schedule;
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      for(uint32_t task = 0; task < tasks.size(); ++task) {
+	if (tasks[task].second == file_c) schedule.push_back(task);
+      }
+    }
+    bool failed = false;
+
+#pragma omp parallel default(shared)
+    {
+      // Thread-local file handle
+      SampleHandle sh;
+
+#pragma omp for schedule(dynamic)
+      for(int32_t slot = 0; slot < (int32_t) schedule.size(); ++slot) {
+	++show_progress;
+	uint32_t task = schedule[slot];
+	int32_t refIndex = tasks[task].first;
+	uint32_t file_c = tasks[task].second;
+	if (!_sampleHandleOpen(c, file_c, sh, failed)) continue;
 
-      // Collect reads from all samples
-      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
 	// Read alignments
+	AssemblyReads& ar = asmReads[task];
+	ar.indexed = (hts_get_format(sh.samfile)->format == bam);
+	std::vector<PrimaryLookup> lookups;
+	bam1_t* rec = bam_init1();
+	uint64_t nread = 0;
+	int64_t voffset = -1;
 	for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); vRIt != validRegions[refIndex].end(); ++vRIt) {
-	  hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, vRIt->lower(), vRIt->upper());
-	  bam1_t* rec = bam_init1();
-	  while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
+	  OffsetReader reader;
+	  _offsetReaderOpen(reader, sh.samfile, sh.idx, refIndex, vRIt->lower(), vRIt->upper());
+	  while (_offsetReaderNext(reader, rec, voffset) >= 0) {
+	    ++nread;
+	    _assemblyRead(c, ar, rec, voffset);
+	    if (ar.indexed) _assemblyLookup(validRegions, chrMap, rec, lookups);
 
 	    // Keep secondary alignments
 	    if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP)) continue;
 	    if ((rec->core.qual < c.minMapQual) || (rec->core.tid<0)) continue;
+	    _alignmentJunctions(c, rec, taskBp[task]);
+	  }
+	  _offsetReaderClose(reader);
+	}
 
-	    std::size_t seed = hash_lr(rec);
-	    //std::cerr << bam_get_qname(rec) << '\t' << seed << std::endl;
-	    uint32_t rp = rec->core.pos; // reference pointer
-	    uint32_t sp = 0; // sequence pointer
-	    
-	    // Parse the CIGAR
-	    uint32_t* cigar = bam_get_cigar(rec);
-	    for (std::size_t i = 0; i < rec->core.n_cigar; ++i) {
-	      if ((bam_cigar_op(cigar[i]) == BAM_CMATCH) || (bam_cigar_op(cigar[i]) == BAM_CEQUAL) || (bam_cigar_op(cigar[i]) == BAM_CDIFF)) {
-		sp += bam_cigar_oplen(cigar[i]);
-		rp += bam_cigar_oplen(cigar[i]);
-	      } else if (bam_cigar_op(cigar[i]) == BAM_CDEL) {
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
-		rp += bam_cigar_oplen(cigar[i]);
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) { // Try look-ahead
-		  uint32_t spOrig = sp;
-		  uint32_t rpTmp = rp;
-		  uint32_t spTmp = sp;
-		  uint32_t dlen = bam_cigar_oplen(cigar[i]);
-		  for (std::size_t j = i + 1; j < rec->core.n_cigar; ++j) {
-		    if ((bam_cigar_op(cigar[j]) == BAM_CMATCH) || (bam_cigar_op(cigar[j]) == BAM_CEQUAL) || (bam_cigar_op(cigar[j]) == BAM_CDIFF)) {
-		      spTmp += bam_cigar_oplen(cigar[j]);
-		      rpTmp += bam_cigar_oplen(cigar[j]);
-		      if ((double) (spTmp - sp) / (double) (dlen + (rpTmp - rp)) > c.indelExtension) break;
-		    } else if (bam_cigar_op(cigar[j]) == BAM_CDEL) {
-		      rpTmp += bam_cigar_oplen(cigar[j]);
-		      if (bam_cigar_oplen(cigar[j]) > c.minRefSep) {
-			// Extend deletion
-			dlen += (rpTmp - rp);
-			rp = rpTmp;
-			sp = spTmp;
-			i = j;
-		      }
-		    } else if (bam_cigar_op(cigar[j]) == BAM_CINS) {
-		      if (bam_cigar_oplen(cigar[j]) > c.minRefSep) break; // No extension
-		      spTmp += bam_cigar_oplen(cigar[j]);
-		    } else break; // No extension
-		  }
-		  _insertJunction(readBp, seed, rec, rp, spOrig, true);
-		}
-	      } else if (bam_cigar_op(cigar[i]) == BAM_CINS) {
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
-		sp += bam_cigar_oplen(cigar[i]);
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) { // Try look-ahead
-		  uint32_t rpOrig = rp;
-		  uint32_t rpTmp = rp;
-		  uint32_t spTmp = sp;
-		  uint32_t ilen = bam_cigar_oplen(cigar[i]);
-		  for (std::size_t j = i + 1; j < rec->core.n_cigar; ++j) {
-		    if ((bam_cigar_op(cigar[j]) == BAM_CMATCH) || (bam_cigar_op(cigar[j]) == BAM_CEQUAL) || (bam_cigar_op(cigar[j]) == BAM_CDIFF)) {
-		      spTmp += bam_cigar_oplen(cigar[j]);
-		      rpTmp += bam_cigar_oplen(cigar[j]);
-		      if ((double) (rpTmp - rp) / (double) (ilen + (spTmp - sp)) > c.indelExtension) break;
-		    } else if (bam_cigar_op(cigar[j]) == BAM_CDEL) {
-		      if (bam_cigar_oplen(cigar[j]) > c.minRefSep) break; // No extension
-		      rpTmp += bam_cigar_oplen(cigar[j]);
-		    } else if (bam_cigar_op(cigar[j]) == BAM_CINS) {
-		      spTmp += bam_cigar_oplen(cigar[j]);
-		      if (bam_cigar_oplen(cigar[j]) > c.minRefSep) {
-			// Extend insertion
-			ilen += (spTmp - sp);
-			rp = rpTmp;
-			sp = spTmp;
-			i = j;
-		      }
-		    } else {
-		      break; // No extension
-		    }
-		  }
-		  _insertJunction(readBp, seed, rec, rpOrig, sp, true);
-		}
-	      } else if (bam_cigar_op(cigar[i]) == BAM_CREF_SKIP) {
-		rp += bam_cigar_oplen(cigar[i]);
-	      } else if ((bam_cigar_op(cigar[i]) == BAM_CSOFT_CLIP) || (bam_cigar_op(cigar[i]) == BAM_CHARD_CLIP)) {
-		int32_t finalsp = sp;
-		bool scleft = false;
-		if (sp == 0) {
-		  finalsp += bam_cigar_oplen(cigar[i]); // Leading soft-clip / hard-clip
-		  scleft = true;
-		}
-		sp += bam_cigar_oplen(cigar[i]);
-		//std::cerr << bam_get_qname(rec) << ',' << rp << ',' << finalsp << ',' << scleft << std::endl;
-		if (bam_cigar_oplen(cigar[i]) > c.minClip) _insertJunction(readBp, seed, rec, rp, finalsp, scleft);
-	      } else {
-		std::cerr << "Unknown Cigar options" << std::endl;
-	      }
-	    }
+	// Primary alignments in excluded gaps are still assembled, fetch them at their SA position
+	std::sort(lookups.begin(), lookups.end());
+	lookups.erase(std::unique(lookups.begin(), lookups.end(), _samePrimaryLookup), lookups.end());
+	for(uint32_t i = 0; ((ar.indexed) && (i < lookups.size())); ++i) {
+	  OffsetReader reader;
+	  _offsetReaderOpen(reader, sh.samfile, sh.idx, lookups[i].refIndex, lookups[i].pos, lookups[i].pos + 1);
+	  while (_offsetReaderNext(reader, rec, voffset) >= 0) {
+	    ++nread;
+	    if ((rec->core.pos != lookups[i].pos) || (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY))) continue;
+	    if (hash_lr(rec) != lookups[i].seed) continue;
+	    gapReads[task].push_back(std::make_pair((uint32_t) taskIndex[lookups[i].refIndex][file_c], std::make_pair(voffset, lookups[i].seed)));
+	    break;
 	  }
-	  bam_destroy1(rec);
-	  hts_itr_destroy(iter);
+	  _offsetReaderClose(reader);
 	}
+
+	// Offsets are bounded per sample, chromosomes beyond the budget are rescanned in assembly
+	bool overBudget = false;
+#pragma omp critical (asmbudget)
+	{
+	  if (sampleOffsets[file_c] + ar.offsets.size() > DELLY_ASSEMBLY_OFFSETS) overBudget = true;
+	  else sampleOffsets[file_c] += ar.offsets.size();
+	}
+	if (overBudget) _assemblyReadsDrop(ar);
+	else if (ar.indexed) {
+	  ar.seeds.reserve(taskBp[task].size());
+	  for(typename TReadBp::const_iterator it = taskBp[task].begin(); it != taskBp[task].end(); ++it) ar.seeds.push_back(it->first);
+	}
+	bam_destroy1(rec);
+	metricsReads(nread);
       }
+
+      _sampleHandleClose(sh);
+    }
+    if (failed) {
+      bam_hdr_destroy(hdr);
+      sam_close(samfile);
+      return false;
+    }
+
+    // Merge in task order, junctions of a read keep the order of the serial scan before sorting
+    typedef typename TReadBp::mapped_type TJunctionVector;
+    for(uint32_t task = 0; task < taskBp.size(); ++task) {
+      for(typename TReadBp::iterator it = taskBp[task].begin(); it != taskBp[task].end(); ++it) {
+	TJunctionVector& jv = readBp[it->first];
+	if (jv.empty()) jv.swap(it->second);
+	else jv.insert(jv.end(), it->second.begin(), it->second.end());
+      }
+      TReadBp().swap(taskBp[task]);
     }
 
     // Sort junctions
@@ -413,12 +508,20 @@ namespace torali
       std::sort(it->second.begin(), it->second.end(), SortJunction<Junction>());
     }
 
+    // Assembly reads in file order
+    for(uint32_t task = 0; task < gapReads.size(); ++task) {
+      for(uint32_t i = 0; i < gapReads[task].size(); ++i) {
+	AssemblyReads& ar = asmReads[gapReads[task][i].first];
+	if (ar.indexed) ar.offsets.push_back(gapReads[task][i].second);
+      }
+      std::vector<TGapRead>().swap(gapReads[task]);
+    }
+    for(uint32_t task = 0; task < asmReads.size(); ++task) _assemblyReadsFinalize(asmReads[task], readBp);
+
     // Clean-up
     bam_hdr_destroy(hdr);
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      hts_idx_destroy(idx[file_c]);
-      sam_close(samfile[file_c]);
-    }
+    sam_close(samfile);
+    return true;
   }
 
 
@@ -434,26 +537,27 @@ namespace torali
   }
 
   template<typename TConfig, typename TValidRegions, typename TSvtSRBamRecord>
-  inline void
-    _findSRBreakpoints(TConfig const& c, TValidRegions const& validRegions, TSvtSRBamRecord& srBR) {
+  inline bool
+    _findSRBreakpoints(TConfig const& c, TValidRegions const& validRegions, TSvtSRBamRecord& srBR, std::vector<AssemblyReads>& asmReads) {
     // Breakpoints
     typedef std::vector<Junction> TJunctionVector;
     typedef std::map<std::size_t, TJunctionVector> TReadBp;
     TReadBp readBp;
-    findJunctions(c, validRegions, readBp);
+    if (!findJunctions(c, validRegions, readBp, asmReads)) return false;
     fetchSVs(c, readBp, srBR);
+    return true;
   }
 
 
   template<typename TConfig, typename TValidRegions, typename TSVs, typename TSRStore>
-  inline void
-  _clusterSRReads(TConfig const& c, TValidRegions const& validRegions, TSVs& svc, TSRStore& srStore) {
+  inline bool
+  _clusterSRReads(TConfig const& c, TValidRegions const& validRegions, TSVs& svc, TSRStore& srStore, std::vector<AssemblyReads>& asmReads) {
     typedef typename TSRStore::mapped_type TSvPosVector;
     // Split-reads
     typedef std::vector<SRBamRecord> TSRBamRecord;
     typedef std::vector<TSRBamRecord> TSvtSRBamRecord;
     TSvtSRBamRecord srBR(2 * DELLY_SVT_TRANS, TSRBamRecord());
-    _findSRBreakpoints(c, validRegions, srBR);
+    if (!_findSRBreakpoints(c, validRegions, srBR, asmReads)) return false;
 	 	 
     // Debug
     //outputSRBamRecords(c, srBR);
@@ -480,6 +584,11 @@ namespace torali
 	}
       }
     }
+
+    // Assembly only needs the primary alignments of clustered split-reads
+    for(uint32_t task = 0; task < asmReads.size(); ++task) _assemblyReadsFinalize(asmReads[task], srStore);
+    _assemblyReadsComplete(c.files.size(), asmReads, srStore);
+    return true;
   }
 
 
@@ -519,6 +628,7 @@ namespace torali
     TIndex idx(c.files.size());
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
+      ioThreadsAttach(samfile[file_c]);
       hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
       idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
     }
@@ -527,7 +637,9 @@ namespace torali
       for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
 	hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, 0, hdr->target_len[refIndex]);
 	bam1_t* rec = bam_init1();
+	uint64_t nread = 0;
 	while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
+	  ++nread;
 	  if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
 	  std::size_t seed = hash_lr(rec);
 	  std::string qname = bam_get_qname(rec);
@@ -539,6 +651,7 @@ namespace torali
 	  }
 	}
 	bam_destroy1(rec);
+	metricsReads(nread);
 	hts_itr_destroy(iter);
       }
     }
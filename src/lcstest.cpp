@@ -0,0 +1,116 @@
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#define BOOST_DISABLE_ASSERTS
+
+#include "util.h"
+#include "msa.h"
+
+using namespace torali;
+
+// Bit-parallel LCS against the quadratic dynamic program it replaced, lengths around 64 and 128 exercise the carry across words
+
+
+inline int32_t
+_lcsDP(std::string const& s1, std::string const& s2) {
+  uint32_t m = s1.size();
+  uint32_t n = s2.size();
+  int32_t prevdiag = 0;
+  int32_t prevprevdiag = 0;
+  std::vector<int32_t> onecol(n+1, 0);
+  for(uint32_t i = 0; i <= m; ++i) {
+    for(uint32_t j = 0; j <= n; ++j) {
+      if ((i==0) || (j==0)) {
+	onecol[j] = 0;
+	prevprevdiag = 0;
+	prevdiag = 0;
+      } else {
+	prevprevdiag = prevdiag;
+	prevdiag = onecol[j];
+	if (s1[i-1] == s2[j-1]) onecol[j] = prevprevdiag + 1;
+	else onecol[j] = (onecol[j] > onecol[j-1]) ? onecol[j] : onecol[j-1];
+      }
+    }
+  }
+  return onecol[n];
+}
+
+inline std::string
+_randomRead(int32_t const len) {
+  std::string s;
+  for(int32_t i = 0; i < len; ++i) s.push_back("ACGTN"[std::rand() % 5]);
+  return s;
+}
+
+// Split-read subsequences of one SV are near-identical
+inline std::string
+_mutateRead(std::string const& s) {
+  std::string t;
+  for(uint32_t i = 0; i < s.size(); ++i) {
+    int32_t r = std::rand() % 100;
+    if (r < 3) t.push_back("ACGT"[std::rand() % 4]);
+    else if (r < 5) continue;
+    else if (r < 7) {
+      t.push_back(s[i]);
+      t.push_back("ACGT"[std::rand() % 4]);
+    } else t.push_back(s[i]);
+  }
+  return t;
+}
+
+// Word boundaries of the bit-vector or any length up to 400bp
+inline int32_t
+_randomLength() {
+  static int32_t const edge[] = {1, 63, 64, 65, 127, 128, 129, 191, 192, 193, 255, 256, 257};
+  if (std::rand() % 4 == 0) return edge[std::rand() % 13];
+  return 1 + std::rand() % 400;
+}
+
+
+int main(int argc, char **argv) {
+  uint32_t ncases = 20000;
+  uint32_t seed = 1;
+  if (argc > 1) ncases = std::atoi(argv[1]);
+  if (argc > 2) seed = std::atoi(argv[2]);
+  std::srand(seed);
+
+  // Inputs
+  std::vector<std::pair<std::string, std::string> > pairs;
+  for(uint32_t i = 0; i < ncases; ++i) {
+    std::string s1 = _randomRead(_randomLength());
+    std::string s2;
+    if (std::rand() % 2) s2 = _mutateRead(s1);
+    else s2 = _randomRead(_randomLength());
+    pairs.push_back(std::make_pair(s1, s2));
+  }
+  pairs.push_back(std::make_pair(std::string(), std::string("ACGT")));
+  pairs.push_back(std::make_pair(std::string(200, 'A'), std::string(200, 'A')));
+  pairs.push_back(std::make_pair(std::string(200, 'A'), std::string(200, 'C')));
+
+  // Equivalence
+  uint32_t mismatches = 0;
+  for(uint32_t i = 0; i < pairs.size(); ++i) {
+    if (lcs(pairs[i].first, pairs[i].second) != _lcsDP(pairs[i].first, pairs[i].second)) {
+      if (!mismatches) std::cerr << "Mismatch: " << pairs[i].first << ' ' << pairs[i].second << std::endl;
+      ++mismatches;
+    }
+  }
+
+  // Timings
+  int64_t sumBit = 0;
+  std::clock_t start = std::clock();
+  for(uint32_t i = 0; i < pairs.size(); ++i) sumBit += lcs(pairs[i].first, pairs[i].second);
+  double tBit = (double) (std::clock() - start) / CLOCKS_PER_SEC;
+  int64_t sumDP = 0;
+  start = std::clock();
+  for(uint32_t i = 0; i < pairs.size(); ++i) sumDP += _lcsDP(pairs[i].first, pairs[i].second);
+  double tDP = (double) (std::clock() - start) / CLOCKS_PER_SEC;
+  if (sumBit != sumDP) ++mismatches;
+
+  std::cout << pairs.size() << " pairs, " << mismatches << " mismatches" << std::endl;
+  std::cout << "Bit-parallel: " << tBit << "s, DP: " << tDP << "s" << std::endl;
+  return (mismatches == 0) ? 0 : 1;
+}
@@ -32,6 +32,8 @@
 #include "version.h"
 #include "util.h"
 #include "modvcf.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 
 namespace torali
@@ -50,6 +52,8 @@ struct MergeConfig {
   float recoverlap;
   float vaf;
   boost::filesystem::path outfile;
+  boost::filesystem::path metricsfile;
+  int32_t iothreads;
   std::vector<boost::filesystem::path> files;
 };
 
@@ -83,8 +87,9 @@ double recOverlap(TPos const s1, TPos const e1, TPos const s2, TPos const e2) {
 }
 
 
-template<typename TGenomeIntervals, typename TContigMap>
-void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap& cMap, int32_t const svtin) {
+template<typename TSvtGenomeIntervals, typename TContigMap>
+void _fillIntervalMap(MergeConfig const& c, TSvtGenomeIntervals& iScore, TContigMap& cMap) {
+  typedef typename TSvtGenomeIntervals::value_type TGenomeIntervals;
   typedef typename TGenomeIntervals::value_type TIntervalScores;
   typedef typename TIntervalScores::value_type IntervalScore;
 
@@ -97,6 +102,7 @@ void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap
   for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
     ++show_progress;
     htsFile* ifile = bcf_open(c.files[file_c].string().c_str(), "r");
+    ioThreadsAttach(ifile);
     bcf_hdr_t* hdr = bcf_hdr_read(ifile);
     bcf1_t* rec = bcf_init();
 
@@ -108,7 +114,9 @@ void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap
     char* ct = NULL;
     int32_t nsvt = 0;
     char* svt = NULL;
+    uint64_t nread = 0;
     while (bcf_read(ifile, hdr, rec) == 0) {
+      ++nread;
       bcf_unpack(rec, BCF_UN_INFO);
       // Check PASS
       bool pass = true;
@@ -118,7 +126,7 @@ void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap
       // Correct SV type
       int32_t recsvt = -1;
       if ((bcf_get_info_string(hdr, rec, "SVTYPE", &svt, &nsvt) > 0) && (bcf_get_info_string(hdr, rec, "CT", &ct, &nct) > 0)) recsvt = _decodeOrientation(std::string(ct), std::string(svt));
-      if (recsvt != svtin) continue;
+      if ((recsvt < 0) || (recsvt >= (int32_t) iScore.size())) continue;
 
       // Correct size?
       std::string chrName(bcf_hdr_id2name(hdr, rec->rid));
@@ -186,8 +194,9 @@ void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap
 	if ((maxvaf < c.vaf) || (maxcov < c.coverage)) continue;
       }
       // Store the interval
-      iScore[tid].push_back(IntervalScore(svStart, svEnd, rec->qual));
+      iScore[recsvt][tid].push_back(IntervalScore(svStart, svEnd, rec->qual));
     }
+    metricsReads(nread);
     if (svend != NULL) free(svend);
     if (inslen != NULL) free(inslen);
     if (ct != NULL) free(ct);
@@ -198,49 +207,76 @@ void _fillIntervalMap(MergeConfig const& c, TGenomeIntervals& iScore, TContigMap
   }
 }
 
-template<typename TGenomeIntervals>
-void _processIntervalMap(MergeConfig const& c, TGenomeIntervals const& iScore, TGenomeIntervals& iSelected, int32_t const svtin) {
+template<typename TIntervalScores>
+void _processIntervals(MergeConfig const& c, TIntervalScores const& iScore, TIntervalScores& iSelected, int32_t const svtin) {
+  typedef typename TIntervalScores::value_type IntervalScore;
+  typedef std::vector<bool> TIntervalSelector;
+  TIntervalSelector keepInterval;
+  keepInterval.resize(iScore.size(), true);
+  typename TIntervalSelector::iterator iK = keepInterval.begin();
+  for(typename TIntervalScores::const_iterator iS = iScore.begin(); iS != iScore.end(); ++iS, ++iK) {
+    typename TIntervalScores::const_iterator iSNext = iS;
+    typename TIntervalSelector::iterator iKNext = iK;
+    ++iSNext; ++iKNext;
+    for(; iSNext != iScore.end(); ++iSNext, ++iKNext) {
+      if (iSNext->start - iS->start > c.bpoffset) break;
+      else {
+	if (((iSNext->end > iS->end) && (iSNext->end - iS->end < c.bpoffset)) || ((iSNext->end <= iS->end) &&(iS->end - iSNext->end < c.bpoffset))) {
+	  if ((_translocation(svtin)) || (recOverlap(iS->start, iS->end, iSNext->start, iSNext->end) >= c.recoverlap)) {
+	    if (iS->score < iSNext->score) *iK = false;
+	    else if (iSNext ->score < iS->score) *iKNext = false;
+	    else {
+	      if (iS->start < iSNext->start) *iKNext = false;
+	      else if (iS->end < iSNext->end) *iKNext = false;
+	      else *iK = false;
+	    }
+	  }
+	}
+      }
+    }
+    if (*iK) iSelected.push_back(IntervalScore(iS->start, iS->end, iS->score));
+  }
+}
+
+template<typename TSvtGenomeIntervals>
+void _processIntervalMap(MergeConfig const& c, TSvtGenomeIntervals& iScore, TSvtGenomeIntervals& iSelected) {
+  typedef typename TSvtGenomeIntervals::value_type TGenomeIntervals;
   typedef typename TGenomeIntervals::value_type TIntervalScores;
   typedef typename TIntervalScores::value_type IntervalScore;
 
   boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
   std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Merging SVs" << std::endl;
-  boost::progress_display show_progress( iScore.size() );
 
-  unsigned int seqId = 0;
-  for(typename TGenomeIntervals::const_iterator iG = iScore.begin(); iG != iScore.end(); ++iG, ++seqId) {
-    ++show_progress;
-    typedef std::vector<bool> TIntervalSelector;
-    TIntervalSelector keepInterval;
-    keepInterval.resize(iG->size(), true);
-    typename TIntervalSelector::iterator iK = keepInterval.begin();
-    for(typename TIntervalScores::const_iterator iS = iG->begin(); iS != iG->end(); ++iS, ++iK) {
-      typename TIntervalScores::const_iterator iSNext = iS;
-      typename TIntervalSelector::iterator iKNext = iK;
-      ++iSNext; ++iKNext;
-      for(; iSNext != iG->end(); ++iSNext, ++iKNext) {
-	if (iSNext->start - iS->start > c.bpoffset) break;
-	else {
-	  if (((iSNext->end > iS->end) && (iSNext->end - iS->end < c.bpoffset)) || ((iSNext->end <= iS->end) &&(iS->end - iSNext->end < c.bpoffset))) {
-	    if ((_translocation(svtin)) || (recOverlap(iS->start, iS->end, iSNext->start, iSNext->end) >= c.recoverlap)) {
-	      if (iS->score < iSNext->score) *iK = false;
-	      else if (iSNext ->score < iS->score) *iKNext = false;
-	      else {
-		if (iS->start < iSNext->start) *iKNext = false;
-		else if (iS->end < iSNext->end) *iKNext = false;
-		else *iK = false;
-	      }
-	    }
-	  }
-	}
-      }
-      if (*iK) iSelected[seqId].push_back(IntervalScore(iS->start, iS->end, iS->score));
+  // One task per SV type and chromosome
+  typedef std::pair<int32_t, uint32_t> TSvtSeq;
+  std::vector<TSvtSeq> tasks;
+  iSelected.resize(iScore.size(), TGenomeIntervals());
+  for(int32_t svt = 0; svt < (int32_t) iScore.size(); ++svt) {
+    iSelected[svt].resize(iScore[svt].size(), TIntervalScores());
+    for(uint32_t seqId = 0; seqId < iScore[svt].size(); ++seqId) {
+      if (!iScore[svt][seqId].empty()) tasks.push_back(std::make_pair(svt, seqId));
+    }
+  }
+  boost::progress_display show_progress( tasks.size() );
+
+#pragma omp parallel for schedule(dynamic)
+  for(int32_t k = 0; k < (int32_t) tasks.size(); ++k) {
+    int32_t svt = tasks[k].first;
+    uint32_t seqId = tasks[k].second;
+    std::sort(iScore[svt][seqId].begin(), iScore[svt][seqId].end(), SortIScores<IntervalScore>());
+    _processIntervals(c, iScore[svt][seqId], iSelected[svt][seqId], svt);
+    TIntervalScores().swap(iScore[svt][seqId]);
+    std::sort(iSelected[svt][seqId].begin(), iSelected[svt][seqId].end(), SortIScores<IntervalScore>());
+#pragma omp critical
+    {
+      ++show_progress;
     }
   }
 }
 
-template<typename TGenomeIntervals, typename TContigMap>
-void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected, TContigMap& cMap, int32_t const svtin) {
+template<typename TSvtGenomeIntervals, typename TContigMap>
+void _outputSelectedIntervals(MergeConfig& c, TSvtGenomeIntervals const& iSelected, TContigMap& cMap) {
+  typedef typename TSvtGenomeIntervals::value_type TGenomeIntervals;
   typedef typename TGenomeIntervals::value_type TIntervalScores;
   typedef typename TIntervalScores::value_type IntervalScore;
 
@@ -249,6 +285,7 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
 
   // Open output VCF file
   htsFile *fp = hts_open(c.outfile.string().c_str(), "wb");
+  ioThreadsAttach(fp);
   bcf_hdr_t *hdr_out = bcf_hdr_init("w");
 
   // Write VCF header
@@ -300,7 +337,7 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
   typedef std::pair<uint32_t, uint32_t> TStartEnd;
   typedef std::set<TStartEnd> TIntervalSet;
   typedef std::vector<TIntervalSet> TGenomicIntervalSet;
-  TGenomicIntervalSet gis(numseq);
+  std::vector<TGenomicIntervalSet> gis(iSelected.size(), TGenomicIntervalSet(numseq));
 
   // Parse input VCF files
   bcf1_t *rout = bcf_init();
@@ -313,8 +350,10 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
   TBcfRecord rec(c.files.size());
   TEof eof(c.files.size());
   uint32_t allEOF = 0;
+  uint64_t nwritten = 0;
   for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
     ifile[file_c] = bcf_open(c.files[file_c].string().c_str(), "r");
+    ioThreadsAttach(ifile[file_c]);
     hdr[file_c] = bcf_hdr_read(ifile[file_c]);
     if (bcf_hdr_set_samples(hdr[file_c], NULL, false) != 0) std::cerr << "Error: Failed to set sample information!" << std::endl;
     rec[file_c] = bcf_init();
@@ -371,7 +410,7 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
     // Correct SV type
     int32_t recsvt = -1;
     if ((bcf_get_info_string(hdr[idx], rec[idx], "SVTYPE", &svt, &nsvt) > 0) && (bcf_get_info_string(hdr[idx], rec[idx], "CT", &ct, &nct) > 0)) recsvt = _decodeOrientation(std::string(ct), std::string(svt));
-    if (recsvt == svtin) {
+    if ((recsvt >= 0) && (recsvt < (int32_t) iSelected.size())) {
       // Check PASS
       bool pass = true;
       if (c.filterForPass) pass = (bcf_has_filter(hdr[idx], rec[idx], const_cast<char*>("PASS"))==1);
@@ -417,14 +456,15 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
 	  int32_t score = rec[idx]->qual;
 	  
 	  // Is this a selected interval
-	  typename TIntervalScores::const_iterator iter = std::lower_bound(iSelected[tid].begin(), iSelected[tid].end(), IntervalScore(svStart, svEnd, score), SortIScores<IntervalScore>());
+	  TIntervalScores const& selected = iSelected[recsvt][tid];
+	  typename TIntervalScores::const_iterator iter = std::lower_bound(selected.begin(), selected.end(), IntervalScore(svStart, svEnd, score), SortIScores<IntervalScore>());
 	  bool foundInterval = false;
-	  for(; (iter != iSelected[tid].end()) && (iter->start == svStart); ++iter) {
+	  for(; (iter != selected.end()) && (iter->start == svStart); ++iter) {
 	    if ((iter->start == svStart) && (iter->end == svEnd) && (iter->score == score)) {
 	      // Duplicate?
-	      if (gis[tid].find(std::make_pair(svStart, svEnd)) == gis[tid].end()) {
+	      if (gis[recsvt][tid].find(std::make_pair(svStart, svEnd)) == gis[recsvt][tid].end()) {
 		foundInterval = true;
-		gis[tid].insert(std::make_pair(svStart, svEnd));
+		gis[recsvt][tid].insert(std::make_pair(svStart, svEnd));
 	      }
 	      break;
 	    }
@@ -452,7 +492,7 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
 	    std::string id;
 	    if (c.files.size() == 1) id = std::string(rec[idx]->d.id); // Within one VCF file IDs are unique
 	    else {
-	      id += _addID(svtin);
+	      id += _addID(recsvt);
 	      std::string padNumber = boost::lexical_cast<std::string>(c.svcounter++);
 	      padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
 	      id += padNumber;
@@ -468,22 +508,22 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
 	    // Add INFO fields
 	    if (precise) bcf_update_info_flag(hdr_out, rout, "PRECISE", NULL, 1);
 	    else bcf_update_info_flag(hdr_out, rout, "IMPRECISE", NULL, 1);
-	    bcf_update_info_string(hdr_out, rout, "SVTYPE", _addID(svtin).c_str());
+	    bcf_update_info_string(hdr_out, rout, "SVTYPE", _addID(recsvt).c_str());
 	    std::string dellyVersion("EMBL.DELLYv");
 	    dellyVersion += dellyVersionNumber;
 	    bcf_update_info_string(hdr_out,rout, "SVMETHOD", dellyVersion.c_str());
 	    bcf_update_info_int32(hdr_out, rout, "END", &svEnd, 1);
-	    if (svtin >= DELLY_SVT_TRANS) {
+	    if (recsvt >= DELLY_SVT_TRANS) {
 	      bcf_update_info_string(hdr_out,rout, "CHR2", chr2Name.c_str());
 	      bcf_update_info_int32(hdr_out, rout, "POS2", &pos2val, 1);
 	    }
-	    if (svtin == 4) {
+	    if (recsvt == 4) {
 	      bcf_update_info_int32(hdr_out, rout, "SVLEN", &inslenVal, 1);
 	    }
 	    bcf_update_info_int32(hdr_out, rout, "PE", &peSupport, 1);
 	    int32_t tmpi = peMapQuality;
 	    bcf_update_info_int32(hdr_out, rout, "MAPQ", &tmpi, 1);
-	    bcf_update_info_string(hdr_out, rout, "CT", _addOrientation(svtin).c_str());
+	    bcf_update_info_string(hdr_out, rout, "CT", _addOrientation(recsvt).c_str());
 	    bcf_update_info_int32(hdr_out, rout, "CIPOS", cipos, 2);
 	    bcf_update_info_int32(hdr_out, rout, "CIEND", ciend, 2);
 	    if (precise) {
@@ -501,7 +541,8 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
 	
 	    // Write record
 	    bcf_write1(fp, hdr_out, rout);
-	    bcf_clear1(rout);	  
+	    bcf_clear1(rout);
+	    ++nwritten;	  
 	    //std::cerr << bcf_hdr_id2name(hdr[idx], tid) << '\t' << svStart << '\t' << svEnd << std::endl;
 	  }
 	}
@@ -531,6 +572,7 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
   if (ciend != NULL) free(ciend);
   if (ce != NULL) free(ce);
   if (cons != NULL) free(cons);
+  metricsRecords(nwritten);
 
   // Clean-up
   for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
@@ -548,83 +590,8 @@ void _outputSelectedIntervals(MergeConfig& c, TGenomeIntervals const& iSelected,
   bcf_index_build(c.outfile.string().c_str(), 14);
 }
 
-inline void
-mergeBCFs(MergeConfig& c, std::vector<boost::filesystem::path> const& cts) {
-  boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
-  std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Merging SV types" << std::endl;
-  boost::progress_display show_progress( 1 );
-
-  // Parse temporary input VCF files
-  typedef std::vector<htsFile*> THtsFile;
-  typedef std::vector<bcf_hdr_t*> TBcfHeader;
-  typedef std::vector<bcf1_t*> TBcfRecord;
-  typedef std::vector<bool> TEof;
-  THtsFile ifile(cts.size());
-  TBcfHeader hdr(cts.size());
-  TBcfRecord rec(cts.size());
-  TEof eof(cts.size());
-  uint32_t allEOF = 0;
-  for(unsigned int file_c = 0; file_c < cts.size(); ++file_c) {
-    ifile[file_c] = bcf_open(cts[file_c].string().c_str(), "r");
-    hdr[file_c] = bcf_hdr_read(ifile[file_c]);
-    rec[file_c] = bcf_init();
-    if (bcf_read(ifile[file_c], hdr[file_c], rec[file_c]) == 0) {
-      bcf_unpack(rec[file_c], BCF_UN_INFO);
-      eof[file_c] = false;
-    } else {
-      ++allEOF;
-      eof[file_c] = true;
-    }
-  }
-
-  // Open output VCF file
-  htsFile *fp = hts_open(c.outfile.string().c_str(), "wb");
-  bcf_hdr_t *hdr_out = bcf_hdr_dup(hdr[0]);
-  if (bcf_hdr_write(fp, hdr_out) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
-
-  // Merge files
-  while (allEOF < cts.size()) {
-    // Find next sorted record
-    int32_t idx = -1;
-    for(unsigned int file_c = 0; file_c < cts.size(); ++file_c) {
-      if (!eof[file_c]) {
-	if ((idx < 0) || (rec[idx]->rid > rec[file_c]->rid) || ((rec[idx]->rid == rec[file_c]->rid) && (rec[idx]->pos > rec[file_c]->pos))) idx = file_c;
-      }
-    }
-
-    // Write record
-    bcf_write1(fp, hdr_out, rec[idx]);
-
-    // Fetch next record
-    if (bcf_read(ifile[idx], hdr[idx], rec[idx]) == 0) bcf_unpack(rec[idx], BCF_UN_INFO);
-    else {
-      ++allEOF;
-      eof[idx] = true;
-    }
-  }
-  ++show_progress;
-  
-  // Clean-up
-  for(unsigned int file_c = 0; file_c < cts.size(); ++file_c) {
-    bcf_hdr_destroy(hdr[file_c]);
-    bcf_close(ifile[file_c]);
-    bcf_destroy(rec[file_c]);
-  }
-
-  // Close VCF file
-  bcf_hdr_destroy(hdr_out);
-  hts_close(fp);
-
-  // Build index
-  bcf_index_build(c.outfile.string().c_str(), 14);
-
-  // End
-  now = boost::posix_time::second_clock::local_time();
-  std::cout << '[' << boost::posix_time::to_simple_string(now) << "] Done." << std::endl;
-}
-
 inline int
-mergeRun(MergeConfig& c, int32_t const svt) {
+mergeRun(MergeConfig& c) {
 
   // All files may use a different set of chromosomes
   typedef std::map<std::string, uint32_t> TContigMap;
@@ -632,6 +599,7 @@ mergeRun(MergeConfig& c, int32_t const svt) {
   uint32_t numseq = 0;
   for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
     htsFile* ifile = bcf_open(c.files[file_c].string().c_str(), "r");
+    ioThreadsAttach(ifile);
     bcf_hdr_t* hdr = bcf_hdr_read(ifile);
     int nseq=0;
     const char** seqnames = bcf_hdr_seqnames(hdr, &nseq);
@@ -644,23 +612,26 @@ mergeRun(MergeConfig& c, int32_t const svt) {
     bcf_close(ifile);
   }
 
-  // Interval maps
+  // Interval maps, bucketed by SV type so every input is read once
   typedef std::vector<IntervalScore> TIntervalScores;
   typedef std::vector<TIntervalScores> TGenomeIntervals;
-  TGenomeIntervals iScore;
-  iScore.resize(numseq, TIntervalScores());
-  _fillIntervalMap(c, iScore, contigMap, svt);
-  for(uint32_t i = 0; i<numseq; ++i) std::sort(iScore[i].begin(), iScore[i].end(), SortIScores<IntervalScore>());
+  typedef std::vector<TGenomeIntervals> TSvtGenomeIntervals;
+  TSvtGenomeIntervals iScore(9, TGenomeIntervals(numseq, TIntervalScores()));
+  int32_t stage = metricsStart("intervals");
+  _fillIntervalMap(c, iScore, contigMap);
+  metricsStop(stage);
 
   // Filter intervals
-  TGenomeIntervals iSelected;
-  iSelected.resize(numseq, TIntervalScores());
-  _processIntervalMap(c, iScore, iSelected, svt);
+  TSvtGenomeIntervals iSelected;
+  stage = metricsStart("select");
+  _processIntervalMap(c, iScore, iSelected);
   iScore.clear();
-  for(uint32_t i = 0; i<numseq; ++i) std::sort(iSelected[i].begin(), iSelected[i].end(), SortIScores<IntervalScore>());
+  metricsStop(stage);
 
   // Output best intervals
-  _outputSelectedIntervals(c, iSelected, contigMap, svt);
+  stage = metricsStart("output");
+  _outputSelectedIntervals(c, iSelected, contigMap);
+  metricsStop(stage);
 
   // End
   boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
@@ -685,6 +656,8 @@ int merge(int argc, char **argv) {
     ("maxsize,n", boost::program_options::value<uint32_t>(&c.maxsize)->default_value(1000000), "max. SV size")
     ("precise,c", "Filter sites for PRECISE")
     ("pass,p", "Filter sites for PASS")
+    ("metrics", boost::program_options::value<boost::filesystem::path>(&c.metricsfile), "per-stage JSON metrics report (optional)")
+    ("io-threads", boost::program_options::value<int32_t>(&c.iothreads)->default_value(0), "additional threads for BAM/CRAM/BCF (de)compression")
     ;
 
   // Define overlap options
@@ -728,6 +701,15 @@ int merge(int argc, char **argv) {
   if (vm.count("precise")) c.filterForPrecise = true;
   else c.filterForPrecise = false;
 
+  // Per-stage metrics?
+  if (vm.count("metrics")) {
+    if (!_outfileValid(c.metricsfile)) return 1;
+    metricsEnable("merge", c.metricsfile);
+  }
+  
+  // Shared I/O thread pool
+  if (!ioThreadsEnable(c.iothreads)) return 1;
+
   // Show cmd
   boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
   std::cout << '[' << boost::posix_time::to_simple_string(now) << "] ";
@@ -797,57 +779,48 @@ int merge(int argc, char **argv) {
   }
   
   // Run merging
-  boost::filesystem::path oldPath = c.outfile;
-  std::vector<boost::filesystem::path> svtCollect(9);
-  for(int32_t svt = 0; svt < 9; ++svt) {
-    boost::uuids::uuid uuid = boost::uuids::random_generator()();
-    std::string filename = "svt" + boost::lexical_cast<std::string>(svt) + "_" + boost::lexical_cast<std::string>(uuid) + ".bcf";
-    svtCollect[svt] = filename;
-    if (c.files.size() <= c.chunksize) {
-      // Merge in one go
-      c.outfile = svtCollect[svt];
-      mergeRun(c, svt);
-    } else {
-      // Merge in chunks
-      std::vector<boost::filesystem::path> fileRestore = c.files;
-      uint32_t chunks = ((c.files.size() - 1) / c.chunksize) + 1;
-      std::vector<boost::filesystem::path> chunkCollect(chunks);
-      for(uint32_t ic = 0; ic < chunks; ++ic) {
-	boost::uuids::uuid uuid = boost::uuids::random_generator()();
-	std::string chunkfile = "chunk" + boost::lexical_cast<std::string>(ic) + "_" + boost::lexical_cast<std::string>(uuid) + ".bcf";
-	chunkCollect[ic] = chunkfile;
-	c.files.clear();
-	for(uint32_t k = ic * c.chunksize; ((k < ((ic+1) * c.chunksize)) && (k < fileRestore.size())); ++k) c.files.push_back(fileRestore[k]);
-	c.outfile = chunkCollect[ic];
-	mergeRun(c, svt);
-      }
-      // Merge chunks
-      c.files = chunkCollect;
-      c.outfile = svtCollect[svt];
-      // Reset VAF and coverage because these are site lists!
-      float vafStore = c.vaf;
-      uint32_t coverageStore = c.coverage;
-      c.vaf = 0;
-      c.coverage = 0;
-      mergeRun(c, svt);
-      c.vaf = vafStore;
-      c.coverage = coverageStore;
-      // Clean-up
-      for(uint32_t ic = 0; ic < chunks; ++ic) {
-	boost::filesystem::remove(chunkCollect[ic]);
-	boost::filesystem::remove(boost::filesystem::path(chunkCollect[ic].string() + ".csi"));
-      }
-      c.files = fileRestore;
+  if (c.files.size() <= c.chunksize) {
+    // Merge in one go
+    mergeRun(c);
+  } else {
+    // Merge in chunks
+    boost::filesystem::path oldPath = c.outfile;
+    std::vector<boost::filesystem::path> fileRestore = c.files;
+    uint32_t chunks = ((c.files.size() - 1) / c.chunksize) + 1;
+    std::vector<boost::filesystem::path> chunkCollect(chunks);
+    for(uint32_t ic = 0; ic < chunks; ++ic) {
+      boost::uuids::uuid uuid = boost::uuids::random_generator()();
+      std::string chunkfile = "chunk" + boost::lexical_cast<std::string>(ic) + "_" + boost::lexical_cast<std::string>(uuid) + ".bcf";
+      chunkCollect[ic] = chunkfile;
+      c.files.clear();
+      for(uint32_t k = ic * c.chunksize; ((k < ((ic+1) * c.chunksize)) && (k < fileRestore.size())); ++k) c.files.push_back(fileRestore[k]);
+      c.outfile = chunkCollect[ic];
+      mergeRun(c);
     }
+    // Merge chunks
+    c.files = chunkCollect;
+    c.outfile = oldPath;
+    // Reset VAF and coverage because these are site lists!
+    float vafStore = c.vaf;
+    uint32_t coverageStore = c.coverage;
+    c.vaf = 0;
+    c.coverage = 0;
+    mergeRun(c);
+    c.vaf = vafStore;
+    c.coverage = coverageStore;
+    // Clean-up
+    for(uint32_t ic = 0; ic < chunks; ++ic) {
+      boost::filesystem::remove(chunkCollect[ic]);
+      boost::filesystem::remove(boost::filesystem::path(chunkCollect[ic].string() + ".csi"));
+    }
+    c.files = fileRestore;
   }
-  
-  // Merge temporary files
-  c.outfile = oldPath;
-  mergeBCFs(c, svtCollect);
-  for(int32_t svt = 0; svt < 9; ++svt) {
-    boost::filesystem::remove(svtCollect[svt]);
-    boost::filesystem::remove(boost::filesystem::path(svtCollect[svt].string() + ".csi"));
-  }
+
+  // All files are closed
+  ioThreadsDestroy();
+
+  // Metrics report, covers all chunk runs
+  if (!metricsWrite()) return 1;
   return 0;
 }
 
@@ -0,0 +1,192 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+namespace torali
+{
+
+  // Counter totals and resource usage at a point in time
+  struct MetricsSnapshot {
+    boost::posix_time::ptime wall;
+    double cpu;
+    int64_t peakRss;
+    uint64_t reads;
+    uint64_t records;
+    uint64_t alignments;
+
+    MetricsSnapshot() : cpu(0), peakRss(0), reads(0), records(0), alignments(0) {}
+  };
+
+  struct StageMetrics {
+    bool done;
+    std::string name;
+    MetricsSnapshot begin;
+    MetricsSnapshot end;
+
+    StageMetrics() : done(false) {}
+  };
+
+  struct MetricsRegistry {
+    bool enabled;
+    std::string command;
+    boost::filesystem::path outfile;
+    uint64_t reads;
+    uint64_t records;
+    uint64_t alignments;
+    MetricsSnapshot begin;
+    std::vector<StageMetrics> stages;
+
+    MetricsRegistry() : enabled(false), reads(0), records(0), alignments(0) {}
+  };
+
+  inline MetricsRegistry&
+  _metrics() {
+    static MetricsRegistry m;
+    return m;
+  }
+
+  inline void
+  _metricsSnapshot(MetricsSnapshot& snap) {
+    MetricsRegistry& m = _metrics();
+    snap.wall = boost::posix_time::microsec_clock::universal_time();
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+      snap.cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000000.0;
+      snap.peakRss = ru.ru_maxrss;
+    }
+#pragma omp critical (metrics)
+    {
+      snap.reads = m.reads;
+      snap.records = m.records;
+      snap.alignments = m.alignments;
+    }
+  }
+
+  // Enable metrics collection, the report is written by metricsWrite
+  inline void
+  metricsEnable(std::string const& command, boost::filesystem::path const& outfile) {
+    MetricsRegistry& m = _metrics();
+    m.enabled = true;
+    m.command = command;
+    m.outfile = outfile;
+    _metricsSnapshot(m.begin);
+  }
+
+  // Counters are updated once per chunk of work, not per read
+  inline void
+  metricsReads(uint64_t const n) {
+    MetricsRegistry& m = _metrics();
+    if ((!m.enabled) || (!n)) return;
+#pragma omp critical (metrics)
+    m.reads += n;
+  }
+
+  inline void
+  metricsRecords(uint64_t const n) {
+    MetricsRegistry& m = _metrics();
+    if ((!m.enabled) || (!n)) return;
+#pragma omp critical (metrics)
+    m.records += n;
+  }
+
+  inline void
+  metricsAlignments(uint64_t const n) {
+    MetricsRegistry& m = _metrics();
+    if ((!m.enabled) || (!n)) return;
+#pragma omp critical (metrics)
+    m.alignments += n;
+  }
+
+  // Stages are opened and closed by the (single-threaded) driver of each command
+  inline int32_t
+  metricsStart(std::string const& name) {
+    MetricsRegistry& m = _metrics();
+    if (!m.enabled) return -1;
+    m.stages.push_back(StageMetrics());
+    m.stages.back().name = name;
+    _metricsSnapshot(m.stages.back().begin);
+    return m.stages.size() - 1;
+  }
+
+  inline void
+  metricsStop(int32_t const idx) {
+    MetricsRegistry& m = _metrics();
+    if ((!m.enabled) || (idx < 0) || (idx >= (int32_t) m.stages.size())) return;
+    _metricsSnapshot(m.stages[idx].end);
+    m.stages[idx].done = true;
+  }
+
+  inline std::string
+  _metricsEscape(std::string const& str) {
+    std::string out;
+    for(uint32_t i = 0; i < str.size(); ++i) {
+      if ((str[i] == '"') || (str[i] == '\\')) out.push_back('\\');
+      out.push_back(str[i]);
+    }
+    return out;
+  }
+
+  inline void
+  _metricsFields(std::ofstream& ofile, MetricsSnapshot const& begin, MetricsSnapshot const& end) {
+    ofile << "\"wall_seconds\": " << (end.wall - begin.wall).total_microseconds() / 1000000.0;
+    ofile << ", \"cpu_seconds\": " << end.cpu - begin.cpu;
+    ofile << ", \"peak_rss_kb\": " << end.peakRss;
+    ofile << ", \"reads\": " << end.reads - begin.reads;
+    ofile << ", \"records\": " << end.records - begin.records;
+    ofile << ", \"alignments\": " << end.alignments - begin.alignments;
+  }
+
+  // JSON report, stages in execution order followed by the command total
+  inline bool
+  metricsWrite() {
+    MetricsRegistry& m = _metrics();
+    if (!m.enabled) return true;
+    MetricsSnapshot end;
+    _metricsSnapshot(end);
+    std::ofstream ofile(m.outfile.string().c_str());
+    if (!ofile.good()) {
+      std::cerr << "Fail to open metrics file " << m.outfile.string() << std::endl;
+      return false;
+    }
+    int32_t threads = 1;
+#ifdef OPENMP
+    threads = omp_get_max_threads();
+#endif
+    ofile << "{" << std::endl;
+    ofile << "  \"command\": \"" << _metricsEscape(m.command) << "\"," << std::endl;
+    ofile << "  \"threads\": " << threads << "," << std::endl;
+    ofile << "  \"stages\": [";
+    for(uint32_t i = 0; i < m.stages.size(); ++i) {
+      if (i) ofile << ",";
+      ofile << std::endl << "    {\"name\": \"" << _metricsEscape(m.stages[i].name) << "\", ";
+      if (m.stages[i].done) _metricsFields(ofile, m.stages[i].begin, m.stages[i].end);
+      else _metricsFields(ofile, m.stages[i].begin, end);
+      ofile << "}";
+    }
+    if (!m.stages.empty()) ofile << std::endl << "  ";
+    ofile << "]," << std::endl;
+    ofile << "  \"total\": {";
+    _metricsFields(ofile, m.begin, end);
+    ofile << "}" << std::endl;
+    ofile << "}" << std::endl;
+    ofile.close();
+    return true;
+  }
+
+}
+
+#endif
@@ -7,12 +7,19 @@
 #include <htslib/vcf.h>
 
 #include "bolog.h"
+#include "refcache.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 
 
 namespace torali
 {
 
+  #ifndef DELLY_VCF_BATCH
+  #define DELLY_VCF_BATCH 512
+  #endif
+
 
 void _remove_info_tag(bcf_hdr_t* hdr, bcf1_t* rec, std::string const& tag) {
   bcf_update_info(hdr, rec, tag.c_str(), NULL, 0, BCF_HT_INT);  // Type does not matter for n = 0
@@ -154,11 +161,11 @@ inline void
 vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>& svs) {
   // Load bcf file
   htsFile* ifile = bcf_open(c.vcffile.string().c_str(), "r");
+  ioThreadsAttach(ifile);
   bcf_hdr_t* hdr = bcf_hdr_read(ifile);
   bcf1_t* rec = bcf_init();
 
   // Parse genome if necessary
-  faidx_t* fai = fai_load(c.genome.string().c_str());
   char* seq = NULL;
   int32_t lastRefIndex = -1;
   
@@ -341,9 +348,9 @@ vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>&
 
 	// Lazy loading of reference sequence
 	if ((seq == NULL) || (tid != lastRefIndex)) {
-	  if (seq != NULL) free(seq);
+	  releaseReference(seq);
 	  int32_t seqlen = -1;
-	  seq = faidx_fetch_seq(fai, chrName.c_str(), 0, faidx_seq_len(fai, chrName.c_str()), &seqlen);
+	  seq = fetchReference(c.genome, chrName, seqlen);
 	  lastRefIndex = tid;
 	}
 
@@ -388,8 +395,7 @@ vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>&
   free(chr2);
 
   // Clean-up index
-  if (seq != NULL) free(seq);
-  fai_destroy(fai);
+  releaseReference(seq);
   
   // Close VCF
   bcf_hdr_destroy(hdr);
@@ -398,6 +404,225 @@ vcfParse(TConfig const& c, bam_hdr_t* hd, std::vector<TStructuralVariantRecord>&
 }
 
 
+// Per-thread FORMAT buffers for the genotype columns of one record
+struct GenotypeArrays {
+  std::vector<int32_t> gts;
+  std::vector<float> gls;
+  std::vector<int32_t> rcl;
+  std::vector<int32_t> rc;
+  std::vector<int32_t> rcr;
+  std::vector<int32_t> cnest;
+  std::vector<int32_t> drcount;
+  std::vector<int32_t> dvcount;
+  std::vector<int32_t> hp1drcount;
+  std::vector<int32_t> hp2drcount;
+  std::vector<int32_t> hp1dvcount;
+  std::vector<int32_t> hp2dvcount;
+  std::vector<int32_t> rrcount;
+  std::vector<int32_t> rvcount;
+  std::vector<int32_t> hp1rrcount;
+  std::vector<int32_t> hp2rrcount;
+  std::vector<int32_t> hp1rvcount;
+  std::vector<int32_t> hp2rvcount;
+  std::vector<int32_t> gqval;
+  std::vector<std::string> ftarr;
+
+  explicit GenotypeArrays(int32_t const n) : gts(2 * n), gls(3 * n), rcl(n), rc(n), rcr(n), cnest(n), drcount(n), dvcount(n), hp1drcount(n), hp2drcount(n), hp1dvcount(n), hp2dvcount(n), rrcount(n), rvcount(n), hp1rrcount(n), hp2rrcount(n), hp1rvcount(n), hp2rvcount(n), gqval(n), ftarr(n) {}
+};
+
+// Fill one output record, only reads the shared header and count maps so records can be built concurrently
+template<typename TConfig, typename TSVIter, typename TJunctionCountMap, typename TReadCountMap, typename TCountMap>
+inline void
+_vcfRecord(TConfig const& c, TSVIter const svIter, bam_hdr_t const* bamhd, bcf_hdr_t* hdr, BoLog<double> const& bl, TJunctionCountMap const& jctCountMap, TReadCountMap const& readCountMap, TCountMap const& spanCountMap, GenotypeArrays& ga, bcf1_t* rec)
+{
+  int32_t* gts = &ga.gts[0];
+  float* gls = &ga.gls[0];
+  int32_t* rcl = &ga.rcl[0];
+  int32_t* rc = &ga.rc[0];
+  int32_t* rcr = &ga.rcr[0];
+  int32_t* cnest = &ga.cnest[0];
+  int32_t* drcount = &ga.drcount[0];
+  int32_t* dvcount = &ga.dvcount[0];
+  int32_t* hp1drcount = &ga.hp1drcount[0];
+  int32_t* hp2drcount = &ga.hp2drcount[0];
+  int32_t* hp1dvcount = &ga.hp1dvcount[0];
+  int32_t* hp2dvcount = &ga.hp2dvcount[0];
+  int32_t* rrcount = &ga.rrcount[0];
+  int32_t* rvcount = &ga.rvcount[0];
+  int32_t* hp1rrcount = &ga.hp1rrcount[0];
+  int32_t* hp2rrcount = &ga.hp2rrcount[0];
+  int32_t* hp1rvcount = &ga.hp1rvcount[0];
+  int32_t* hp2rvcount = &ga.hp2rvcount[0];
+  int32_t* gqval = &ga.gqval[0];
+  std::vector<std::string>& ftarr = ga.ftarr;
+
+  // Output main vcf fields
+  int32_t tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "PASS");
+  if (svIter->chr == svIter->chr2) {
+    // Intra-chromosomal
+    if (((svIter->peSupport < 3) || (svIter->peMapQuality < 20)) && ((svIter->srSupport < 3) || (svIter->srMapQuality < 20))) tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
+  } else {
+    // Inter-chromosomal
+    if (((svIter->peSupport < 5) || (svIter->peMapQuality < 20)) && ((svIter->srSupport < 5) || (svIter->srMapQuality < 20))) tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
+  }
+  rec->rid = bcf_hdr_name2id(hdr, bamhd->target_name[svIter->chr]);
+  int32_t svStartPos = svIter->svStart - 1;
+  if (svStartPos < 1) svStartPos = 1;
+  int32_t svEndPos = svIter->svEnd;
+  if (svEndPos < 1) svEndPos = 1;
+  if (svEndPos >= (int32_t) bamhd->target_len[svIter->chr2]) svEndPos = bamhd->target_len[svIter->chr2] - 1;
+  rec->pos = svStartPos;
+  std::string id(_addID(svIter->svt));
+  std::string padNumber = boost::lexical_cast<std::string>(svIter->id);
+  padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
+  id += padNumber;
+  bcf_update_id(hdr, rec, id.c_str());
+  std::string alleles = _replaceIUPAC(svIter->alleles);
+  bcf_update_alleles_str(hdr, rec, alleles.c_str());
+  bcf_update_filter(hdr, rec, &tmpi, 1);
+
+  // Add INFO fields
+  if (svIter->precise) bcf_update_info_flag(hdr, rec, "PRECISE", NULL, 1);
+  else bcf_update_info_flag(hdr, rec, "IMPRECISE", NULL, 1);
+  bcf_update_info_string(hdr, rec, "SVTYPE", _addID(svIter->svt).c_str());
+  std::string dellyVersion("EMBL.DELLYv");
+  dellyVersion += dellyVersionNumber;
+  bcf_update_info_string(hdr,rec, "SVMETHOD", dellyVersion.c_str());
+  if (svIter->svt < DELLY_SVT_TRANS) {
+    tmpi = svEndPos;
+    bcf_update_info_int32(hdr, rec, "END", &tmpi, 1);
+  } else {
+    tmpi = svStartPos + 2;
+    bcf_update_info_int32(hdr, rec, "END", &tmpi, 1);
+    bcf_update_info_string(hdr,rec, "CHR2", bamhd->target_name[svIter->chr2]);
+    tmpi = svEndPos;
+    bcf_update_info_int32(hdr, rec, "POS2", &tmpi, 1);
+  }
+  if (svIter->svt == 4) {
+    tmpi = svIter->insLen;
+    bcf_update_info_int32(hdr, rec, "SVLEN", &tmpi, 1);
+  }
+  tmpi = svIter->peSupport;
+  bcf_update_info_int32(hdr, rec, "PE", &tmpi, 1);
+  tmpi = svIter->peMapQuality;
+  bcf_update_info_int32(hdr, rec, "MAPQ", &tmpi, 1);
+  bcf_update_info_string(hdr, rec, "CT", _addOrientation(svIter->svt).c_str());
+  int32_t ciend[2];
+  ciend[0] = svIter->ciendlow;
+  ciend[1] = svIter->ciendhigh;
+  int32_t cipos[2];
+  cipos[0] = svIter->ciposlow;
+  cipos[1] = svIter->ciposhigh;
+  bcf_update_info_int32(hdr, rec, "CIPOS", cipos, 2);
+  bcf_update_info_int32(hdr, rec, "CIEND", ciend, 2);
+
+  if (svIter->precise)  {
+    tmpi = svIter->srMapQuality;
+    bcf_update_info_int32(hdr, rec, "SRMAPQ", &tmpi, 1);
+    tmpi = svIter->insLen;
+    bcf_update_info_int32(hdr, rec, "INSLEN", &tmpi, 1);
+    tmpi = svIter->homLen;
+    bcf_update_info_int32(hdr, rec, "HOMLEN", &tmpi, 1);
+    tmpi = svIter->srSupport;
+    bcf_update_info_int32(hdr, rec, "SR", &tmpi, 1);
+    float tmpf = svIter->srAlignQuality;
+    bcf_update_info_float(hdr, rec, "SRQ", &tmpf, 1);
+    if (svIter->consensus.size()) {
+      bcf_update_info_string(hdr, rec, "CONSENSUS", svIter->consensus.c_str());
+      tmpf = entropy(svIter->consensus);
+      bcf_update_info_float(hdr, rec, "CE", &tmpf, 1);
+    }
+  }
+
+  // Add genotype columns
+  for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+    // Counters
+    rcl[file_c] = 0;
+    rc[file_c] = 0;
+    rcr[file_c] = 0;
+    cnest[file_c] = 0;
+    drcount[file_c] = 0;
+    dvcount[file_c] = 0;
+    if (c.isHaplotagged) {
+      hp1drcount[file_c] = 0;
+      hp2drcount[file_c] = 0;
+      hp1dvcount[file_c] = 0;
+      hp2dvcount[file_c] = 0;
+    }
+    rrcount[file_c] = 0;
+    rvcount[file_c] = 0;
+    if (c.isHaplotagged) {
+      hp1rrcount[file_c] = 0;
+      hp2rrcount[file_c] = 0;
+      hp1rvcount[file_c] = 0;
+      hp2rvcount[file_c] = 0;
+    }
+    drcount[file_c] = spanCountMap[file_c][svIter->id].ref.size();
+    dvcount[file_c] = spanCountMap[file_c][svIter->id].alt.size();
+    if (c.isHaplotagged) {
+      hp1drcount[file_c] = spanCountMap[file_c][svIter->id].refh1;
+      hp2drcount[file_c] = spanCountMap[file_c][svIter->id].refh2;
+      hp1dvcount[file_c] = spanCountMap[file_c][svIter->id].alth1;
+      hp2dvcount[file_c] = spanCountMap[file_c][svIter->id].alth2;
+    }
+    rrcount[file_c] = jctCountMap[file_c][svIter->id].ref.size();
+    rvcount[file_c] = jctCountMap[file_c][svIter->id].alt.size();
+    if (c.isHaplotagged) {
+      hp1rrcount[file_c] = jctCountMap[file_c][svIter->id].refh1;
+      hp2rrcount[file_c] = jctCountMap[file_c][svIter->id].refh2;
+      hp1rvcount[file_c] = jctCountMap[file_c][svIter->id].alth1;
+      hp2rvcount[file_c] = jctCountMap[file_c][svIter->id].alth2;
+    }
+
+    // Compute GLs
+    if (svIter->precise) _computeGLs(bl, jctCountMap[file_c][svIter->id].ref, jctCountMap[file_c][svIter->id].alt, gls, gqval, gts, file_c);
+    else _computeGLs(bl, spanCountMap[file_c][svIter->id].ref, spanCountMap[file_c][svIter->id].alt, gls, gqval, gts, file_c);
+
+    // Compute RCs
+    rcl[file_c] = readCountMap[file_c][svIter->id].leftRC;
+    rc[file_c] = readCountMap[file_c][svIter->id].rc;
+    rcr[file_c] = readCountMap[file_c][svIter->id].rightRC;
+    cnest[file_c] = -1;
+    if ((rcl[file_c] + rcr[file_c]) > 0) cnest[file_c] = boost::math::iround( 2.0 * (double) rc[file_c] / (double) (rcl[file_c] + rcr[file_c]) );
+
+    // Genotype filter
+    if (gqval[file_c] < 15) ftarr[file_c] = "LowQual";
+    else ftarr[file_c] = "PASS";
+  }
+  int32_t qvalout = svIter->mapq;
+  if (qvalout < 0) qvalout = 0;
+  if (qvalout > 10000) qvalout = 10000;
+  rec->qual = qvalout;
+
+  bcf_update_genotypes(hdr, rec, gts, bcf_hdr_nsamples(hdr) * 2);
+  bcf_update_format_float(hdr, rec, "GL",  gls, bcf_hdr_nsamples(hdr) * 3);
+  bcf_update_format_int32(hdr, rec, "GQ", gqval, bcf_hdr_nsamples(hdr));
+  std::vector<const char*> strp(bcf_hdr_nsamples(hdr));
+  std::transform(ftarr.begin(), ftarr.end(), strp.begin(), cstyle_str());
+  bcf_update_format_string(hdr, rec, "FT", &strp[0], bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "RCL", rcl, bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "RC", rc, bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "RCR", rcr, bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "RDCN", cnest, bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "DR", drcount, bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "DV", dvcount, bcf_hdr_nsamples(hdr));
+  if (c.isHaplotagged) {
+    bcf_update_format_int32(hdr, rec, "HP1DR", hp1drcount, bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP2DR", hp2drcount, bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP1DV", hp1dvcount, bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP2DV", hp2dvcount, bcf_hdr_nsamples(hdr));
+  }
+  bcf_update_format_int32(hdr, rec, "RR", rrcount, bcf_hdr_nsamples(hdr));
+  bcf_update_format_int32(hdr, rec, "RV", rvcount, bcf_hdr_nsamples(hdr));
+  if (c.isHaplotagged) {
+    bcf_update_format_int32(hdr, rec, "HP1RR", hp1rrcount, bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP2RR", hp2rrcount, bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP1RV", hp1rvcount, bcf_hdr_nsamples(hdr));
+    bcf_update_format_int32(hdr, rec, "HP2RV", hp2rvcount, bcf_hdr_nsamples(hdr));
+  }
+}
+
+
 template<typename TConfig, typename TStructuralVariantRecord, typename TJunctionCountMap, typename TReadCountMap, typename TCountMap>
 inline void
 vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJunctionCountMap const& jctCountMap, TReadCountMap const& readCountMap, TCountMap const& spanCountMap)
@@ -412,6 +637,7 @@ vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJ
 
   // Output all structural variants
   htsFile *fp = hts_open(c.outfile.string().c_str(), "wb");
+  ioThreadsAttach(fp);
   bcf_hdr_t *hdr = bcf_hdr_init("w");
 
   // Print vcf header
@@ -485,228 +711,39 @@ vcfOutput(TConfig const& c, std::vector<TStructuralVariantRecord> const& svs, TJ
   if (bcf_hdr_write(fp, hdr) != 0) std::cerr << "Error: Failed to write BCF header!" << std::endl;
 
   if (!svs.empty()) {
-    // Genotype arrays
-    int32_t *gts = (int*) malloc(bcf_hdr_nsamples(hdr) * 2 * sizeof(int));
-    float *gls = (float*) malloc(bcf_hdr_nsamples(hdr) * 3 * sizeof(float));
-    int32_t *rcl = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *rc = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *rcr = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *cnest = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *drcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *dvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp1drcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp2drcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp1dvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp2dvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *rrcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *rvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp1rrcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp2rrcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp1rvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *hp2rvcount = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    int32_t *gqval = (int*) malloc(bcf_hdr_nsamples(hdr) * sizeof(int));
-    std::vector<std::string> ftarr;
-    ftarr.resize(bcf_hdr_nsamples(hdr));
-    
-    // Iterate all structural variants
+    // Iterate all structural variants in batches, records are built in parallel and written in input order
     typedef std::vector<TStructuralVariantRecord> TSVs;
     now = boost::posix_time::second_clock::local_time();
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Genotyping" << std::endl;
     boost::progress_display show_progress( svs.size() );
-    bcf1_t *rec = bcf_init();
-    for(typename TSVs::const_iterator svIter = svs.begin(); svIter!=svs.end(); ++svIter) {
-      ++show_progress;
-      if ((svIter->srSupport == 0) && (svIter->peSupport == 0)) continue;
-      
-      // Output main vcf fields
-      int32_t tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "PASS");
-      if (svIter->chr == svIter->chr2) {
-	// Intra-chromosomal
-	if (((svIter->peSupport < 3) || (svIter->peMapQuality < 20)) && ((svIter->srSupport < 3) || (svIter->srMapQuality < 20))) tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
-      } else {
-	// Inter-chromosomal
-	if (((svIter->peSupport < 5) || (svIter->peMapQuality < 20)) && ((svIter->srSupport < 5) || (svIter->srMapQuality < 20))) tmpi = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
-      }
-      rec->rid = bcf_hdr_name2id(hdr, bamhd->target_name[svIter->chr]);
-      int32_t svStartPos = svIter->svStart - 1;
-      if (svStartPos < 1) svStartPos = 1;
-      int32_t svEndPos = svIter->svEnd;
-      if (svEndPos < 1) svEndPos = 1;
-      if (svEndPos >= (int32_t) bamhd->target_len[svIter->chr2]) svEndPos = bamhd->target_len[svIter->chr2] - 1;
-      rec->pos = svStartPos;
-      std::string id(_addID(svIter->svt));
-      std::string padNumber = boost::lexical_cast<std::string>(svIter->id);
-      padNumber.insert(padNumber.begin(), 8 - padNumber.length(), '0');
-      id += padNumber;
-      bcf_update_id(hdr, rec, id.c_str());
-      std::string alleles = _replaceIUPAC(svIter->alleles);
-      bcf_update_alleles_str(hdr, rec, alleles.c_str());
-      bcf_update_filter(hdr, rec, &tmpi, 1);
-      
-      // Add INFO fields
-      if (svIter->precise) bcf_update_info_flag(hdr, rec, "PRECISE", NULL, 1);
-      else bcf_update_info_flag(hdr, rec, "IMPRECISE", NULL, 1);
-      bcf_update_info_string(hdr, rec, "SVTYPE", _addID(svIter->svt).c_str());
-      std::string dellyVersion("EMBL.DELLYv");
-      dellyVersion += dellyVersionNumber;
-      bcf_update_info_string(hdr,rec, "SVMETHOD", dellyVersion.c_str());
-      if (svIter->svt < DELLY_SVT_TRANS) {
-	tmpi = svEndPos;
-	bcf_update_info_int32(hdr, rec, "END", &tmpi, 1);
-      } else {
-	tmpi = svStartPos + 2;
-	bcf_update_info_int32(hdr, rec, "END", &tmpi, 1);
-	bcf_update_info_string(hdr,rec, "CHR2", bamhd->target_name[svIter->chr2]);
-	tmpi = svEndPos;
-	bcf_update_info_int32(hdr, rec, "POS2", &tmpi, 1);
-      }
-      if (svIter->svt == 4) {
-	tmpi = svIter->insLen;
-	bcf_update_info_int32(hdr, rec, "SVLEN", &tmpi, 1);
-      }
-      tmpi = svIter->peSupport;
-      bcf_update_info_int32(hdr, rec, "PE", &tmpi, 1);
-      tmpi = svIter->peMapQuality;
-      bcf_update_info_int32(hdr, rec, "MAPQ", &tmpi, 1);
-      bcf_update_info_string(hdr, rec, "CT", _addOrientation(svIter->svt).c_str());
-      int32_t ciend[2];
-      ciend[0] = svIter->ciendlow;
-      ciend[1] = svIter->ciendhigh;
-      int32_t cipos[2];
-      cipos[0] = svIter->ciposlow;
-      cipos[1] = svIter->ciposhigh;
-      bcf_update_info_int32(hdr, rec, "CIPOS", cipos, 2);
-      bcf_update_info_int32(hdr, rec, "CIEND", ciend, 2);
-      
-      if (svIter->precise)  {
-	tmpi = svIter->srMapQuality;
-	bcf_update_info_int32(hdr, rec, "SRMAPQ", &tmpi, 1);
-	tmpi = svIter->insLen;
-	bcf_update_info_int32(hdr, rec, "INSLEN", &tmpi, 1);
-	tmpi = svIter->homLen;
-	bcf_update_info_int32(hdr, rec, "HOMLEN", &tmpi, 1);
-	tmpi = svIter->srSupport;
-	bcf_update_info_int32(hdr, rec, "SR", &tmpi, 1);
-	float tmpf = svIter->srAlignQuality;
-	bcf_update_info_float(hdr, rec, "SRQ", &tmpf, 1);
-	if (svIter->consensus.size()) {
-	  bcf_update_info_string(hdr, rec, "CONSENSUS", svIter->consensus.c_str());
-	  tmpf = entropy(svIter->consensus);
-	  bcf_update_info_float(hdr, rec, "CE", &tmpf, 1);
+    std::vector<bcf1_t*> recs(DELLY_VCF_BATCH);
+    for(uint32_t i = 0; i < recs.size(); ++i) recs[i] = bcf_init();
+    uint64_t nwritten = 0;
+    for(uint32_t batchStart = 0; batchStart < svs.size(); batchStart += DELLY_VCF_BATCH) {
+      uint32_t batchEnd = std::min((uint32_t) svs.size(), batchStart + DELLY_VCF_BATCH);
+#pragma omp parallel default(shared)
+      {
+	GenotypeArrays ga(bcf_hdr_nsamples(hdr));
+#pragma omp for schedule(dynamic)
+	for(int32_t i = batchStart; i < (int32_t) batchEnd; ++i) {
+	  typename TSVs::const_iterator svIter = svs.begin() + i;
+	  if ((svIter->srSupport == 0) && (svIter->peSupport == 0)) continue;
+	  _vcfRecord(c, svIter, bamhd, hdr, bl, jctCountMap, readCountMap, spanCountMap, ga, recs[i - batchStart]);
 	}
       }
-      
-      // Add genotype columns
-      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-	// Counters
-	rcl[file_c] = 0;
-	rc[file_c] = 0;
-	rcr[file_c] = 0;
-	cnest[file_c] = 0;
-	drcount[file_c] = 0;
-	dvcount[file_c] = 0;
-	if (c.isHaplotagged) {
-	  hp1drcount[file_c] = 0;
-	  hp2drcount[file_c] = 0;
-	  hp1dvcount[file_c] = 0;
-	  hp2dvcount[file_c] = 0;
-	}
-	rrcount[file_c] = 0;
-	rvcount[file_c] = 0;
-	if (c.isHaplotagged) {
-	  hp1rrcount[file_c] = 0;
-	  hp2rrcount[file_c] = 0;
-	  hp1rvcount[file_c] = 0;
-	  hp2rvcount[file_c] = 0;
-	}
-	drcount[file_c] = spanCountMap[file_c][svIter->id].ref.size();
-	dvcount[file_c] = spanCountMap[file_c][svIter->id].alt.size();
-	if (c.isHaplotagged) {
-	  hp1drcount[file_c] = spanCountMap[file_c][svIter->id].refh1;
-	  hp2drcount[file_c] = spanCountMap[file_c][svIter->id].refh2;
-	  hp1dvcount[file_c] = spanCountMap[file_c][svIter->id].alth1;
-	  hp2dvcount[file_c] = spanCountMap[file_c][svIter->id].alth2;
-	}
-	rrcount[file_c] = jctCountMap[file_c][svIter->id].ref.size();
-	rvcount[file_c] = jctCountMap[file_c][svIter->id].alt.size();
-	if (c.isHaplotagged) {
-	  hp1rrcount[file_c] = jctCountMap[file_c][svIter->id].refh1;
-	  hp2rrcount[file_c] = jctCountMap[file_c][svIter->id].refh2;
-	  hp1rvcount[file_c] = jctCountMap[file_c][svIter->id].alth1;
-	  hp2rvcount[file_c] = jctCountMap[file_c][svIter->id].alth2;
-	}
-	
-	// Compute GLs
-	if (svIter->precise) _computeGLs(bl, jctCountMap[file_c][svIter->id].ref, jctCountMap[file_c][svIter->id].alt, gls, gqval, gts, file_c);
-	else _computeGLs(bl, spanCountMap[file_c][svIter->id].ref, spanCountMap[file_c][svIter->id].alt, gls, gqval, gts, file_c);
-	
-	// Compute RCs
-	rcl[file_c] = readCountMap[file_c][svIter->id].leftRC;
-	rc[file_c] = readCountMap[file_c][svIter->id].rc;
-	rcr[file_c] = readCountMap[file_c][svIter->id].rightRC;
-	cnest[file_c] = -1;
-	if ((rcl[file_c] + rcr[file_c]) > 0) cnest[file_c] = boost::math::iround( 2.0 * (double) rc[file_c] / (double) (rcl[file_c] + rcr[file_c]) );
-      
-	// Genotype filter
-	if (gqval[file_c] < 15) ftarr[file_c] = "LowQual";
-	else ftarr[file_c] = "PASS";
-      }
-      int32_t qvalout = svIter->mapq;
-      if (qvalout < 0) qvalout = 0;
-      if (qvalout > 10000) qvalout = 10000;
-      rec->qual = qvalout;
-      
-      bcf_update_genotypes(hdr, rec, gts, bcf_hdr_nsamples(hdr) * 2);
-      bcf_update_format_float(hdr, rec, "GL",  gls, bcf_hdr_nsamples(hdr) * 3);
-      bcf_update_format_int32(hdr, rec, "GQ", gqval, bcf_hdr_nsamples(hdr));
-      std::vector<const char*> strp(bcf_hdr_nsamples(hdr));
-      std::transform(ftarr.begin(), ftarr.end(), strp.begin(), cstyle_str());
-      bcf_update_format_string(hdr, rec, "FT", &strp[0], bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "RCL", rcl, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "RC", rc, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "RCR", rcr, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "RDCN", cnest, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "DR", drcount, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "DV", dvcount, bcf_hdr_nsamples(hdr));
-      if (c.isHaplotagged) {
-	bcf_update_format_int32(hdr, rec, "HP1DR", hp1drcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP2DR", hp2drcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP1DV", hp1dvcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP2DV", hp2dvcount, bcf_hdr_nsamples(hdr));
-      }
-      bcf_update_format_int32(hdr, rec, "RR", rrcount, bcf_hdr_nsamples(hdr));
-      bcf_update_format_int32(hdr, rec, "RV", rvcount, bcf_hdr_nsamples(hdr));
-      if (c.isHaplotagged) {
-	bcf_update_format_int32(hdr, rec, "HP1RR", hp1rrcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP2RR", hp2rrcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP1RV", hp1rvcount, bcf_hdr_nsamples(hdr));
-	bcf_update_format_int32(hdr, rec, "HP2RV", hp2rvcount, bcf_hdr_nsamples(hdr));
+
+      // Ordered writer
+      for(uint32_t i = batchStart; i < batchEnd; ++i) {
+	++show_progress;
+	if ((svs[i].srSupport == 0) && (svs[i].peSupport == 0)) continue;
+	bcf1_t* rec = recs[i - batchStart];
+	bcf_write1(fp, hdr, rec);
+	bcf_clear1(rec);
+	++nwritten;
       }
-      bcf_write1(fp, hdr, rec);
-      bcf_clear1(rec);
     }
-    bcf_destroy1(rec);
-    
-    // Clean-up
-    free(gts);
-    free(gls);
-    free(rcl);
-    free(rc);
-    free(rcr);
-    free(cnest);
-    free(drcount);
-    free(dvcount);
-    free(hp1drcount);
-    free(hp2drcount);
-    free(hp1dvcount);
-    free(hp2dvcount);
-    free(rrcount);
-    free(rvcount);
-    free(hp1rrcount);
-    free(hp2rrcount);
-    free(hp1rvcount);
-    free(hp2rvcount);
-    free(gqval);
+    for(uint32_t i = 0; i < recs.size(); ++i) bcf_destroy1(recs[i]);
+    metricsRecords(nwritten);
   }
 
   // Close BAM file
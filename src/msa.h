@@ -4,31 +4,54 @@
 #include <boost/multi_array.hpp>
 #include "needle.h"
 #include "gotoh.h"
+#include "metrics.h"
 
 namespace torali {
 
+  // Bit-parallel longest common subsequence (Hyyroe), one bit per s1 character
   inline int32_t
   lcs(std::string const& s1, std::string const& s2) {
     uint32_t m = s1.size();
     uint32_t n = s2.size();
-    int32_t prevdiag = 0;
-    int32_t prevprevdiag = 0;
-    std::vector<int32_t> onecol(n+1, 0);
-    for(uint32_t i = 0; i <= m; ++i) {
-      for(uint32_t j = 0; j <= n; ++j) {
-	if ((i==0) || (j==0)) {
-	  onecol[j] = 0;
-	  prevprevdiag = 0;
-	  prevdiag = 0;
-	} else {
-	  prevprevdiag = prevdiag;
-	  prevdiag = onecol[j];
-	  if (s1[i-1] == s2[j-1]) onecol[j] = prevprevdiag + 1;
-	  else onecol[j] = (onecol[j] > onecol[j-1]) ? onecol[j] : onecol[j-1];
-	}
+    if ((m == 0) || (n == 0)) return 0;
+    uint32_t words = (m + 63) / 64;
+
+    // Match masks
+    std::vector<int32_t> charIdx(256, -1);
+    std::vector<uint64_t> peq;
+    for(uint32_t i = 0; i < m; ++i) {
+      uint8_t ch = (uint8_t) s1[i];
+      if (charIdx[ch] == -1) {
+	charIdx[ch] = peq.size() / words;
+	peq.resize(peq.size() + words, 0);
       }
+      peq[charIdx[ch] * words + i / 64] |= ((uint64_t) 1 << (i % 64));
+    }
+
+    // V' = (V + (V & M)) | (V & ~M), carries ripple across words
+    std::vector<uint64_t> v(words, ~((uint64_t) 0));
+    for(uint32_t j = 0; j < n; ++j) {
+      int32_t idx = charIdx[(uint8_t) s2[j]];
+      if (idx == -1) continue;
+      uint64_t const* mask = &peq[idx * words];
+      uint64_t carry = 0;
+      for(uint32_t w = 0; w < words; ++w) {
+	uint64_t u = v[w] & mask[w];
+	uint64_t x = v[w] + u;
+	uint64_t y = x + carry;
+	carry = ((x < v[w]) || (y < x)) ? 1 : 0;
+	v[w] = y | (v[w] & ~mask[w]);
+      }
+    }
+
+    // LCS length is the number of zero bits
+    int32_t zeros = 0;
+    for(uint32_t w = 0; w < words; ++w) {
+      uint64_t bits = ~v[w];
+      if ((w == words - 1) && (m % 64)) bits &= (((uint64_t) 1 << (m % 64)) - 1);
+      zeros += __builtin_popcountll(bits);
     }
-    return onecol[n];
+    return zeros;
   }
 
   template<typename TSplitReadSet, typename TDistArray>
@@ -269,6 +292,7 @@ namespace torali {
     typedef boost::multi_array<char, 2> TAlign;
     TAlign align;
     palign(c, sps, p, root, align);
+    if (num > 1) metricsAlignments(num - 1);
 
     // Debug MSA
     //for(uint32_t i = 0; i<align.shape()[0]; ++i) {
@@ -5,6 +5,7 @@
 #include <boost/dynamic_bitset.hpp>
 #include <boost/multi_array.hpp>
 #include <iostream>
+#include <cmath>
 #include "align.h"
 
 namespace torali
@@ -42,28 +43,98 @@ namespace torali
   }
 
 
+  // One row of the long alignment matrix, columns 0..ncol
+  template<typename TRow, typename TAlignConfig, typename TScoreObject>
+  inline void
+  _longNeedleRow(std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc, std::size_t const row, std::size_t const ncol, TRow const& prev, TRow& cur)
+  {
+    std::size_t m = s1.size();
+    std::size_t n = s2.size();
+    if (row == 0) {
+      cur[0] = 0;
+      for(std::size_t col = 1; col <= ncol; ++col) cur[col] = cur[col-1] + _horizontalGap(ac, 0, m, sc.ge);
+    } else {
+      cur[0] = prev[0] + _verticalGap(ac, 0, n, sc.ge);
+      for(std::size_t col = 1; col <= ncol; ++col)
+	cur[col] = std::max(std::max(prev[col-1] + (s1[row-1] == s2[col-1] ? sc.match : sc.mismatch), prev[col] + _verticalGap(ac, col, n, sc.ge)), cur[col-1] + _horizontalGap(ac, row, m, sc.ge));
+    }
+  }
+
+  // Rows first..last recomputed from the checkpoint row first
+  template<typename TRows, typename TAlignConfig, typename TScoreObject>
+  inline void
+  _longNeedleBlock(std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc, TRows const& ckpt, std::size_t const k, std::size_t const first, std::size_t const last, std::size_t const ncol, TRows& block)
+  {
+    for(std::size_t col = 0; col <= ncol; ++col) block[0][col] = ckpt[first / k][col];
+    for(std::size_t row = first + 1; row <= last; ++row) _longNeedleRow(s1, s2, ac, sc, row, ncol, block[row - first - 1], block[row - first]);
+  }
+
+  // Full pass keeping every k-th row, last holds row m
+  template<typename TRows, typename TRow, typename TAlignConfig, typename TScoreObject>
+  inline void
+  _longNeedleCheckpoints(std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc, std::size_t const k, TRows& ckpt, TRow& last)
+  {
+    std::size_t m = s1.size();
+    std::size_t n = s2.size();
+    TRow prev(n+1, 0);
+    last.resize(n+1);
+    for(std::size_t row = 0; row <= m; ++row) {
+      _longNeedleRow(s1, s2, ac, sc, row, n, prev, last);
+      if (row % k == 0) ckpt.push_back(last);
+      prev.swap(last);
+    }
+    last.swap(prev);
+  }
+
+  // Trace-back with the rows of each block of k rows recomputed from its checkpoint
+  template<typename TRows, typename TAlignConfig, typename TScoreObject>
+  inline void
+  _longNeedleTrace(std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc, TRows const& ckpt, std::size_t const k, std::size_t rr, std::size_t cc, std::vector<char>& trace)
+  {
+    typedef typename TRows::value_type TRow;
+    std::size_t m = s1.size();
+    std::size_t n = s2.size();
+    std::size_t top = rr;
+    std::size_t ncol = cc;
+    TRows block(k+1, TRow(ncol+1, 0));
+    std::size_t first = top + 1;
+    while ((rr>0) || (cc>0)) {
+      std::size_t b = 0;
+      if (rr > 0) b = ((rr - 1) / k) * k;
+      if (b != first) {
+	first = b;
+	_longNeedleBlock(s1, s2, ac, sc, ckpt, k, first, std::min(first + k, top), ncol, block);
+      }
+      TRow const& cur = block[rr - first];
+      if ((rr>0) && (cur[cc] == block[rr - first - 1][cc] + _verticalGap(ac, cc, n, sc.ge))) {
+	--rr;
+	trace.push_back('v');
+      } else if ((cc>0) && (cur[cc] == cur[cc-1] + _horizontalGap(ac, rr, m, sc.ge))) {
+	--cc;
+	trace.push_back('h');
+      } else {
+	--rr;
+	--cc;
+	trace.push_back('s');
+      }
+    }
+  }
+
+  // Split alignment in O((m/k + k) * n) memory with k = sqrt(m), rows are recomputed from checkpoints instead of storing full matrices
   template<typename TAlign, typename TAlignConfig, typename TScoreObject>
   inline bool
   longNeedle(std::string const& s1, std::string const& s2, TAlign& align, TAlignConfig const& ac, TScoreObject const& sc)
   {
     typedef typename TScoreObject::TValue TScoreValue;
     typedef typename TAlign::index TAIndex;
+    typedef std::vector<TScoreValue> TRow;
+    typedef std::vector<TRow> TRows;
 
-    // DP Matrix
-    typedef boost::multi_array<TScoreValue, 2> TMatrix;
+    // Checkpoint distance
     std::size_t m = s1.size();
     std::size_t n = s2.size();
-    TMatrix mat(boost::extents[m+1][n+1]);
-
-    // Initialization
-    mat[0][0] = 0;
-    for(std::size_t col = 1; col <= n; ++col) mat[0][col] = mat[0][col-1] + _horizontalGap(ac, 0, m, sc.ge);
-    for(std::size_t row = 1; row <= m; ++row) mat[row][0] = mat[row-1][0] + _verticalGap(ac, 0, n, sc.ge);
-
-    // Forward alignment
-    for(std::size_t row = 1; row <= m; ++row)
-      for(std::size_t col = 1; col <= n; ++col)
-	mat[row][col] = std::max(std::max(mat[row-1][col-1] + (s1[row-1] == s2[col-1] ? sc.match : sc.mismatch), mat[row-1][col] + _verticalGap(ac, col, n, sc.ge)), mat[row][col-1] + _horizontalGap(ac, row, m, sc.ge));
+    std::size_t k = (std::size_t) std::sqrt((double) (m + 1));
+    if (k < 1) k = 1;
 
     // Reverse input sequences
     std::string sRev1 = s1;
@@ -72,124 +143,89 @@ namespace torali
     reverseComplement(sRev2);
 
     // Reverse alignment
-    TMatrix rev(boost::extents[m+1][n+1]);
-    rev[0][0] = 0;
-    for(std::size_t col = 1; col <= n; ++col) rev[0][col] = rev[0][col-1] + _horizontalGap(ac, 0, m, sc.ge);
-    for(std::size_t row = 1; row <= m; ++row) rev[row][0] = rev[row-1][0] + _verticalGap(ac, 0, n, sc.ge);
-    for(std::size_t row = 1; row <= m; ++row)
-      for(std::size_t col = 1; col <= n; ++col)
-	rev[row][col] = std::max(std::max(rev[row-1][col-1] + (sRev1[row-1] == sRev2[col-1] ? sc.match : sc.mismatch), rev[row-1][col] + _verticalGap(ac, col, n, sc.ge)), rev[row][col-1] + _horizontalGap(ac, row, m, sc.ge));
-
-    if (mat[m][n] != rev[m][n]) {
+    TRows revCkpt;
+    TRow revLast;
+    _longNeedleCheckpoints(sRev1, sRev2, ac, sc, k, revCkpt, revLast);
+
+    // Forward alignment, each row is joined with the reverse row m - row
+    TRows matCkpt;
+    TRow prev(n+1, 0);
+    TRow cur(n+1, 0);
+    TRow bestRev(n+1, 0);
+    TRows revBlock(k, TRow(n+1, 0));
+    std::size_t revFirst = m + 1;
+    std::vector<TScoreValue> rowScore(m+1, 0);
+    std::vector<std::size_t> rowCol(m+1, 0);
+    for(std::size_t row = 0; row <= m; ++row) {
+      _longNeedleRow(s1, s2, ac, sc, row, n, prev, cur);
+      if (row % k == 0) matCkpt.push_back(cur);
+      std::size_t rrow = m - row;
+      if ((rrow / k) * k != revFirst) {
+	revFirst = (rrow / k) * k;
+	_longNeedleBlock(sRev1, sRev2, ac, sc, revCkpt, k, revFirst, std::min(revFirst + k - 1, m), n, revBlock);
+      }
+      TRow const& rev = revBlock[rrow - revFirst];
+      bestRev[0] = rev[0];
+      for(std::size_t col = 1; col <= n; ++col) {
+	if (rev[col] > bestRev[col-1]) bestRev[col] = rev[col];
+	else bestRev[col] = bestRev[col-1];
+      }
+      // Best join of this row, first column on ties
+      TScoreValue bestMat = cur[0];
+      rowScore[row] = bestMat + bestRev[n];
+      for(std::size_t col = 1; col <= n; ++col) {
+	if (cur[col] > bestMat) bestMat = cur[col];
+	if (bestMat + bestRev[n-col] > rowScore[row]) {
+	  rowScore[row] = bestMat + bestRev[n-col];
+	  rowCol[row] = col;
+	}
+      }
+      prev.swap(cur);
+    }
+    TScoreValue matScore = prev[n];
+
+    if (matScore != revLast[n]) {
       //std::cerr << "Warning: Alignment scores disagree!" << std::endl;
       return false;
     } else {
       // Find best join
-      TMatrix bestMat(boost::extents[m+1][n+1]);
-      for(std::size_t row = 0; row <= m; ++row) {
-	bestMat[row][0] = mat[row][0];
-	for(std::size_t col = 1; col <= n; ++col) {
-	  if (mat[row][col] > bestMat[row][col-1]) bestMat[row][col] = mat[row][col];
-	  else bestMat[row][col] = bestMat[row][col-1];
-	}
-      }
-      TMatrix bestRev(boost::extents[m+1][n+1]);
-      for(std::size_t row = 0; row <= m; ++row) {
-	bestRev[row][0] = rev[row][0];
-	for(std::size_t col = 1; col <= n; ++col) {
-	  if (rev[row][col] > bestRev[row][col-1]) bestRev[row][col] = rev[row][col];
-	  else bestRev[row][col] = bestRev[row][col-1];
-	}
-      }
-      TScoreValue bestScore = mat[m][n];
+      TScoreValue bestScore = matScore;
       std::size_t consLeft = 0;
       std::size_t refLeft = 0;
       for(std::size_t row = 0; row<=m; ++row) {
-	for(std::size_t col = 0; col<=n; ++col) {
-	  if (bestMat[row][col]+bestRev[m-row][n-col] > bestScore) {
-	    bestScore=bestMat[row][col]+bestRev[m-row][n-col];
-	    consLeft = row;
-	    refLeft = col;
-	  }
+	if (rowScore[row] > bestScore) {
+	  bestScore = rowScore[row];
+	  consLeft = row;
+	  refLeft = rowCol[row];
 	}
       }
       std::size_t consRight = m - consLeft;
       std::size_t refRight = 0;
       // Find right bound
+      TRows block(k+1, TRow(n+1, 0));
+      _longNeedleBlock(s1, s2, ac, sc, matCkpt, k, (consLeft / k) * k, consLeft, refLeft, block);
+      TScoreValue leftScore = block[consLeft % k][refLeft];
+      _longNeedleBlock(sRev1, sRev2, ac, sc, revCkpt, k, (consRight / k) * k, consRight, n - refLeft, block);
       for(std::size_t right = 0; right<=(n-refLeft); ++right) {
-	if (mat[consLeft][refLeft] + rev[consRight][right] == bestScore) {
+	if (leftScore + block[consRight % k][right] == bestScore) {
 	  refRight = right;
 	}
       }
-
-      // Debug best join
-      /*
-      TScoreValue bScore = mat[m][n];
-      std::size_t cLeft = 0;
-      std::size_t cRight = 0;
-      std::size_t rLeft = 0;
-      std::size_t rRight = 0;
-      for(std::size_t fwdcut = 0; fwdcut<=m; ++fwdcut) {
-	std::size_t revcut = m - fwdcut;
-	// Iterate all valid collinear alignments on the reference
-	for(std::size_t left = 0; left<=n; ++left) {
-	  for(std::size_t right = 0; right<=(n-left); ++right) {
-	    if (mat[fwdcut][left] + rev[revcut][right] > bScore) {
-	      bScore = mat[fwdcut][left] + rev[revcut][right];
-	      cLeft = fwdcut;
-	      cRight = revcut;
-	      rLeft = left;
-	      rRight = right;
-	    }
-	  }
-	}
-      }
-      std::cerr << mat[m][n] << ',' << bScore << ';' << s1.size() << ',' << s2.size() << ';' << cLeft << ',' << (m-cRight) << ',' << rLeft << ',' << (n-rRight) << std::endl;
-      std::cerr << mat[m][n] << ',' << bestScore << ';' << s1.size() << ',' << s2.size() << ';' << consLeft << ',' << (m-consRight) << ',' << refLeft << ',' << (n-refRight) << std::endl;
-      */
+      TRows().swap(block);
 
       // Better split found?
-      if (bestScore == mat[m][n]) return false; // No split found
+      if (bestScore == matScore) return false; // No split found
 
       // Trace-back fwd
-      std::size_t rr = consLeft;
-      std::size_t cc = refLeft;
       typedef std::vector<char> TTrace;
       TTrace trace;
-      while ((rr>0) || (cc>0)) {
-	if ((rr>0) && (mat[rr][cc] == mat[rr-1][cc] + _verticalGap(ac, cc, n, sc.ge))) {
-	  --rr;
-	  trace.push_back('v');
-	} else if ((cc>0) && (mat[rr][cc] == mat[rr][cc-1] + _horizontalGap(ac, rr, m, sc.ge))) {
-	  --cc;
-	  trace.push_back('h');
-	} else {
-	  --rr;
-	  --cc;
-	  trace.push_back('s');
-	}
-      }
+      _longNeedleTrace(s1, s2, ac, sc, matCkpt, k, consLeft, refLeft, trace);
       TAlign fwd;
       _createAlignment(trace, s1.substr(0, consLeft), s2.substr(0, refLeft), fwd);
 
       // Trace-back rev
-      rr = consRight;
-      cc = refRight;
-      typedef std::vector<char> TTrace;
       TTrace rtrace;
-      while ((rr>0) || (cc>0)) {
-	if ((rr>0) && (rev[rr][cc] == rev[rr-1][cc] + _verticalGap(ac, cc, n, sc.ge))) {
-	  --rr;
-	  rtrace.push_back('v');
-	} else if ((cc>0) && (rev[rr][cc] == rev[rr][cc-1] + _horizontalGap(ac, rr, m, sc.ge))) {
-	  --cc;
-	  rtrace.push_back('h');
-	} else {
-	  --rr;
-	  --cc;
-	  rtrace.push_back('s');
-	}
-      }
+      _longNeedleTrace(sRev1, sRev2, ac, sc, revCkpt, k, consRight, refRight, rtrace);
       TAlign rvs;
       _createAlignment(rtrace, sRev1.substr(0, consRight), sRev2.substr(0, refRight), rvs);
 
@@ -0,0 +1,228 @@
+#ifndef REFCACHE_H
+#define REFCACHE_H
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <htslib/faidx.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace torali
+{
+
+  static char const DELLY_REFCACHE_MAGIC[8] = {'D', 'L', 'Y', 'R', 'E', 'F', '1', '\0'};
+
+  // Memory-mapped, newline-free copy of a FASTA file, one NUL-terminated sequence per contig
+  struct ReferenceCache {
+    bool mapped;
+    char* base;
+    uint64_t length;
+    faidx_t* fai;
+    typedef std::pair<uint64_t, int32_t> TOffsetLength;
+    std::map<std::string, TOffsetLength> contigs;
+
+    ReferenceCache() : mapped(false), base(NULL), length(0), fai(NULL) {}
+  };
+
+  typedef std::map<std::string, ReferenceCache> TReferenceCacheMap;
+
+  inline TReferenceCacheMap&
+  _referenceCaches() {
+    static TReferenceCacheMap caches;
+    return caches;
+  }
+
+  // Cache files are opt-in per FASTA, all other files are read with faidx
+  typedef std::map<std::string, std::string> TReferenceCacheFileMap;
+
+  inline TReferenceCacheFileMap&
+  _referenceCacheFiles() {
+    static TReferenceCacheFileMap files;
+    return files;
+  }
+
+  inline void
+  referenceCacheEnable(boost::filesystem::path const& fasta, boost::filesystem::path const& cacheFile) {
+    _referenceCacheFiles()[fasta.string()] = cacheFile.string();
+  }
+
+  template<typename TValue>
+  inline void
+  _refCachePut(std::ofstream& out, TValue const val) {
+    out.write((char const*) &val, sizeof(TValue));
+  }
+
+  template<typename TValue>
+  inline bool
+  _refCacheGet(char const* base, uint64_t const length, uint64_t& k, TValue& val) {
+    if (k + sizeof(TValue) > length) return false;
+    std::memcpy(&val, base + k, sizeof(TValue));
+    k += sizeof(TValue);
+    return true;
+  }
+
+  // Decode all contigs once, the cache is written to a temporary file and renamed
+  inline bool
+  _buildReferenceCache(std::string const& fasta, std::string const& cacheFile, struct stat const& fastaStat) {
+    faidx_t* fai = fai_load(fasta.c_str());
+    if (fai == NULL) return false;
+    int32_t nseq = faidx_nseq(fai);
+    std::vector<std::string> names(nseq);
+    std::vector<int32_t> lengths(nseq, 0);
+    uint64_t headerSize = sizeof(DELLY_REFCACHE_MAGIC) + 2 * sizeof(int64_t) + sizeof(int32_t);
+    for(int32_t i = 0; i < nseq; ++i) {
+      names[i] = faidx_iseq(fai, i);
+      lengths[i] = faidx_seq_len(fai, names[i].c_str());
+      headerSize += sizeof(int32_t) + names[i].size() + sizeof(uint64_t) + sizeof(int32_t);
+    }
+    std::string tmpFile = cacheFile + ".tmp." + boost::lexical_cast<std::string>(getpid());
+    std::ofstream out(tmpFile.c_str(), std::ios::out | std::ios::binary);
+    if (!out.good()) {
+      fai_destroy(fai);
+      return false;
+    }
+    out.write(DELLY_REFCACHE_MAGIC, sizeof(DELLY_REFCACHE_MAGIC));
+    _refCachePut(out, (int64_t) fastaStat.st_size);
+    _refCachePut(out, (int64_t) fastaStat.st_mtime);
+    _refCachePut(out, nseq);
+    uint64_t offset = headerSize;
+    for(int32_t i = 0; i < nseq; ++i) {
+      _refCachePut(out, (int32_t) names[i].size());
+      out.write(names[i].c_str(), names[i].size());
+      _refCachePut(out, offset);
+      _refCachePut(out, lengths[i]);
+      offset += lengths[i] + 1;
+    }
+    bool success = true;
+    for(int32_t i = 0; ((i < nseq) && (success)); ++i) {
+      int32_t seqlen = -1;
+      char* seq = faidx_fetch_seq(fai, names[i].c_str(), 0, lengths[i], &seqlen);
+      if ((seq == NULL) || (seqlen != lengths[i])) success = false;
+      else out.write(seq, seqlen + 1);
+      if (seq != NULL) free(seq);
+    }
+    out.close();
+    fai_destroy(fai);
+    if ((!success) || (out.fail()) || (std::rename(tmpFile.c_str(), cacheFile.c_str()) != 0)) {
+      std::remove(tmpFile.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  // Map the cache and parse the contig table, stale caches are rejected
+  inline bool
+  _mapReferenceCache(std::string const& cacheFile, struct stat const& fastaStat, ReferenceCache& rc) {
+    int fd = open(cacheFile.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat cacheStat;
+    if ((fstat(fd, &cacheStat) != 0) || (cacheStat.st_size < (off_t) sizeof(DELLY_REFCACHE_MAGIC))) {
+      close(fd);
+      return false;
+    }
+    void* addr = mmap(NULL, cacheStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+    char* base = (char*) addr;
+    uint64_t length = cacheStat.st_size;
+    uint64_t k = sizeof(DELLY_REFCACHE_MAGIC);
+    int64_t fsize = 0;
+    int64_t fmtime = 0;
+    int32_t nseq = 0;
+    bool valid = (std::memcmp(base, DELLY_REFCACHE_MAGIC, sizeof(DELLY_REFCACHE_MAGIC)) == 0);
+    valid = valid && _refCacheGet(base, length, k, fsize) && _refCacheGet(base, length, k, fmtime) && _refCacheGet(base, length, k, nseq);
+    valid = valid && (fsize == (int64_t) fastaStat.st_size) && (fmtime == (int64_t) fastaStat.st_mtime);
+    for(int32_t i = 0; ((valid) && (i < nseq)); ++i) {
+      int32_t nameLen = 0;
+      uint64_t offset = 0;
+      int32_t seqlen = 0;
+      valid = _refCacheGet(base, length, k, nameLen) && (nameLen >= 0) && (k + nameLen <= length);
+      if (!valid) break;
+      std::string name(base + k, nameLen);
+      k += nameLen;
+      valid = _refCacheGet(base, length, k, offset) && _refCacheGet(base, length, k, seqlen) && (seqlen >= 0) && (offset + seqlen < length);
+      if (valid) rc.contigs[name] = std::make_pair(offset, seqlen);
+    }
+    if (!valid) {
+      rc.contigs.clear();
+      munmap(addr, length);
+      return false;
+    }
+    rc.mapped = true;
+    rc.base = base;
+    rc.length = length;
+    return true;
+  }
+
+  inline ReferenceCache&
+  _openReferenceCache(std::string const& fasta) {
+    TReferenceCacheMap& caches = _referenceCaches();
+    TReferenceCacheMap::iterator it = caches.find(fasta);
+    if (it != caches.end()) return it->second;
+    ReferenceCache& rc = caches[fasta];
+    TReferenceCacheFileMap::const_iterator cf = _referenceCacheFiles().find(fasta);
+    struct stat fastaStat;
+    if ((cf != _referenceCacheFiles().end()) && (stat(fasta.c_str(), &fastaStat) == 0)) {
+      if (!_mapReferenceCache(cf->second, fastaStat, rc)) {
+	if (_buildReferenceCache(fasta, cf->second, fastaStat)) _mapReferenceCache(cf->second, fastaStat, rc);
+      }
+      if (!rc.mapped) std::cerr << "Warning: Reference cache " << cf->second << " is unusable, using faidx." << std::endl;
+    }
+    if (!rc.mapped) rc.fai = fai_load(fasta.c_str());
+    return rc;
+  }
+
+  // Full sequence of a contig, NULL if the contig is unknown. Release with releaseReference.
+  inline char*
+  fetchReference(boost::filesystem::path const& fasta, std::string const& chr, int32_t& seqlen) {
+    char* seq = NULL;
+    seqlen = -1;
+#pragma omp critical (refcache)
+    {
+      ReferenceCache& rc = _openReferenceCache(fasta.string());
+      if (rc.mapped) {
+	std::map<std::string, ReferenceCache::TOffsetLength>::const_iterator it = rc.contigs.find(chr);
+	if (it != rc.contigs.end()) {
+	  seq = rc.base + it->second.first;
+	  seqlen = it->second.second;
+	}
+      } else if (rc.fai != NULL) {
+	seq = faidx_fetch_seq(rc.fai, chr.c_str(), 0, faidx_seq_len(rc.fai, chr.c_str()), &seqlen);
+      }
+    }
+    return seq;
+  }
+
+  // Mapped sequences are shared, only faidx fall-back copies are freed
+  inline void
+  releaseReference(char* seq) {
+    if (seq == NULL) return;
+    bool isMapped = false;
+#pragma omp critical (refcache)
+    {
+      TReferenceCacheMap& caches = _referenceCaches();
+      for(TReferenceCacheMap::const_iterator it = caches.begin(); it != caches.end(); ++it) {
+	if ((it->second.mapped) && (seq >= it->second.base) && (seq < it->second.base + it->second.length)) {
+	  isMapped = true;
+	  break;
+	}
+      }
+    }
+    if (!isMapped) free(seq);
+  }
+
+}
+
+#endif
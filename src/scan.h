@@ -13,7 +13,11 @@
 #include <htslib/sam.h>
 
 #include "version.h"
+#include "refcache.h"
+#include "gctrack.h"
 #include "util.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 
 namespace torali
@@ -81,6 +85,7 @@ namespace torali
 
     // Load bam file
     samFile* samfile = sam_open(c.bamFile.string().c_str(), "r");
+    ioThreadsAttach(samfile);
     hts_set_fai_filename(samfile, c.genome.string().c_str());
     hts_idx_t* idx = sam_index_load(samfile, c.bamFile.string().c_str());
     bam_hdr_t* hdr = sam_hdr_read(samfile);
@@ -117,7 +122,8 @@ namespace torali
 
     // Iterate chromosomes
     uint64_t totalCov = 0;
-    faidx_t* faiMap = fai_load(c.mapFile.string().c_str());
+    faidx_t* faiMap = NULL;
+    if (!c.hasTrackFile) faiMap = fai_load(c.mapFile.string().c_str());
     for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
       ++show_progress;
       if (chrNoData(c, refIndex, idx)) continue;
@@ -126,22 +132,25 @@ namespace torali
       // Exclude sex chromosomes
       if ((std::string(hdr->target_name[refIndex]) == "chrX") || (std::string(hdr->target_name[refIndex]) == "chrY") || (std::string(hdr->target_name[refIndex]) == "X") || (std::string(hdr->target_name[refIndex]) == "Y")) continue;
 
-      // Check presence in mappability map
-      std::string tname(hdr->target_name[refIndex]);
-      int32_t seqlen = faidx_seq_len(faiMap, tname.c_str());
-      if (seqlen == -1) continue;
-      else seqlen = -1;
-      char* seq = faidx_fetch_seq(faiMap, tname.c_str(), 0, faidx_seq_len(faiMap, tname.c_str()), &seqlen);
-
       // Get Mappability
+      std::string tname(hdr->target_name[refIndex]);
       std::vector<uint16_t> uniqContent(hdr->target_len[refIndex], 0);
-      {
+      if (c.hasTrackFile) {
+	if (!gcTrackContent(c.trackFile, tname, hdr->target_len[refIndex], c.meanisize, uniqContent, NULL)) continue;
+      } else {
+	// Check presence in mappability map
+	int32_t seqlen = faidx_seq_len(faiMap, tname.c_str());
+	if (seqlen == -1) continue;
+	else seqlen = -1;
+	char* seq = fetchReference(c.mapFile, tname, seqlen);
+
 	// Mappability map
 	typedef boost::dynamic_bitset<> TBitSet;
 	TBitSet uniq(hdr->target_len[refIndex], false);
 	for(uint32_t i = 0; i < hdr->target_len[refIndex]; ++i) {
 	  if (seq[i] == 'C') uniq[i] = 1;
 	}
+	releaseReference(seq);
 
 	// Sum across fragments
 	int32_t halfwin = (int32_t) (c.meanisize / 2);
@@ -186,7 +195,9 @@ namespace torali
       bam1_t* rec = bam_init1();
       int32_t lastAlignedPos = 0;
       std::set<std::size_t> lastAlignedPosReads;
+      uint64_t nread = 0;
       while (sam_itr_next(samfile, iter, rec) >= 0) {
+	++nread;
 	if (rec->core.flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP | BAM_FSUPPLEMENTARY | BAM_FUNMAP)) continue;
 	if ((rec->core.flag & BAM_FPAIRED) && ((rec->core.flag & BAM_FMUNMAP) || (rec->core.tid != rec->core.mtid))) continue;
 	if (rec->core.qual < c.minQual) continue;
@@ -233,11 +244,11 @@ namespace torali
       // Clean-up
       bam_destroy1(rec);
       hts_itr_destroy(iter);
-      if (seq != NULL) free(seq);
+      metricsReads(nread);
     }
     
     // clean-up
-    fai_destroy(faiMap);
+    if (faiMap != NULL) fai_destroy(faiMap);
     bam_hdr_destroy(hdr);
     hts_idx_destroy(idx);
     sam_close(samfile);
@@ -36,6 +36,10 @@
 #include "split.h"
 #include "junction.h"
 #include "cluster.h"
+#include "evidence.h"
+#include "refcache.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -45,7 +49,88 @@
 
 namespace torali
 {
-  
+
+  // Independent unit of work of the discovery scan
+  struct ScanRegion {
+    uint32_t file_c;
+    int32_t refIndex;
+    int32_t rstart;
+    int32_t rend;
+
+    ScanRegion(uint32_t const f, int32_t const r, int32_t const s, int32_t const e) : file_c(f), refIndex(r), rstart(s), rend(e) {}
+  };
+
+  // Paired-end observation, mates are matched after the scan in region order
+  struct PairObservation {
+    std::size_t hv;
+    int32_t svt;
+    int32_t alen;
+    int32_t brIdx;  // -1 for the first read of a pair
+    uint8_t qual;
+
+    PairObservation(std::size_t const h, int32_t const s, int32_t const a, uint8_t const q, int32_t const b) : hv(h), svt(s), alen(a), brIdx(b), qual(q) {}
+  };
+
+  // Orient and store a split-read of a given SV
+  template<typename TStructuralVariantRecord, typename TSVSequences, typename TQualVectors>
+  inline void
+  _collectSplitRead(std::vector<TStructuralVariantRecord> const& svs, int32_t const svid, int32_t const tid, int32_t const pos, uint8_t const qual, std::string& sequence, uint32_t const maxReadPerSV, TSVSequences& seqStore, TQualVectors& qualStore, TSVSequences& traStore, TQualVectors& traQualStore)
+  {
+    if (svid != (int32_t) svs[svid].id) return;  // Should never happen
+
+    // Adjust orientation
+    bool bpPoint = false;
+    if (_translocation(svs[svid].svt)) {
+      if (tid == svs[svid].chr2) bpPoint = true;
+    } else {
+      // Only relevant for inversions
+      if (svs[svid].svt == 0) {
+	if (pos + 25 > svs[svid].svStart) bpPoint = true;
+	else bpPoint = false;
+      } else if (svs[svid].svt == 1) {
+	if (pos + 25 > svs[svid].svEnd) bpPoint = true;
+	else bpPoint = false;
+      }
+    }
+    _adjustOrientation(sequence, bpPoint, svs[svid].svt);
+		
+    // At most n split-reads
+    if (seqStore[svid].size() < maxReadPerSV) {
+      bool insertSuccess = false;
+      if (_translocation(svs[svid].svt)) insertSuccess = traStore[svid].insert(sequence).second;
+      else insertSuccess = seqStore[svid].insert(sequence).second;
+      // Store qualities
+      if (insertSuccess) {
+	if (_translocation(svs[svid].svt)) traQualStore[svid].push_back(qual);
+	else qualStore[svid].push_back(qual);
+      }
+    }
+  }
+
+  // Consensus of the split-reads of one SV, only the SV record and its qualities are modified
+  template<typename TConfig, typename TSequences, typename TQualities, typename TStructuralVariantRecord>
+  inline void
+  _assembleSV(TConfig const& c, bam_hdr_t* hdr, char const* seq, char const* sndSeq, TSequences const& seqs, TQualities& quals, TStructuralVariantRecord& sv)
+  {
+    bool msaSuccess = false;
+    if (seqs.size() > 1) {
+      msa(c, seqs, sv.consensus);
+      if (alignConsensus(c, hdr, seq, sndSeq, sv)) msaSuccess = true;
+    }
+    if (!msaSuccess) {
+      sv.consensus = "";
+      sv.srSupport = 0;
+      sv.srAlignQuality = 0;
+    } else {
+      // SR support and qualities
+      std::sort(quals.begin(), quals.end());
+      sv.mapq = 0;
+      for(uint32_t i = 0; i < quals.size(); ++i) sv.mapq += quals[i];
+      sv.srSupport = seqs.size();
+      sv.srMapQuality = quals[quals.size()/2];
+    }
+  }
+
   template<typename TConfig, typename TValidRegion, typename TSRStore, typename TStructuralVariantRecord>
   inline void
   assembleSplitReads(TConfig const& c, TValidRegion const& validRegions, TSRStore const& srStore, std::vector<TStructuralVariantRecord>& svs) 
@@ -60,6 +145,7 @@ namespace torali
     TIndex idx(c.files.size());
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
+      ioThreadsAttach(samfile[file_c]);
       hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
       idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
     }
@@ -74,12 +160,23 @@ namespace torali
     typedef std::vector<TQualities> TQualVectors;
     TQualVectors traQualStore(svs.size(), TQualities());
     
+    // Split-read evidence sidecar
+    std::vector<EvidenceChunk> evChunks;
+    std::ifstream evIn;
+    bool useEvidence = false;
+    if (c.hasEvidenceFile) {
+      if (evidenceLoadIndex(c.evidencefile, evChunks)) {
+	evIn.open(c.evidencefile.string().c_str(), std::ios::in | std::ios::binary);
+	useEvidence = evIn.good();
+      }
+      if (!useEvidence) std::cerr << "Warning: Evidence sidecar " << c.evidencefile.string() << " is unusable, re-reading alignments." << std::endl;
+    }
+
     // Parse BAM
     boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
     std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Split-read assembly" << std::endl;
     boost::progress_display show_progress( 2 * hdr->n_targets );
 
-    faidx_t* fai = fai_load(c.genome.string().c_str());
     for(int32_t refIndex = 0; refIndex < hdr->n_targets; ++refIndex) {
       ++show_progress;
       if (validRegions[refIndex].empty()) continue;
@@ -88,7 +185,7 @@ namespace torali
       // Load sequence
       int32_t seqlen = -1;
       std::string tname(hdr->target_name[refIndex]);
-      char* seq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex], &seqlen);
+      char* seq = fetchReference(c.genome, tname, seqlen);
       
       // Collect all split-read pos
       typedef boost::dynamic_bitset<> TBitSet;
@@ -100,90 +197,68 @@ namespace torali
       TQualVectors qualStore(svs.size(), TQualities());
       
       // Collect reads from all samples
-      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-	// Read alignments
-	for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); vRIt != validRegions[refIndex].end(); ++vRIt) {
-	  hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, vRIt->lower(), vRIt->upper());
-	  bam1_t* rec = bam_init1();
-	  while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
-	    if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
-	    if ((rec->core.qual < c.minMapQual) || (rec->core.tid<0)) continue;
-	    if (!hits[rec->core.pos]) continue;
+      if (useEvidence) {
+	std::string buf;
+	EvidenceRead er;
+	typename std::vector<EvidenceChunk>::const_iterator itChunk = std::lower_bound(evChunks.begin(), evChunks.end(), EvidenceChunk(0, refIndex, 0, 0, 0, 0), SortEvidenceChunk<EvidenceChunk>());
+	for(; ((itChunk != evChunks.end()) && (itChunk->refIndex == refIndex)); ++itChunk) {
+	  if (!evidenceReadChunk(evIn, *itChunk, buf)) {
+	    std::cerr << "Warning: Truncated evidence sidecar " << c.evidencefile.string() << std::endl;
+	    break;
+	  }
+	  std::size_t k = 0;
+	  while (_evidenceNext(buf, k, er)) {
+	    if (!hits[er.pos]) continue;
 
 	    // Valid split-read
-	    std::size_t seed = hash_string(bam_get_qname(rec));
-	    typename TPosReadSV::const_iterator it = srStore[refIndex].find(std::make_pair(rec->core.pos, seed));
-	    if (it != srStore[refIndex].end()) {
-	      int32_t svid = it->second;
-
-	      // Get the sequence
-	      if (svid == (int32_t) svs[svid].id) {  // Should be always true
+	    typename TPosReadSV::const_iterator it = srStore[refIndex].find(std::make_pair(er.pos, (std::size_t) er.seed));
+	    if (it != srStore[refIndex].end()) _collectSplitRead(svs, it->second, refIndex, er.pos, er.qual, er.sequence, maxReadPerSV, seqStore, qualStore, traStore, traQualStore);
+	  }
+	}
+      } else {
+	for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+	  // Read alignments
+	  for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); vRIt != validRegions[refIndex].end(); ++vRIt) {
+	    hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, vRIt->lower(), vRIt->upper());
+	    bam1_t* rec = bam_init1();
+	    uint64_t nread = 0;
+	    while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
+	      ++nread;
+	      if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP | BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
+	      if ((rec->core.qual < c.minMapQual) || (rec->core.tid<0)) continue;
+	      if (!hits[rec->core.pos]) continue;
+
+	      // Valid split-read
+	      std::size_t seed = hash_string(bam_get_qname(rec));
+	      typename TPosReadSV::const_iterator it = srStore[refIndex].find(std::make_pair(rec->core.pos, seed));
+	      if (it != srStore[refIndex].end()) {
+		// Get the sequence
 		std::string sequence;
 		sequence.resize(rec->core.l_qseq);
 		uint8_t* seqptr = bam_get_seq(rec);
 		for (int i = 0; i < rec->core.l_qseq; ++i) sequence[i] = "=ACMGRSVTWYHKDBN"[bam_seqi(seqptr, i)];
-
-		// Adjust orientation
-		bool bpPoint = false;
-		if (_translocation(svs[svid].svt)) {
-		  if (rec->core.tid == svs[svid].chr2) bpPoint = true;
-		} else {
-		  // Only relevant for inversions
-		  if (svs[svid].svt == 0) {
-		    if (rec->core.pos + 25 > svs[svid].svStart) bpPoint = true;
-		    else bpPoint = false;
-		  } else if (svs[svid].svt == 1) {
-		    if (rec->core.pos + 25 > svs[svid].svEnd) bpPoint = true;
-		    else bpPoint = false;
-		  }
-		}
-		_adjustOrientation(sequence, bpPoint, svs[svid].svt);
-		
-		// At most n split-reads
-		if (seqStore[svid].size() < maxReadPerSV) {
-		  bool insertSuccess = false;
-		  if (_translocation(svs[svid].svt)) insertSuccess = traStore[svid].insert(sequence).second;
-		  else insertSuccess = seqStore[svid].insert(sequence).second;
-		  // Store qualities
-		  if (insertSuccess) {
-		    if (_translocation(svs[svid].svt)) traQualStore[svid].push_back(rec->core.qual);
-		    else qualStore[svid].push_back(rec->core.qual);
-		  }
-		}
+		_collectSplitRead(svs, it->second, rec->core.tid, rec->core.pos, rec->core.qual, sequence, maxReadPerSV, seqStore, qualStore, traStore, traQualStore);
 	      }
 	    }
+	    bam_destroy1(rec);
+	    metricsReads(nread);
+	    hts_itr_destroy(iter);
 	  }
-	  bam_destroy1(rec);
-          hts_itr_destroy(iter);
 	}
       }
 
-      // Process all SVs on this chromosome
+      // Process all SVs on this chromosome, SVs are independent and assembled in parallel
+      std::vector<uint32_t> svids;
       for(uint32_t svid = 0; svid < seqStore.size(); ++svid) {
 	if (_translocation(svs[svid].svt)) continue;
 	if (svs[svid].chr != refIndex) continue;
-
-	// MSA
-	bool msaSuccess = false;
-	if (seqStore[svid].size() > 1) {
-	  msa(c, seqStore[svid], svs[svid].consensus);
-	  if (alignConsensus(c, hdr, seq, NULL, svs[svid])) msaSuccess = true;
-	}
-	if (!msaSuccess) {
-	  svs[svid].consensus = "";
-	  svs[svid].srSupport = 0;
-	  svs[svid].srAlignQuality = 0;
-	} else {
-	  // SR support and qualities
-	  std::sort(qualStore[svid].begin(), qualStore[svid].end());
-	  svs[svid].mapq = 0;
-	  for(uint32_t i = 0; i < qualStore[svid].size(); ++i) svs[svid].mapq += qualStore[svid][i];
-	  svs[svid].srSupport = seqStore[svid].size();
-	  svs[svid].srMapQuality = qualStore[svid][qualStore[svid].size()/2];
-	}
+	svids.push_back(svid);
       }
+#pragma omp parallel for default(shared) schedule(dynamic)
+      for(int32_t i = 0; i < (int32_t) svids.size(); ++i) _assembleSV(c, hdr, seq, NULL, seqStore[svids[i]], qualStore[svids[i]], svs[svids[i]]);
+
       // Clean-up
-      if (seq != NULL) free(seq);
+      releaseReference(seq);
     }
 
     // Process translocations
@@ -196,46 +271,33 @@ namespace torali
 	char* seq = NULL;
 
 	// Iterate SVs
+	std::vector<uint32_t> svids;
 	for(uint32_t svid = 0; svid < traStore.size(); ++svid) {
 	  if (!_translocation(svs[svid].svt)) continue;
 	  if ((svs[svid].chr != refIndex) || (svs[svid].chr2 != refIndex2)) continue;
-
-	  bool msaSuccess = false;
+	  svids.push_back(svid);
 	  if (traStore[svid].size() > 1) {
 	    // Lazy loading of references
 	    if (seq == NULL) {
 	      int32_t seqlen = -1;
 	      std::string tname(hdr->target_name[refIndex]);
-	      seq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex], &seqlen);
+	      seq = fetchReference(c.genome, tname, seqlen);
 	    }
 	    if (sndSeq == NULL) {
 	      int32_t seqlen = -1;
 	      std::string tname(hdr->target_name[refIndex2]);
-	      sndSeq = faidx_fetch_seq(fai, tname.c_str(), 0, hdr->target_len[refIndex2], &seqlen);
+	      sndSeq = fetchReference(c.genome, tname, seqlen);
 	    }
-	    msa(c, traStore[svid], svs[svid].consensus);
-	    if (alignConsensus(c, hdr, seq, sndSeq, svs[svid])) msaSuccess = true;
-	  }
-	  if (!msaSuccess) {
-	    svs[svid].consensus = "";
-	    svs[svid].srSupport = 0;
-	    svs[svid].srAlignQuality = 0;
-	  } else {
-	    // SR support and qualities
-	    std::sort(traQualStore[svid].begin(), traQualStore[svid].end());
-	    svs[svid].mapq = 0;
-	    for(uint32_t i = 0; i < traQualStore[svid].size(); ++i) svs[svid].mapq += traQualStore[svid][i];
-	    svs[svid].srSupport = traStore[svid].size();
-	    svs[svid].srMapQuality = traQualStore[svid][traQualStore[svid].size()/2];
 	  }
 	}
-	if (seq != NULL) free(seq);
+#pragma omp parallel for default(shared) schedule(dynamic)
+	for(int32_t i = 0; i < (int32_t) svids.size(); ++i) _assembleSV(c, hdr, seq, sndSeq, traStore[svids[i]], traQualStore[svids[i]], svs[svids[i]]);
+	releaseReference(seq);
       }
-      if (sndSeq != NULL) free(sndSeq);
+      releaseReference(sndSeq);
     }
 
     // Clean-up
-    fai_destroy(fai);
     bam_hdr_destroy(hdr);
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
       hts_idx_destroy(idx[file_c]);
@@ -244,8 +306,76 @@ namespace torali
   }
 
       
-  template<typename TConfig, typename TValidRegion, typename TSRStore, typename TSampleLib>
+  // Merge the regions of one sample in scan order and free them, mates are matched across the regions of a sample
+  template<typename TConfig, typename TReadBp, typename TPairObservations, typename TBamRecord, typename TSvtSRBamRecord, typename TSvtBamRecord, typename TLibrary>
   inline void
+  _mergeScanRegions(TConfig const& c, std::vector<ScanRegion> const& scanRegions, uint32_t const file_c, std::vector<TReadBp>& regionReadBp, std::vector<TPairObservations>& regionPairObs, std::vector<TBamRecord>& regionBamRecord, TSvtSRBamRecord& fileSRBR, TSvtBamRecord& fileBamRecord, TLibrary& lib)
+  {
+    typedef typename TReadBp::mapped_type TJunctionVector;
+
+    // Inter-chromosomal mate map and alignment length
+    typedef std::pair<uint8_t, int32_t> TQualLen;
+    typedef boost::unordered_map<std::size_t, TQualLen> TMateMap;
+    TMateMap matetra;
+
+    // Intra-chromosomal mate map and alignment length
+    TMateMap mateMap;
+    int32_t mateMapRefIndex = -1;
+
+    // Split-read junctions
+    TReadBp readBp;
+      
+    for(uint32_t task = 0; task < scanRegions.size(); ++task) {
+      if (scanRegions[task].file_c != file_c) continue;
+      if (scanRegions[task].refIndex != mateMapRefIndex) {
+	mateMap.clear();
+	mateMapRefIndex = scanRegions[task].refIndex;
+      }
+
+      // Append junctions
+      for(typename TReadBp::iterator it = regionReadBp[task].begin(); it != regionReadBp[task].end(); ++it) {
+	TJunctionVector& jv = readBp[it->first];
+	jv.insert(jv.end(), it->second.begin(), it->second.end());
+      }
+      TReadBp().swap(regionReadBp[task]);
+
+      // Match mates
+      for(typename TPairObservations::const_iterator itPO = regionPairObs[task].begin(); itPO != regionPairObs[task].end(); ++itPO) {
+	TMateMap& mm = _translocation(itPO->svt) ? matetra : mateMap;
+	if (itPO->brIdx == -1) {
+	  // First read
+	  mm[itPO->hv] = std::make_pair(itPO->qual, itPO->alen);
+	} else {
+	  // Second read
+	  typename TMateMap::iterator itMate = mm.find(itPO->hv);
+	  if ((itMate == mm.end()) || (!itMate->second.first)) continue; // Mate discarded
+	  typename TBamRecord::value_type& br = regionBamRecord[task][itPO->brIdx];
+	  br.MapQuality = std::min((uint8_t) itMate->second.first, (uint8_t) itPO->qual);
+	  br.malen = (uint16_t) itMate->second.second;
+	  itMate->second.first = 0;
+	  fileBamRecord[itPO->svt].push_back(br);
+	  ++lib.abnormal_pairs;
+	}
+      }
+      TPairObservations().swap(regionPairObs[task]);
+      TBamRecord().swap(regionBamRecord[task]);
+    }
+
+    // Process all junctions for this BAM file
+    for(typename TReadBp::iterator it = readBp.begin(); it != readBp.end(); ++it) {
+      std::sort(it->second.begin(), it->second.end(), SortJunction<Junction>());
+    }
+	
+    // Collect split-read SVs
+    if ((!c.svtcmd) || (c.svtset.find(2) != c.svtset.end())) selectDeletions(c, readBp, fileSRBR);
+    if ((!c.svtcmd) || (c.svtset.find(3) != c.svtset.end())) selectDuplications(c, readBp, fileSRBR);
+    if ((!c.svtcmd) || (c.svtset.find(0) != c.svtset.end()) || (c.svtset.find(1) != c.svtset.end())) selectInversions(c, readBp, fileSRBR);
+    if ((!c.svtcmd) || (c.svtset.find(4) != c.svtset.end())) selectInsertions(c, readBp, fileSRBR);
+    if ((!c.svtcmd) || (c.svtset.find(DELLY_SVT_TRANS) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 1) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 2) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 3) != c.svtset.end())) selectTranslocations(c, readBp, fileSRBR);
+  }
+
+  template<typename TConfig, typename TValidRegion, typename TSRStore, typename TSampleLib>
+  inline bool
   scanPEandSR(TConfig const& c, TValidRegion const& validRegions, std::vector<StructuralVariantRecord>& svs, std::vector<StructuralVariantRecord>& srSVs, TSRStore& srStore, TSampleLib& sampleLib)
   {
     typedef typename TValidRegion::value_type TChrIntervals;
@@ -272,167 +402,217 @@ namespace torali
     typedef std::vector<TBamRecord> TSvtBamRecord;
     TSvtBamRecord bamRecord(2 * DELLY_SVT_TRANS, TBamRecord());
      
-    // Parse genome, process chromosome by chromosome
-    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
-    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Paired-end and split-read scanning" << std::endl;
-    boost::progress_display show_progress( c.files.size() * hdr->n_targets );
-    // Iterate all samples
-#pragma omp parallel for default(shared)
+    // Scan tasks: one per sample, chromosome and valid region
+    typedef std::vector<ScanRegion> TScanRegions;
+    TScanRegions scanRegions;
     for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      // Inter-chromosomal mate map and alignment length
-      typedef std::pair<uint8_t, int32_t> TQualLen;
-      typedef boost::unordered_map<std::size_t, TQualLen> TMateMap;
-      std::vector<TMateMap> matetra(c.files.size());
-
-      // Split-read junctions
-      typedef std::vector<Junction> TJunctionVector;
-      typedef std::map<unsigned, TJunctionVector> TReadBp;
-      TReadBp readBp;
-      
-      // Iterate all chromosomes for that sample
+      std::string suffix("cram");
+      std::string str(c.files[file_c].string());
+      bool isCram = ((str.size() >= suffix.size()) && (str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0));
       for(int32_t refIndex=0; refIndex < (int32_t) hdr->n_targets; ++refIndex) {
-	++show_progress;
-
 	// Any data?
 	if (validRegions[refIndex].empty()) continue;
-	bool nodata = true;
-	std::string suffix("cram");
-	std::string str(c.files[file_c].string());
-	if ((str.size() >= suffix.size()) && (str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0)) nodata = false;
-	uint64_t mapped = 0;
-	uint64_t unmapped = 0;
-	hts_idx_get_stat(idx[file_c], refIndex, &mapped, &unmapped);
-	if (mapped) nodata = false;
-	if (nodata) continue;
-
-	// Intra-chromosomal mate map and alignment length
-	TMateMap mateMap;
+	if (!isCram) {
+	  uint64_t mapped = 0;
+	  uint64_t unmapped = 0;
+	  hts_idx_get_stat(idx[file_c], refIndex, &mapped, &unmapped);
+	  if (!mapped) continue;
+	}
+	for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); vRIt != validRegions[refIndex].end(); ++vRIt) scanRegions.push_back(ScanRegion(file_c, refIndex, vRIt->lower(), vRIt->upper()));
+      }
+    }
+
+    // Thread-local scan results
+    typedef std::vector<Junction> TJunctionVector;
+    typedef std::map<unsigned, TJunctionVector> TReadBp;
+    typedef std::vector<PairObservation> TPairObservations;
+    std::vector<TReadBp> regionReadBp(scanRegions.size(), TReadBp());
+    std::vector<TPairObservations> regionPairObs(scanRegions.size(), TPairObservations());
+    std::vector<TBamRecord> regionBamRecord(scanRegions.size(), TBamRecord());
+
+    // Per-sample evidence buffers, a sample is merged and its region buffers freed as soon as its last task is done
+    std::vector<TSvtSRBamRecord> fileSRBR(c.files.size(), TSvtSRBamRecord(2 * DELLY_SVT_TRANS, TSRBamRecord()));
+    std::vector<TSvtBamRecord> fileBamRecord(c.files.size(), TSvtBamRecord(2 * DELLY_SVT_TRANS, TBamRecord()));
+    std::vector<uint32_t> pendingTasks(c.files.size(), 0);
+    for(uint32_t task = 0; task < scanRegions.size(); ++task) ++pendingTasks[scanRegions[task].file_c];
+    bool failed = false;
+
+    // Split-read evidence sidecar
+    EvidenceWriter evw;
+    if ((c.hasEvidenceFile) && (!evidenceOpen(c.evidencefile, evw))) std::cerr << "Warning: Failed to open evidence sidecar " << c.evidencefile.string() << std::endl;
+     
+    // Parse genome, process region by region
+    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
+    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] " << "Paired-end and split-read scanning" << std::endl;
+    boost::progress_display show_progress( scanRegions.size() );
+#pragma omp parallel default(shared)
+    {
+      // Thread-local file handle, tasks are sample-major
+      SampleHandle sh;
+
+#pragma omp for schedule(dynamic)
+      for(int32_t task = 0; task < (int32_t) scanRegions.size(); ++task) {
+	++show_progress;
+	uint32_t file_c = scanRegions[task].file_c;
+	int32_t refIndex = scanRegions[task].refIndex;
+	if (!_sampleHandleOpen(c, file_c, sh, failed)) continue;
+	TReadBp& readBp = regionReadBp[task];
+	TPairObservations& pairObs = regionPairObs[task];
+	TBamRecord& taskBamRecord = regionBamRecord[task];
 
 	// Read alignments
-	for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); vRIt != validRegions[refIndex].end(); ++vRIt) {
-	  hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, vRIt->lower(), vRIt->upper());
-	  bam1_t* rec = bam_init1();
-	  int32_t lastAlignedPos = 0;
-	  std::set<std::size_t> lastAlignedPosReads;
-	  while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
-	    if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP)) continue;
-	    if ((rec->core.qual < c.minMapQual) || (rec->core.tid<0)) continue;
-
-	    unsigned seed = hash_string(bam_get_qname(rec));
+	hts_itr_t* iter = sam_itr_queryi(sh.idx, refIndex, scanRegions[task].rstart, scanRegions[task].rend);
+	bam1_t* rec = bam_init1();
+	int32_t lastAlignedPos = 0;
+	std::set<std::size_t> lastAlignedPosReads;
+	std::string evBuf;
+	uint32_t evPart = 0;
+	uint64_t nread = 0;
+	while (sam_itr_next(sh.samfile, iter, rec) >= 0) {
+	  ++nread;
+	  if (rec->core.flag & (BAM_FQCFAIL | BAM_FDUP | BAM_FUNMAP)) continue;
+	  if ((rec->core.qual < c.minMapQual) || (rec->core.tid<0)) continue;
+
+	  unsigned seed = hash_string(bam_get_qname(rec));
 	    
-	    // SV detection using single-end read
-	    uint32_t rp = rec->core.pos; // reference pointer
-	    uint32_t sp = 0; // sequence pointer
-
-	    // Parse the CIGAR
-	    uint32_t* cigar = bam_get_cigar(rec);
-	    for (std::size_t i = 0; i < rec->core.n_cigar; ++i) {
-	      if ((bam_cigar_op(cigar[i]) == BAM_CMATCH) || (bam_cigar_op(cigar[i]) == BAM_CEQUAL) || (bam_cigar_op(cigar[i]) == BAM_CDIFF)) {
-		sp += bam_cigar_oplen(cigar[i]);
-		rp += bam_cigar_oplen(cigar[i]);
-	      } else if (bam_cigar_op(cigar[i]) == BAM_CDEL) {
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
-		rp += bam_cigar_oplen(cigar[i]);
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, true);
-	      } else if (bam_cigar_op(cigar[i]) == BAM_CINS) {
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
-		sp += bam_cigar_oplen(cigar[i]);
-		if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, true);
-	      } else if ((bam_cigar_op(cigar[i]) == BAM_CSOFT_CLIP) || (bam_cigar_op(cigar[i]) == BAM_CHARD_CLIP)) {
-		int32_t finalsp = sp;
-		bool scleft = false;
-		if (sp == 0) {
-		  finalsp += bam_cigar_oplen(cigar[i]); // Leading soft-clip / hard-clip
-		  scleft = true;
-		}
-		sp += bam_cigar_oplen(cigar[i]);
-		if (bam_cigar_oplen(cigar[i]) > c.minClip) _insertJunction(readBp, seed, rec, rp, finalsp, scleft);
-	      } else if (bam_cigar_op(cigar[i]) == BAM_CREF_SKIP) {
-		rp += bam_cigar_oplen(cigar[i]);
-	      } else {
-		std::cerr << "Warning: Unknown Cigar operation!" << std::endl;
+	  // SV detection using single-end read
+	  uint32_t rp = rec->core.pos; // reference pointer
+	  uint32_t sp = 0; // sequence pointer
+
+	  // Parse the CIGAR
+	  bool srCandidate = false;
+	  uint32_t* cigar = bam_get_cigar(rec);
+	  for (std::size_t i = 0; i < rec->core.n_cigar; ++i) {
+	    if ((bam_cigar_op(cigar[i]) == BAM_CMATCH) || (bam_cigar_op(cigar[i]) == BAM_CEQUAL) || (bam_cigar_op(cigar[i]) == BAM_CDIFF)) {
+	      sp += bam_cigar_oplen(cigar[i]);
+	      rp += bam_cigar_oplen(cigar[i]);
+	    } else if (bam_cigar_op(cigar[i]) == BAM_CDEL) {
+	      if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
+	      rp += bam_cigar_oplen(cigar[i]);
+	      if (bam_cigar_oplen(cigar[i]) > c.minRefSep) {
+		_insertJunction(readBp, seed, rec, rp, sp, true);
+		srCandidate = true;
 	      }
-	    }
-	    
-	    // Paired-end clustering
-	    if (rec->core.flag & BAM_FPAIRED) {
-	      // Single-end library
-	      if (sampleLib[file_c].median == 0) continue; // Single-end library
-
-	      // Secondary/supplementary alignments, mate unmapped or blacklisted chr
-	      if (rec->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
-	      if ((rec->core.mtid<0) || (rec->core.flag & BAM_FMUNMAP)) continue;
-	      if (validRegions[rec->core.mtid].empty()) continue;
-	      if ((_translocation(rec)) && (rec->core.qual < c.minTraQual)) continue;
-
-	      // SV type	      
-	      int32_t svt = _isizeMappingPos(rec, sampleLib[file_c].maxISizeCutoff);
-	      if (svt == -1) continue;
-	      if ((c.svtcmd) && (c.svtset.find(svt) == c.svtset.end())) continue;
-
-	      // Check library-specific insert size for deletions
-	      if ((svt == 2) && (sampleLib[file_c].maxISizeCutoff > std::abs(rec->core.isize))) continue;
-	      
-	      // Clean-up the read store for identical alignment positions
-	      if (rec->core.pos > lastAlignedPos) {
-		lastAlignedPosReads.clear();
-		lastAlignedPos = rec->core.pos;
+	    } else if (bam_cigar_op(cigar[i]) == BAM_CINS) {
+	      if (bam_cigar_oplen(cigar[i]) > c.minRefSep) _insertJunction(readBp, seed, rec, rp, sp, false);
+	      sp += bam_cigar_oplen(cigar[i]);
+	      if (bam_cigar_oplen(cigar[i]) > c.minRefSep) {
+		_insertJunction(readBp, seed, rec, rp, sp, true);
+		srCandidate = true;
 	      }
-	      
-	      // Get or store the mapping quality for the partner
-	      if (_firstPairObs(rec, lastAlignedPosReads)) {
-		// First read
-		lastAlignedPosReads.insert(seed);
-		std::size_t hv = hash_pair(rec);
-		if (_translocation(svt)) matetra[file_c][hv]= std::make_pair((uint8_t) rec->core.qual, alignmentLength(rec));
-		else mateMap[hv]= std::make_pair((uint8_t) rec->core.qual, alignmentLength(rec));
-	      } else {
-		// Second read
-		std::size_t hv = hash_pair_mate(rec);
-		int32_t alenmate = 0;
-		uint8_t pairQuality = 0;
-	        if (_translocation(svt)) {
-		  // Inter-chromosomal
-		  if ((matetra[file_c].find(hv) == matetra[file_c].end()) || (!matetra[file_c][hv].first)) continue; // Mate discarded
-		  TQualLen p = matetra[file_c][hv];
-		  pairQuality = std::min((uint8_t) p.first, (uint8_t) rec->core.qual);
-		  alenmate = p.second;
-		  matetra[file_c][hv].first = 0;
-		} else {
-		  // Intra-chromosomal
-		  if ((mateMap.find(hv) == mateMap.end()) || (!mateMap[hv].first)) continue; // Mate discarded
-		  TQualLen p = mateMap[hv];
-		  pairQuality = std::min((uint8_t) p.first, (uint8_t) rec->core.qual);
-		  alenmate = p.second;
-		  mateMap[hv].first = 0;
-		}
+	    } else if ((bam_cigar_op(cigar[i]) == BAM_CSOFT_CLIP) || (bam_cigar_op(cigar[i]) == BAM_CHARD_CLIP)) {
+	      int32_t finalsp = sp;
+	      bool scleft = false;
+	      if (sp == 0) {
+		finalsp += bam_cigar_oplen(cigar[i]); // Leading soft-clip / hard-clip
+		scleft = true;
+	      }
+	      sp += bam_cigar_oplen(cigar[i]);
+	      if (bam_cigar_oplen(cigar[i]) > c.minClip) {
+		_insertJunction(readBp, seed, rec, rp, finalsp, scleft);
+		srCandidate = true;
+	      }
+	    } else if (bam_cigar_op(cigar[i]) == BAM_CREF_SKIP) {
+	      rp += bam_cigar_oplen(cigar[i]);
+	    } else {
+	      std::cerr << "Warning: Unknown Cigar operation!" << std::endl;
+	    }
+	  }
 
+	  // Keep split-read candidates for assembly
+	  if ((c.hasEvidenceFile) && (srCandidate) && (!(rec->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)))) {
+	    _evidenceAppend(evBuf, rec, seed);
+	    if (evBuf.size() >= DELLY_EVIDENCE_CHUNK) {
 #pragma omp critical
-		{
-		  bamRecord[svt].push_back(BamAlignRecord(rec, pairQuality, alignmentLength(rec), alenmate, sampleLib[file_c].median, sampleLib[file_c].mad, sampleLib[file_c].maxNormalISize));
-		}
-		++sampleLib[file_c].abnormal_pairs;
+	      {
+		evidenceWriteChunk(evw, file_c, refIndex, task, evPart, evBuf);
 	      }
+	      evBuf.clear();
+	      ++evPart;
+	    }
+	  }
+	    
+	  // Paired-end clustering
+	  if (rec->core.flag & BAM_FPAIRED) {
+	    // Single-end library
+	    if (sampleLib[file_c].median == 0) continue; // Single-end library
+
+	    // Secondary/supplementary alignments, mate unmapped or blacklisted chr
+	    if (rec->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)) continue;
+	    if ((rec->core.mtid<0) || (rec->core.flag & BAM_FMUNMAP)) continue;
+	    if (validRegions[rec->core.mtid].empty()) continue;
+	    if ((_translocation(rec)) && (rec->core.qual < c.minTraQual)) continue;
+
+	    // SV type	      
+	    int32_t svt = _isizeMappingPos(rec, sampleLib[file_c].maxISizeCutoff);
+	    if (svt == -1) continue;
+	    if ((c.svtcmd) && (c.svtset.find(svt) == c.svtset.end())) continue;
+
+	    // Check library-specific insert size for deletions
+	    if ((svt == 2) && (sampleLib[file_c].maxISizeCutoff > std::abs(rec->core.isize))) continue;
+	      
+	    // Clean-up the read store for identical alignment positions
+	    if (rec->core.pos > lastAlignedPos) {
+	      lastAlignedPosReads.clear();
+	      lastAlignedPos = rec->core.pos;
+	    }
+	      
+	    // Record the pair observation, mates are matched when merging the regions
+	    if (_firstPairObs(rec, lastAlignedPosReads)) {
+	      // First read
+	      lastAlignedPosReads.insert(seed);
+	      pairObs.push_back(PairObservation(hash_pair(rec), svt, alignmentLength(rec), rec->core.qual, -1));
+	    } else {
+	      // Second read, pair quality and mate alignment length are set once the mate is known
+	      pairObs.push_back(PairObservation(hash_pair_mate(rec), svt, 0, rec->core.qual, taskBamRecord.size()));
+	      taskBamRecord.push_back(BamAlignRecord(rec, rec->core.qual, alignmentLength(rec), 0, sampleLib[file_c].median, sampleLib[file_c].mad, sampleLib[file_c].maxNormalISize));
 	    }
 	  }
-	  bam_destroy1(rec);
-	  hts_itr_destroy(iter);
 	}
+	bam_destroy1(rec);
+	metricsReads(nread);
+	hts_itr_destroy(iter);
+	if (!evBuf.empty()) {
+#pragma omp critical
+	  {
+	    evidenceWriteChunk(evw, file_c, refIndex, task, evPart, evBuf);
+	  }
+	}
+
+	// Last task of this sample?
+	bool lastTask = false;
+#pragma omp critical (scanmerge)
+	lastTask = (--pendingTasks[file_c] == 0);
+	if (lastTask) _mergeScanRegions(c, scanRegions, file_c, regionReadBp, regionPairObs, regionBamRecord, fileSRBR[file_c], fileBamRecord[file_c], sampleLib[file_c]);
+      }
+      _sampleHandleClose(sh);
+    }
+
+    if ((c.hasEvidenceFile) && (!evidenceClose(evw))) std::cerr << "Warning: Failed to close evidence sidecar " << c.evidencefile.string() << std::endl;
+    if (failed) {
+      bam_hdr_destroy(hdr);
+      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+	hts_idx_destroy(idx[file_c]);
+	sam_close(samfile[file_c]);
       }
+      return false;
+    }
 
-      // Process all junctions for this BAM file
-      for(typename TReadBp::iterator it = readBp.begin(); it != readBp.end(); ++it) {
-	std::sort(it->second.begin(), it->second.end(), SortJunction<Junction>());
+    // Concatenate evidence in sample order
+    for(uint32_t svt = 0; svt < 2 * DELLY_SVT_TRANS; ++svt) {
+      std::size_t srCount = 0;
+      std::size_t peCount = 0;
+      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+	srCount += fileSRBR[file_c][svt].size();
+	peCount += fileBamRecord[file_c][svt].size();
       }
-	
-      // Collect split-read SVs
-#pragma omp critical
-      {
-	if ((!c.svtcmd) || (c.svtset.find(2) != c.svtset.end())) selectDeletions(c, readBp, srBR);
-	if ((!c.svtcmd) || (c.svtset.find(3) != c.svtset.end())) selectDuplications(c, readBp, srBR);
-	if ((!c.svtcmd) || (c.svtset.find(0) != c.svtset.end()) || (c.svtset.find(1) != c.svtset.end())) selectInversions(c, readBp, srBR);
-	if ((!c.svtcmd) || (c.svtset.find(4) != c.svtset.end())) selectInsertions(c, readBp, srBR);
-	if ((!c.svtcmd) || (c.svtset.find(DELLY_SVT_TRANS) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 1) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 2) != c.svtset.end()) || (c.svtset.find(DELLY_SVT_TRANS + 3) != c.svtset.end())) selectTranslocations(c, readBp, srBR);
+      srBR[svt].reserve(srCount);
+      bamRecord[svt].reserve(peCount);
+      for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
+	srBR[svt].insert(srBR[svt].end(), fileSRBR[file_c][svt].begin(), fileSRBR[file_c][svt].end());
+	TSRBamRecord().swap(fileSRBR[file_c][svt]);
+	bamRecord[svt].insert(bamRecord[svt].end(), fileBamRecord[file_c][svt].begin(), fileBamRecord[file_c][svt].end());
+	TBamRecord().swap(fileBamRecord[file_c][svt]);
       }
     }
 
@@ -497,6 +677,7 @@ namespace torali
       hts_idx_destroy(idx[file_c]);
       sam_close(samfile[file_c]);
     }
+    return true;
   }
 
 
@@ -508,9 +689,21 @@ namespace torali
 
     // Sort SR records for look-up
     sort(sr.begin(), sr.end(), SortSVs<StructuralVariantRecord>());
+
+    // Index imprecise PE SVs by type, keyed on their original (chr, svStart) because augmented records move
+    typedef std::pair<int32_t, int32_t> TChrPos;
+    typedef std::pair<TChrPos, int32_t> TPosIndex;
+    typedef std::vector<TPosIndex> TPosIndexVector;
+    std::vector<TPosIndexVector> peIndex(10, TPosIndexVector());
+    for(int32_t k = 0; k < (int32_t) pe.size(); ++k) {
+      if ((pe[k].precise) || (pe[k].svt < 0) || (pe[k].svt >= 10)) continue;
+      peIndex[pe[k].svt].push_back(std::make_pair(std::make_pair(pe[k].chr, pe[k].svStart), k));
+    }
     
-    // Augment PE SVs and append missing SR SVs
+    // Augment PE SVs and collect missing SR SVs, appended PE records are precise and never matched again
+    TVariants srOnly;
     for(int32_t svt = 0; svt < 10; ++svt) {
+      TPosIndexVector const& svtIndex = peIndex[svt];
       for(int32_t i = 0; i < (int32_t) sr.size(); ++i) {
 	if (sr[i].svt != svt) continue;
 	if ((sr[i].srSupport == 0) || (sr[i].srAlignQuality == 0)) continue; // SR assembly failed
@@ -518,10 +711,11 @@ namespace torali
 	// Precise duplicates
 	int32_t searchWindow = 500;
 	bool svExists = false;
-	typename TVariants::iterator itOther = std::lower_bound(pe.begin(), pe.end(), StructuralVariantRecord(sr[i].chr, std::max(0, sr[i].svStart - searchWindow), sr[i].svEnd), SortSVs<StructuralVariantRecord>());
-	for(; ((itOther != pe.end()) && (std::abs(itOther->svStart - sr[i].svStart) < searchWindow)); ++itOther) {
-	  if ((itOther->svt != svt) || (itOther->precise)) continue; 
-	  if ((sr[i].chr != itOther->chr) || (sr[i].chr2 != itOther->chr2)) continue;  // Mismatching chr
+	typename TPosIndexVector::const_iterator itIdx = std::lower_bound(svtIndex.begin(), svtIndex.end(), std::make_pair(std::make_pair(sr[i].chr, sr[i].svStart - searchWindow + 1), (int32_t) -1));
+	for(; ((itIdx != svtIndex.end()) && (itIdx->first.first == sr[i].chr) && (itIdx->first.second < sr[i].svStart + searchWindow)); ++itIdx) {
+	  typename TVariants::iterator itOther = pe.begin() + itIdx->second;
+	  if (itOther->precise) continue; 
+	  if (sr[i].chr2 != itOther->chr2) continue;  // Mismatching chr
 
 	  // Breakpoints within PE confidence interval?
 	  if ((itOther->svStart + itOther->ciposlow < sr[i].svStart) && (sr[i].svStart < itOther->svStart + itOther->ciposhigh)) {
@@ -577,13 +771,14 @@ namespace torali
 	      }
 	    }
 	  }
-	  if (!preciseDuplicate) {
-	    pe.push_back(sr[i]);
-	    sort(pe.begin(), pe.end(), SortSVs<StructuralVariantRecord>());
-	  }
+	  if (!preciseDuplicate) srOnly.push_back(sr[i]);
 	}
       }
     }
+
+    // Append SR only SVs and sort once
+    pe.insert(pe.end(), srOnly.begin(), srOnly.end());
+    sort(pe.begin(), pe.end(), SortSVs<StructuralVariantRecord>());
   }
   
 
@@ -4,6 +4,7 @@
 #include <iostream>
 #include "gotoh.h"
 #include "needle.h"
+#include "metrics.h"
 
 namespace torali
 {
@@ -414,6 +415,7 @@ namespace torali
     AlignConfig<true, false> semiglobal;
     DnaScore<int> lnsc(5, -4, -4, -4);
     bool reNeedle = false;
+    metricsAlignments(1);
     if (svt == 4) {
       reNeedle = longNeedle(svRefStr, cons, aln, semiglobal, lnsc);
       for(uint32_t j = 0; j < aln.shape()[1]; ++j) {
@@ -0,0 +1,273 @@
+#ifndef STRIPED_H
+#define STRIPED_H
+
+#include <iostream>
+#include <vector>
+
+#include "align.h"
+#include "needle.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DELLY_STRIPED_X86
+#include <immintrin.h>
+#endif
+
+namespace torali
+{
+
+  #ifndef DELLY_STRIPED_NEGINF
+  #define DELLY_STRIPED_NEGINF -32768
+  #endif
+
+  #ifndef DELLY_STRIPED_MAXSCORE
+  #define DELLY_STRIPED_MAXSCORE 30000
+  #endif
+
+
+  // Striped query profile, rows (s1) are distributed across the vector lanes, one profile per distinct s2 character
+  inline void
+  _stripedProfile(std::string const& s1, std::string const& s2, int16_t const match, int16_t const mismatch, int32_t const width, int32_t const segLen, std::vector<int16_t>& prof, std::vector<int32_t>& code)
+  {
+    int32_t m = s1.size();
+    int32_t n = s2.size();
+    std::vector<int32_t> charIdx(256, -1);
+    std::string alphabet;
+    code.resize(n);
+    for(int32_t j = 0; j < n; ++j) {
+      uint8_t ch = (uint8_t) s2[j];
+      if (charIdx[ch] == -1) {
+	charIdx[ch] = alphabet.size();
+	alphabet.push_back(s2[j]);
+      }
+      code[j] = charIdx[ch];
+    }
+    prof.resize(alphabet.size() * segLen * width);
+    for(uint32_t a = 0; a < alphabet.size(); ++a) {
+      for(int32_t s = 0; s < segLen; ++s) {
+	for(int32_t k = 0; k < width; ++k) {
+	  int32_t row = k * segLen + s;
+	  if ((row < m) && (s1[row] == alphabet[a])) prof[(a * segLen + s) * width + k] = match;
+	  else prof[(a * segLen + s) * width + k] = mismatch;
+	}
+      }
+    }
+  }
+
+  // Initial column and top row of the DP matrix
+  inline int16_t
+  _stripedTop(bool const horizontalFree, int32_t const col, int16_t const ge) {
+    if (horizontalFree) return 0;
+    return (int16_t) (col * ge);
+  }
+
+  inline void
+  _stripedInit(int32_t const width, int32_t const segLen, int16_t const ge, std::vector<int16_t>& h) {
+    h.resize(segLen * width);
+    for(int32_t s = 0; s < segLen; ++s)
+      for(int32_t k = 0; k < width; ++k) h[s * width + k] = (int16_t) std::max((int32_t) DELLY_STRIPED_NEGINF, (k * segLen + s + 1) * ge);
+  }
+
+
+#ifdef DELLY_STRIPED_X86
+
+  __attribute__((target("sse4.1")))
+  inline int32_t
+  _stripedNeedleSSE41(std::string const& s1, std::string const& s2, bool const horizontalFree, int16_t const match, int16_t const mismatch, int16_t const ge)
+  {
+    int32_t const width = 8;
+    int32_t m = s1.size();
+    int32_t n = s2.size();
+    int32_t segLen = (m + width - 1) / width;
+
+    // Query profile
+    std::vector<int16_t> prof;
+    std::vector<int32_t> code;
+    _stripedProfile(s1, s2, match, mismatch, width, segLen, prof, code);
+
+    // DP columns
+    std::vector<int16_t> hPrev;
+    std::vector<int16_t> hCur(segLen * width, 0);
+    _stripedInit(width, segLen, ge, hPrev);
+    __m128i vGe = _mm_set1_epi16(ge);
+    __m128i vNegInf = _mm_set1_epi16(DELLY_STRIPED_NEGINF);
+    __m128i vMaxLast = vNegInf;
+    int32_t lastSeg = (m - 1) % segLen;
+    int32_t lastLane = (m - 1) / segLen;
+
+    for(int32_t col = 1; col <= n; ++col) {
+      int16_t const* p = &prof[code[col - 1] * segLen * width];
+      __m128i vHDiag = _mm_slli_si128(_mm_loadu_si128((__m128i const*) &hPrev[(segLen - 1) * width]), 2);
+      vHDiag = _mm_insert_epi16(vHDiag, _stripedTop(horizontalFree, col - 1, ge), 0);
+      __m128i vF = _mm_insert_epi16(vNegInf, _stripedTop(horizontalFree, col, ge) + ge, 0);
+      for(int32_t s = 0; s < segLen; ++s) {
+	__m128i vHPrev = _mm_loadu_si128((__m128i const*) &hPrev[s * width]);
+	__m128i vH = _mm_adds_epi16(vHDiag, _mm_loadu_si128((__m128i const*) &p[s * width]));
+	vH = _mm_max_epi16(vH, _mm_adds_epi16(vHPrev, vGe));
+	vH = _mm_max_epi16(vH, vF);
+	_mm_storeu_si128((__m128i*) &hCur[s * width], vH);
+	vF = _mm_adds_epi16(vH, vGe);
+	vHDiag = vHPrev;
+      }
+
+      // Lazy-F loop for vertical gaps crossing segment boundaries
+      vF = _mm_insert_epi16(_mm_slli_si128(vF, 2), DELLY_STRIPED_NEGINF, 0);
+      int32_t s = 0;
+      while (true) {
+	__m128i vH = _mm_loadu_si128((__m128i const*) &hCur[s * width]);
+	if (!_mm_movemask_epi8(_mm_cmpgt_epi16(vF, vH))) break;
+	_mm_storeu_si128((__m128i*) &hCur[s * width], _mm_max_epi16(vH, vF));
+	vF = _mm_adds_epi16(vF, vGe);
+	if (++s == segLen) {
+	  s = 0;
+	  vF = _mm_insert_epi16(_mm_slli_si128(vF, 2), DELLY_STRIPED_NEGINF, 0);
+	}
+      }
+      if (horizontalFree) vMaxLast = _mm_max_epi16(vMaxLast, _mm_loadu_si128((__m128i const*) &hCur[lastSeg * width]));
+      hPrev.swap(hCur);
+    }
+
+    // Score
+    if (horizontalFree) {
+      int16_t last[8];
+      _mm_storeu_si128((__m128i*) last, vMaxLast);
+      return std::max((int32_t) last[lastLane], m * ge);
+    }
+    return hPrev[lastSeg * width + lastLane];
+  }
+
+
+  __attribute__((target("avx2")))
+  inline __m256i
+  _stripedShiftAVX2(__m256i const v, int16_t const first) {
+    __m256i shifted = _mm256_alignr_epi8(v, _mm256_permute2x128_si256(v, v, 0x08), 14);
+    return _mm256_insert_epi16(shifted, first, 0);
+  }
+
+  __attribute__((target("avx2")))
+  inline int32_t
+  _stripedNeedleAVX2(std::string const& s1, std::string const& s2, bool const horizontalFree, int16_t const match, int16_t const mismatch, int16_t const ge)
+  {
+    int32_t const width = 16;
+    int32_t m = s1.size();
+    int32_t n = s2.size();
+    int32_t segLen = (m + width - 1) / width;
+
+    // Query profile
+    std::vector<int16_t> prof;
+    std::vector<int32_t> code;
+    _stripedProfile(s1, s2, match, mismatch, width, segLen, prof, code);
+
+    // DP columns
+    std::vector<int16_t> hPrev;
+    std::vector<int16_t> hCur(segLen * width, 0);
+    _stripedInit(width, segLen, ge, hPrev);
+    __m256i vGe = _mm256_set1_epi16(ge);
+    __m256i vNegInf = _mm256_set1_epi16(DELLY_STRIPED_NEGINF);
+    __m256i vMaxLast = vNegInf;
+    int32_t lastSeg = (m - 1) % segLen;
+    int32_t lastLane = (m - 1) / segLen;
+
+    for(int32_t col = 1; col <= n; ++col) {
+      int16_t const* p = &prof[code[col - 1] * segLen * width];
+      __m256i vHDiag = _stripedShiftAVX2(_mm256_loadu_si256((__m256i const*) &hPrev[(segLen - 1) * width]), _stripedTop(horizontalFree, col - 1, ge));
+      __m256i vF = _mm256_insert_epi16(vNegInf, _stripedTop(horizontalFree, col, ge) + ge, 0);
+      for(int32_t s = 0; s < segLen; ++s) {
+	__m256i vHPrev = _mm256_loadu_si256((__m256i const*) &hPrev[s * width]);
+	__m256i vH = _mm256_adds_epi16(vHDiag, _mm256_loadu_si256((__m256i const*) &p[s * width]));
+	vH = _mm256_max_epi16(vH, _mm256_adds_epi16(vHPrev, vGe));
+	vH = _mm256_max_epi16(vH, vF);
+	_mm256_storeu_si256((__m256i*) &hCur[s * width], vH);
+	vF = _mm256_adds_epi16(vH, vGe);
+	vHDiag = vHPrev;
+      }
+
+      // Lazy-F loop for vertical gaps crossing segment boundaries
+      vF = _stripedShiftAVX2(vF, DELLY_STRIPED_NEGINF);
+      int32_t s = 0;
+      while (true) {
+	__m256i vH = _mm256_loadu_si256((__m256i const*) &hCur[s * width]);
+	if (!_mm256_movemask_epi8(_mm256_cmpgt_epi16(vF, vH))) break;
+	_mm256_storeu_si256((__m256i*) &hCur[s * width], _mm256_max_epi16(vH, vF));
+	vF = _mm256_adds_epi16(vF, vGe);
+	if (++s == segLen) {
+	  s = 0;
+	  vF = _stripedShiftAVX2(vF, DELLY_STRIPED_NEGINF);
+	}
+      }
+      if (horizontalFree) vMaxLast = _mm256_max_epi16(vMaxLast, _mm256_loadu_si256((__m256i const*) &hCur[lastSeg * width]));
+      hPrev.swap(hCur);
+    }
+
+    // Score
+    if (horizontalFree) {
+      int16_t last[16];
+      _mm256_storeu_si256((__m256i*) last, vMaxLast);
+      return std::max((int32_t) last[lastLane], m * ge);
+    }
+    return hPrev[lastSeg * width + lastLane];
+  }
+
+#endif
+
+
+  // Instruction set available at runtime: 2 = AVX2, 1 = SSE4.1, 0 = scalar
+  inline int32_t
+  _stripedLevel() {
+#ifdef DELLY_STRIPED_X86
+    static int32_t const level = (__builtin_cpu_supports("avx2") ? 2 : (__builtin_cpu_supports("sse4.1") ? 1 : 0));
+    return level;
+#else
+    return 0;
+#endif
+  }
+
+  // Striped kernels use saturated 16-bit scores and a strictly negative gap extension
+  template<typename TScoreObject>
+  inline bool
+  _stripedFits(std::string const& s1, std::string const& s2, TScoreObject const& sc) {
+    if ((s1.empty()) || (s2.empty())) return false;
+    if (sc.ge >= 0) return false;
+    int64_t maxCost = std::max(std::max(std::abs((int64_t) sc.match), std::abs((int64_t) sc.mismatch)), std::abs((int64_t) sc.ge));
+    return ((int64_t) (s1.size() + s2.size() + 1) * maxCost < DELLY_STRIPED_MAXSCORE);
+  }
+
+  template<typename TAlignConfig, typename TScoreObject>
+  inline int32_t
+  _stripedNeedle(std::string const& s1, std::string const& s2, bool const horizontalFree, TAlignConfig const& ac, TScoreObject const& sc)
+  {
+#ifdef DELLY_STRIPED_X86
+    if (_stripedFits(s1, s2, sc)) {
+      int32_t level = _stripedLevel();
+      if (level == 2) return _stripedNeedleAVX2(s1, s2, horizontalFree, sc.match, sc.mismatch, sc.ge);
+      else if (level == 1) return _stripedNeedleSSE41(s1, s2, horizontalFree, sc.match, sc.mismatch, sc.ge);
+    }
+#endif
+    return needleScore(s1, s2, ac, sc);
+  }
+
+  // Score-only global alignment, identical to needleScore and needle
+  template<typename TAlignConfig, typename TScoreObject>
+  inline int32_t
+  stripedNeedleScore(std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc)
+  {
+    return needleScore(s1, s2, ac, sc);
+  }
+
+  template<typename TScoreObject>
+  inline int32_t
+  stripedNeedleScore(std::string const& s1, std::string const& s2, AlignConfig<false, false> const& ac, TScoreObject const& sc)
+  {
+    return _stripedNeedle(s1, s2, false, ac, sc);
+  }
+
+  // Free end gaps in s2
+  template<typename TScoreObject>
+  inline int32_t
+  stripedNeedleScore(std::string const& s1, std::string const& s2, AlignConfig<true, false> const& ac, TScoreObject const& sc)
+  {
+    return _stripedNeedle(s1, s2, true, ac, sc);
+  }
+
+}
+
+#endif
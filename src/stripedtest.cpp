@@ -0,0 +1,122 @@
+#include <iostream>
+#include <cstdlib>
+#include <string>
+
+#define BOOST_DISABLE_ASSERTS
+
+#include "util.h"
+#include "striped.h"
+
+using namespace torali;
+
+// Randomized equivalence of the striped SIMD kernels with the scalar aligner
+
+
+inline std::string
+_randomSequence(int32_t const len) {
+  std::string s;
+  for(int32_t i = 0; i < len; ++i) s.push_back("ACGTN"[std::rand() % 5]);
+  return s;
+}
+
+// Point mutations and short indels, keeps most pairs in the high-scoring regime of the assembly probes
+inline std::string
+_mutateSequence(std::string const& s) {
+  std::string t;
+  for(uint32_t i = 0; i < s.size(); ++i) {
+    int32_t r = std::rand() % 100;
+    if (r < 5) t.push_back("ACGT"[std::rand() % 4]);
+    else if (r < 7) continue;
+    else if (r < 9) {
+      t.push_back(s[i]);
+      t.append(_randomSequence(1 + std::rand() % 4));
+    } else t.push_back(s[i]);
+  }
+  if (t.empty()) t.push_back(s[0]);
+  return t;
+}
+
+// Recompute the score of a traceback, rows have to spell s1 and s2 without gaps
+template<typename TAlignConfig, typename TScoreObject>
+inline bool
+_rescoreAlignment(boost::multi_array<char, 2> const& align, std::string const& s1, std::string const& s2, TAlignConfig const& ac, TScoreObject const& sc, int32_t& score) {
+  std::string r1;
+  std::string r2;
+  score = 0;
+  for(uint32_t j = 0; j < align.shape()[1]; ++j) {
+    if ((align[0][j] == '-') && (align[1][j] == '-')) return false;
+    if (align[0][j] == '-') {
+      score += _horizontalGap(ac, r1.size(), s1.size(), sc.ge);
+      r2.push_back(align[1][j]);
+    } else if (align[1][j] == '-') {
+      score += _verticalGap(ac, r2.size(), s2.size(), sc.ge);
+      r1.push_back(align[0][j]);
+    } else {
+      score += (align[0][j] == align[1][j]) ? sc.match : sc.mismatch;
+      r1.push_back(align[0][j]);
+      r2.push_back(align[1][j]);
+    }
+  }
+  return ((r1 == s1) && (r2 == s2));
+}
+
+template<typename TAlignConfig>
+inline uint32_t
+_checkPair(std::string const& s1, std::string const& s2, bool const horizontalFree, TAlignConfig const& ac, DnaScore<int> const& sc, uint32_t& nsimd) {
+  uint32_t mismatches = 0;
+  int32_t scalar = needleScore(s1, s2, ac, sc);
+
+  // Striped kernels
+  if (stripedNeedleScore(s1, s2, ac, sc) != scalar) ++mismatches;
+#ifdef DELLY_STRIPED_X86
+  if (_stripedFits(s1, s2, sc)) {
+    int32_t level = _stripedLevel();
+    if (level >= 1) {
+      if (_stripedNeedleSSE41(s1, s2, horizontalFree, sc.match, sc.mismatch, sc.ge) != scalar) ++mismatches;
+      ++nsimd;
+    }
+    if (level >= 2) {
+      if (_stripedNeedleAVX2(s1, s2, horizontalFree, sc.match, sc.mismatch, sc.ge) != scalar) ++mismatches;
+      ++nsimd;
+    }
+  }
+#else
+  (void) horizontalFree;
+#endif
+
+  // Traceback
+  typedef boost::multi_array<char, 2> TAlign;
+  TAlign align;
+  int32_t traced = needle(s1, s2, align, ac, sc);
+  int32_t rescored = 0;
+  if ((traced != scalar) || (!_rescoreAlignment(align, s1, s2, ac, sc, rescored)) || (rescored != scalar)) ++mismatches;
+  return mismatches;
+}
+
+
+int main(int argc, char **argv) {
+  uint32_t ncases = 20000;
+  uint32_t seed = 1;
+  if (argc > 1) ncases = std::atoi(argv[1]);
+  if (argc > 2) seed = std::atoi(argv[2]);
+  std::srand(seed);
+
+  uint32_t mismatches = 0;
+  uint32_t nsimd = 0;
+  for(uint32_t i = 0; i < ncases; ++i) {
+    std::string s1 = _randomSequence(1 + std::rand() % 300);
+    std::string s2;
+    if (std::rand() % 2) s2 = _mutateSequence(s1);
+    else s2 = _randomSequence(1 + std::rand() % 300);
+    DnaScore<int> sc(1 + std::rand() % 6, -1 - std::rand() % 6, -10, -1 - std::rand() % 4);
+    uint32_t m = 0;
+    if (std::rand() % 2) m = _checkPair(s1, s2, false, AlignConfig<false, false>(), sc, nsimd);
+    else m = _checkPair(s1, s2, true, AlignConfig<true, false>(), sc, nsimd);
+    if (m) {
+      if (!mismatches) std::cerr << "Mismatch: " << s1 << ' ' << s2 << " (" << sc.match << ',' << sc.mismatch << ',' << sc.ge << ')' << std::endl;
+      mismatches += m;
+    }
+  }
+  std::cout << ncases << " cases, " << nsimd << " SIMD alignments, " << mismatches << " mismatches" << std::endl;
+  return (mismatches == 0) ? 0 : 1;
+}
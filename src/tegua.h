@@ -29,6 +29,9 @@
 #include "cluster.h"
 #include "assemble.h"
 #include "modvcf.h"
+#include "metrics.h"
+#include "refcache.h"
+#include "iothreads.h"
 
 namespace torali {
 
@@ -58,6 +61,9 @@ namespace torali {
     std::vector<boost::filesystem::path> files;
     boost::filesystem::path genome;
     boost::filesystem::path exclude;
+    boost::filesystem::path metricsfile;
+    boost::filesystem::path refcache;
+    int32_t iothreads;
     std::vector<std::string> sampleName;
   };
   
@@ -117,11 +123,18 @@ namespace torali {
      typedef boost::unordered_map<std::size_t, TSvPosVector> TReadSV;
      TReadSV tmpStore;
 
+     // Primary alignments of split-reads for assembly
+     std::vector<AssemblyReads> asmReads;
+
      // SV Discovery
-     _clusterSRReads(c, validRegions, svc, tmpStore);
+     int32_t stage = metricsStart("discovery");
+     if (!_clusterSRReads(c, validRegions, svc, tmpStore, asmReads)) return 1;
+     metricsStop(stage);
      
      // Assemble
-     assemble(c, validRegions, svc, tmpStore);
+     stage = metricsStart("assembly");
+     assemble(c, validRegions, svc, tmpStore, asmReads);
+     metricsStop(stage);
 
      // Sort SVs
      sort(svc.begin(), svc.end(), SortSVs<StructuralVariantRecord>());
@@ -137,7 +150,12 @@ namespace torali {
        lastSV = *svIter;
        svs.push_back(*svIter);
      }
-   } else vcfParse(c, hdr, svs);   // Re-genotyping
+   } else {
+     // Re-genotyping
+     int32_t stage = metricsStart("vcfparse");
+     vcfParse(c, hdr, svs);
+     metricsStop(stage);
+   }
    // Clean-up
    bam_hdr_destroy(hdr);
    sam_close(samfile);
@@ -209,15 +227,25 @@ namespace torali {
    }
       
    // Reference SV Genotyping
-   trackRef(c, svs, srStore, jctMap, rcMap);
+   int32_t stage = metricsStart("genotyping");
+   if (!trackRef(c, svs, srStore, jctMap, rcMap)) return 1;
+   metricsStop(stage);
 
    // VCF Output
+   stage = metricsStart("output");
    vcfOutput(c, svs, jctMap, rcMap, spanMap);
+   metricsStop(stage);
 
 #ifdef PROFILE
    ProfilerStop();
 #endif
 
+   // All files are closed
+   ioThreadsDestroy();
+
+   // Metrics report
+   if (!metricsWrite()) return 1;
+
    // End
    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] Done." << std::endl;;
@@ -239,8 +267,11 @@ namespace torali {
      ("svtype,t", boost::program_options::value<std::string>(&svtype)->default_value("ALL"), "SV type to compute [DEL, INS, DUP, INV, BND, ALL]")
      ("technology,y", boost::program_options::value<std::string>(&mode)->default_value("ont"), "seq. technology [pb, ont]")
      ("genome,g", boost::program_options::value<boost::filesystem::path>(&c.genome), "genome fasta file")
+     ("ref-cache", boost::program_options::value<boost::filesystem::path>(&c.refcache), "memory-mapped genome cache file, built on first use (optional)")
      ("exclude,x", boost::program_options::value<boost::filesystem::path>(&c.exclude), "file with regions to exclude")
      ("outfile,o", boost::program_options::value<boost::filesystem::path>(&c.outfile)->default_value("sv.bcf"), "SV BCF output file")
+     ("metrics", boost::program_options::value<boost::filesystem::path>(&c.metricsfile), "per-stage JSON metrics report (optional)")
+     ("io-threads", boost::program_options::value<int32_t>(&c.iothreads)->default_value(0), "additional threads for BAM/CRAM/BCF (de)compression")
      ;
    
    boost::program_options::options_description disc("Discovery options");
@@ -397,6 +428,21 @@ namespace torali {
    // Check output directory
    if (!_outfileValid(c.outfile)) return 1;
 
+   // Reference cache?
+   if (vm.count("ref-cache")) {
+     if (!_outfileValid(c.refcache)) return 1;
+     referenceCacheEnable(c.genome, c.refcache);
+   }
+
+   // Per-stage metrics?
+   if (vm.count("metrics")) {
+     if (!_outfileValid(c.metricsfile)) return 1;
+     metricsEnable("lr", c.metricsfile);
+   }
+   
+   // Shared I/O thread pool
+   if (!ioThreadsEnable(c.iothreads)) return 1;
+
    // Show cmd
    boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
    std::cout << '[' << boost::posix_time::to_simple_string(now) << "] ";
@@ -11,6 +11,8 @@
 #include <sstream>
 #include <math.h>
 #include "tags.h"
+#include "metrics.h"
+#include "iothreads.h"
 
 
 namespace torali
@@ -19,6 +21,10 @@ namespace torali
   #ifndef LAST_BIN
   #define LAST_BIN 65535
   #endif
+
+  #ifndef DELLY_LIBRARY_SEEDS
+  #define DELLY_LIBRARY_SEEDS 8
+  #endif
   
   struct LibraryInfo {
     int32_t rs;
@@ -526,92 +532,218 @@ namespace torali
     stdDev = sqrt(stdDev / (TValue) count);
   }
 
-  template<typename TConfig, typename TValidRegion, typename TSampleLibrary>
+  // Alignment file and index of one sample, cached per thread and reopened when the thread switches samples
+  struct SampleHandle {
+    int32_t file_c;
+    samFile* samfile;
+    hts_idx_t* idx;
+
+    SampleHandle() : file_c(-1), samfile(NULL), idx(NULL) {}
+  };
+
   inline void
-  getLibraryParams(TConfig const& c, TValidRegion const& validRegions, TSampleLibrary& sampleLib) {
-    typedef typename TValidRegion::value_type TChrIntervals;
+  _sampleHandleClose(SampleHandle& h) {
+    if (h.idx != NULL) hts_idx_destroy(h.idx);
+    if (h.samfile != NULL) sam_close(h.samfile);
+    h.file_c = -1;
+    h.samfile = NULL;
+    h.idx = NULL;
+  }
+
+  // Returns false if the file or index cannot be opened or any other thread failed before
+  template<typename TConfig>
+  inline bool
+  _sampleHandleOpen(TConfig const& c, uint32_t const file_c, SampleHandle& h, bool& failed) {
+    bool abort = false;
+#pragma omp critical (samplehandle)
+    abort = failed;
+    if (abort) return false;
+    if (h.file_c == (int32_t) file_c) return true;
+    _sampleHandleClose(h);
+    h.samfile = sam_open(c.files[file_c].string().c_str(), "r");
+    if ((h.samfile != NULL) && (hts_set_fai_filename(h.samfile, c.genome.string().c_str()) == 0)) h.idx = sam_index_load(h.samfile, c.files[file_c].string().c_str());
+    if (h.idx == NULL) {
+#pragma omp critical (samplehandle)
+      {
+	if (!failed) std::cerr << "Fail to open file or index " << c.files[file_c].string() << std::endl;
+	failed = true;
+      }
+      _sampleHandleClose(h);
+      return false;
+    }
+    // Thread-local BAM decoding already runs in parallel, the pool pays off for CRAM slices
+    if (hts_get_format(h.samfile)->format == cram) ioThreadsAttach(h.samfile);
+    h.file_c = file_c;
+    return true;
+  }
+
+  // Insert sizes and read lengths of one seed region of one sample, kept as value counts
+  struct LibrarySample {
+    uint32_t file_c;
+    uint32_t seed;
+    uint32_t processedNumPairs;
+    uint32_t processedNumReads;
+    uint32_t rplus;
+    uint32_t nonrplus;
+    std::map<uint32_t, uint32_t> isize;
+    std::map<uint32_t, uint32_t> readSize;
+
+    LibrarySample(uint32_t const f, uint32_t const s) : file_c(f), seed(s), processedNumPairs(0), processedNumReads(0), rplus(0), nonrplus(0) {}
+  };
+
+  // Query interval of a seed region, clip skips alignments starting left of a cut valid region
+  struct LibrarySeedInterval {
+    int32_t refIndex;
+    uint32_t start;
+    uint32_t end;
+    bool clip;
+
+    LibrarySeedInterval(int32_t const r, uint32_t const s, uint32_t const e, bool const cl) : refIndex(r), start(s), end(e), clip(cl) {}
+  };
 
-    // Open file handles
-    typedef std::vector<samFile*> TSamFile;
-    typedef std::vector<hts_idx_t*> TIndex;
-    typedef std::vector<bam_hdr_t*> TSamHeader;
-    TSamFile samfile(c.files.size());
-    TIndex idx(c.files.size());
-    TSamHeader hdr(c.files.size());
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      samfile[file_c] = sam_open(c.files[file_c].string().c_str(), "r");
-      hts_set_fai_filename(samfile[file_c], c.genome.string().c_str());
-      idx[file_c] = sam_index_load(samfile[file_c], c.files[file_c].string().c_str());
-      hdr[file_c] = sam_hdr_read(samfile[file_c]);
+  // Element at rank n/2 of the sorted values
+  inline uint32_t
+  _medianCount(std::map<uint32_t, uint32_t> const& counts, uint64_t const n) {
+    uint64_t rank = n / 2;
+    uint64_t cum = 0;
+    for(std::map<uint32_t, uint32_t>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+      cum += it->second;
+      if (cum > rank) return it->first;
+    }
+    return 0;
+  }
+
+  // Split the valid regions into seeds of equal length, each seed is a contiguous genomic stretch
+  template<typename TValidRegion>
+  inline void
+  _librarySeeds(TValidRegion const& validRegions, uint32_t const numSeeds, std::vector<std::vector<LibrarySeedInterval> >& seeds) {
+    typedef typename TValidRegion::value_type TChrIntervals;
+    uint64_t genomeLen = 0;
+    for(uint32_t refIndex = 0; refIndex < validRegions.size(); ++refIndex) {
+      for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); vRIt != validRegions[refIndex].end(); ++vRIt) genomeLen += vRIt->upper() - vRIt->lower();
+    }
+    seeds.clear();
+    seeds.resize(numSeeds);
+    if (!genomeLen) return;
+    uint64_t offset = 0;
+    for(uint32_t refIndex = 0; refIndex < validRegions.size(); ++refIndex) {
+      for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); vRIt != validRegions[refIndex].end(); ++vRIt) {
+	uint32_t pos = vRIt->lower();
+	while (pos < vRIt->upper()) {
+	  uint32_t seed = (offset * numSeeds) / genomeLen;
+	  uint64_t seedEnd = ((seed + 1) * genomeLen + numSeeds - 1) / numSeeds;
+	  uint32_t end = vRIt->upper();
+	  if (offset + (end - pos) > seedEnd) end = pos + (seedEnd - offset);
+	  seeds[seed].push_back(LibrarySeedInterval(refIndex, pos, end, (pos != vRIt->lower())));
+	  offset += end - pos;
+	  pos = end;
+	}
+      }
     }
+  }
 
-    // Iterate all samples
+  template<typename TConfig, typename TValidRegion, typename TSampleLibrary>
+  inline bool
+  getLibraryParams(TConfig const& c, TValidRegion const& validRegions, TSampleLibrary& sampleLib) {
+    // Each sample is sampled across the same seed regions, every seed gets an equal share of the alignment limits
+    uint32_t maxAlignmentsScreened=10000000 / DELLY_LIBRARY_SEEDS;
+    uint32_t maxNumAlignments=1000000 / DELLY_LIBRARY_SEEDS;
+    uint32_t minNumAlignments=1000;
+    typedef std::vector<LibrarySeedInterval> TSeedIntervals;
+    std::vector<TSeedIntervals> seeds;
+    _librarySeeds(validRegions, DELLY_LIBRARY_SEEDS, seeds);
+    std::vector<LibrarySample> tasks;
     for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
-      uint32_t maxAlignmentsScreened=10000000;
-      uint32_t maxNumAlignments=1000000;
-      uint32_t minNumAlignments=1000;
-      uint32_t alignmentCount=0;
-      uint32_t processedNumPairs = 0;
-      uint32_t processedNumReads = 0;
-      uint32_t rplus = 0;
-      uint32_t nonrplus = 0;
-      typedef std::vector<uint32_t> TSizeVector;
-      TSizeVector vecISize;
-      TSizeVector readSize;
-
-      // Collect insert sizes
-      bool libCharacterized = false;
-      for(uint32_t refIndex=0; refIndex < (uint32_t) hdr[0]->n_targets; ++refIndex) {
-	if (validRegions[refIndex].empty()) continue;
-	for(typename TChrIntervals::const_iterator vRIt = validRegions[refIndex].begin(); ((vRIt != validRegions[refIndex].end()) && (!libCharacterized)); ++vRIt) {
-	  hts_itr_t* iter = sam_itr_queryi(idx[file_c], refIndex, vRIt->lower(), vRIt->upper());
+      for(uint32_t seed = 0; seed < seeds.size(); ++seed) {
+	if (!seeds[seed].empty()) tasks.push_back(LibrarySample(file_c, seed));
+      }
+    }
+
+    bool failed = false;
+#pragma omp parallel default(shared)
+    {
+      // Thread-local file handle, tasks are sample-major
+      SampleHandle sh;
+
+#pragma omp for schedule(dynamic)
+      for(int32_t task = 0; task < (int32_t) tasks.size(); ++task) {
+	LibrarySample& ls = tasks[task];
+	uint32_t file_c = ls.file_c;
+	if (!_sampleHandleOpen(c, file_c, sh, failed)) continue;
+
+	// Collect insert sizes
+	uint32_t alignmentCount=0;
+	bool libCharacterized = false;
+	TSeedIntervals const& si = seeds[ls.seed];
+	for(uint32_t k = 0; ((k < si.size()) && (!libCharacterized)); ++k) {
+	  hts_itr_t* iter = sam_itr_queryi(sh.idx, si[k].refIndex, si[k].start, si[k].end);
 	  bam1_t* rec = bam_init1();
-	  while (sam_itr_next(samfile[file_c], iter, rec) >= 0) {
+	  uint64_t nread = 0;
+	  while (sam_itr_next(sh.samfile, iter, rec) >= 0) {
+	    ++nread;
+	    if ((si[k].clip) && (rec->core.pos < (int32_t) si[k].start)) continue;
 	    if (!(rec->core.flag & BAM_FREAD2) && (rec->core.l_qseq < 65000)) {
 	      if (rec->core.flag & (BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP | BAM_FSUPPLEMENTARY | BAM_FUNMAP)) continue;
-	      if ((alignmentCount > maxAlignmentsScreened) || ((processedNumReads >= maxNumAlignments) && (processedNumPairs == 0)) || (processedNumPairs >= maxNumAlignments)) {
+	      if ((alignmentCount > maxAlignmentsScreened) || ((ls.processedNumReads >= maxNumAlignments) && (ls.processedNumPairs == 0)) || (ls.processedNumPairs >= maxNumAlignments)) {
 		  // Paired-end library with enough pairs
 		  libCharacterized = true;
 		  break;
 	      }
 	      ++alignmentCount;
-	      
+
 	      // Single-end
-	      if (processedNumReads < maxNumAlignments) {
-		readSize.push_back(rec->core.l_qseq);
-		++processedNumReads;
+	      if (ls.processedNumReads < maxNumAlignments) {
+		++ls.readSize[rec->core.l_qseq];
+		++ls.processedNumReads;
 	      }
-	      
+
 	      // Paired-end
 	      if ((rec->core.flag & BAM_FPAIRED) && !(rec->core.flag & BAM_FMUNMAP) && (rec->core.tid==rec->core.mtid)) {
-		if (processedNumPairs < maxNumAlignments) {
-		  vecISize.push_back(abs(rec->core.isize));
-		  if (getSVType(rec->core) == 2) ++rplus;
-		  else ++nonrplus;
-		  ++processedNumPairs;
+		if (ls.processedNumPairs < maxNumAlignments) {
+		  ++ls.isize[abs(rec->core.isize)];
+		  if (getSVType(rec->core) == 2) ++ls.rplus;
+		  else ++ls.nonrplus;
+		  ++ls.processedNumPairs;
 		}
 	      }
 	    }
 	  }
 	  bam_destroy1(rec);
+	  metricsReads(nread);
 	  hts_itr_destroy(iter);
-	  if (libCharacterized) break;
 	}
-	if (libCharacterized) break;
       }
-    
-      // Get library parameters
-      if (processedNumReads >= minNumAlignments) {
-	std::sort(readSize.begin(), readSize.end());
-	sampleLib[file_c].rs = readSize[readSize.size() / 2];
+
+      _sampleHandleClose(sh);
+    }
+    if (failed) return false;
+
+    // Merge seeds in sample order, counts make medians independent of the thread schedule
+    uint32_t task = 0;
+    for(uint32_t file_c = 0; file_c < c.files.size(); ++file_c) {
+      uint32_t processedNumPairs = 0;
+      uint32_t processedNumReads = 0;
+      uint32_t rplus = 0;
+      uint32_t nonrplus = 0;
+      std::map<uint32_t, uint32_t> isize;
+      std::map<uint32_t, uint32_t> readSize;
+      for(; ((task < tasks.size()) && (tasks[task].file_c == file_c)); ++task) {
+	LibrarySample const& ls = tasks[task];
+	processedNumPairs += ls.processedNumPairs;
+	processedNumReads += ls.processedNumReads;
+	rplus += ls.rplus;
+	nonrplus += ls.nonrplus;
+	for(std::map<uint32_t, uint32_t>::const_iterator it = ls.isize.begin(); it != ls.isize.end(); ++it) isize[it->first] += it->second;
+	for(std::map<uint32_t, uint32_t>::const_iterator it = ls.readSize.begin(); it != ls.readSize.end(); ++it) readSize[it->first] += it->second;
       }
+
+      // Get library parameters
+      if (processedNumReads >= minNumAlignments) sampleLib[file_c].rs = _medianCount(readSize, processedNumReads);
       if (processedNumPairs >= minNumAlignments) {
-	std::sort(vecISize.begin(), vecISize.end());
-	int32_t median = vecISize[vecISize.size() / 2];
-	std::vector<uint32_t> absDev;
-	for(uint32_t i = 0; i < vecISize.size(); ++i) absDev.push_back(std::abs((int32_t) vecISize[i] - median));
-	std::sort(absDev.begin(), absDev.end());
-	int32_t mad = absDev[absDev.size() / 2];
+	int32_t median = _medianCount(isize, processedNumPairs);
+	std::map<uint32_t, uint32_t> absDev;
+	for(std::map<uint32_t, uint32_t>::const_iterator it = isize.begin(); it != isize.end(); ++it) absDev[std::abs((int32_t) it->first - median)] += it->second;
+	int32_t mad = _medianCount(absDev, processedNumPairs);
 
 	// Get default library orientation
 	if ((median >= 50) && (median<=100000)) {
@@ -637,13 +769,7 @@ namespace torali
 	}
       }
     }
-
-    // Clean-up
-    for(unsigned int file_c = 0; file_c < c.files.size(); ++file_c) {
-      bam_hdr_destroy(hdr[file_c]);
-      hts_idx_destroy(idx[file_c]);
-      sam_close(samfile[file_c]);
-    }
+    return true;
   }
 
 